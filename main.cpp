@@ -10,10 +10,39 @@
 #include <algorithm>
 #include <cstdlib>
 #include <csignal>
-#include <conio.h>
-#include <windows.h>
 #include <regex>
 #include <sstream>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <list>
+#include <functional>
+#include <memory>
+#include <limits>
+#include <numeric>
+#include <cmath>
+#include <type_traits>
+#if defined(__SSE2__) || defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+#ifdef _WIN32
+    #include <conio.h>
+    #include <windows.h>
+#else
+    #include <poll.h>
+    #include <termios.h>
+    #include <sys/ioctl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
 
 
 using namespace std;
@@ -50,89 +79,1319 @@ struct Song
     float duration;
 };
 
+// Run of bytes inside SongStore::arena
+struct TextRef
+{
+    uint32_t offset = 0;
+    uint32_t length = 0;
+};
+
+// Playlist kept as parallel columns. Artist and album names are interned,
+// file paths are split into an interned directory and a file name, and
+// titles and file names share one text arena. Song is only built at the
+// edges (prompts, playback, journal payloads).
+struct SongStore
+{
+    vector<TextRef> titles;
+    vector<TextRef> fileNames;
+    vector<uint32_t> artists;       // Ids into names
+    vector<uint32_t> albums;
+    vector<uint32_t> directories;   // Ids into directoryNames
+    vector<int32_t> years;
+    vector<float> durations;
+    vector<uint32_t> ids;           // Stable per-song id, kept across reorders
+
+    string arena;
+    size_t deadBytes = 0;           // Arena bytes no song refers to any more
+    vector<string> names;
+    unordered_map<string, uint32_t> nameIds;
+    vector<string> directoryNames;  // Each ends with a separator, or is empty
+    unordered_map<string, uint32_t> directoryIds;
+    uint64_t version = 0;           // Bumped on every change
+    uint64_t contentVersion = 0;    // Bumped when songs change, but not on reorders
+    uint32_t nextId = 0;
+
+    size_t size() const { return years.size(); }
+    bool empty() const { return years.empty(); }
+    string_view text(TextRef ref) const { return string_view(arena.data() + ref.offset, ref.length); }
+    string_view title(size_t i) const { return text(titles[i]); }
+    const string& artist(size_t i) const { return names[artists[i]]; }
+    const string& album(size_t i) const { return names[albums[i]]; }
+    string filepath(size_t i) const;
+    Song get(size_t i) const;
+
+    void add(const Song& song);
+    void set(size_t i, const Song& song);
+    void erase(size_t i);
+    void permute(const vector<uint32_t>& order);
+    void reserve(size_t count);
+    size_t memoryUsage() const;
+
+    TextRef storeText(string_view value);
+    uint32_t internName(const string& name);
+    uint32_t internDirectory(string_view directory);
+    void compactArena();
+};
+
+// Playlist file format (v2): header, fixed-width record table, string blob
+const string PLAYLIST_FILE = "playlist_data/playlist.dat";
+const char PLAYLIST_MAGIC[8] = {'B', 'T', 'S', 'P', 'L', 'A', 'Y', '\0'};
+const uint32_t PLAYLIST_VERSION = 2;
+
+struct PlaylistFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    uint64_t recordCount;
+    uint64_t recordOffset;
+    uint64_t blobOffset;
+    uint64_t blobSize;
+    uint64_t journalSequence;   // Last journal record folded into this snapshot
+    uint64_t checksum;      // Covers the record table and the string blob
+};
+
+// Strings are stored as (offset, length) pairs into the blob
+struct PlaylistFileRecord
+{
+    uint32_t titleOffset;
+    uint32_t titleLength;
+    uint32_t artistOffset;
+    uint32_t artistLength;
+    uint32_t filepathOffset;
+    uint32_t filepathLength;
+    uint32_t albumOffset;
+    uint32_t albumLength;
+    int32_t year;
+    float duration;
+};
+
+static_assert(sizeof(PlaylistFileHeader) == 64, "playlist header must stay 64 bytes");
+static_assert(sizeof(PlaylistFileRecord) == 40, "playlist record must stay 40 bytes");
+
+// Playlist journal: append-only log of edits applied on top of the snapshot
+const string PLAYLIST_JOURNAL_FILE = "playlist_data/playlist.journal";
+
+enum JournalOp : uint8_t
+{
+    JOURNAL_ADD = 1,
+    JOURNAL_REMOVE = 2,
+    JOURNAL_EDIT = 3,
+    JOURNAL_REORDER = 4
+};
+
+// Each record is this header, the payload, then a checksum of both
+struct JournalRecordHeader
+{
+    uint32_t payloadSize;
+    uint8_t op;
+    uint8_t padding[3];
+    uint64_t sequence;
+};
+
+static_assert(sizeof(JournalRecordHeader) == 16, "journal record header must stay 16 bytes");
+
+// Bounds-checked cursor over a journal payload
+struct PayloadReader
+{
+    string_view data;
+    size_t pos = 0;
+
+    bool readU32(uint32_t& value)
+    {
+        if (data.size() - pos < sizeof(value)) return false;
+        memcpy(&value, data.data() + pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    bool readString(string_view& text)
+    {
+        uint32_t length;
+        if (!readU32(length) || data.size() - pos < length) return false;
+        text = data.substr(pos, length);
+        pos += length;
+        return true;
+    }
+};
+
+// Snapshot is rewritten in the background once this many records pile up
+const size_t JOURNAL_COMPACT_THRESHOLD = 512;
+
+// A failed write is retried after this delay, doubling up to the maximum;
+// on exit the writer gives up after WRITER_EXIT_ATTEMPTS tries
+const int WRITER_RETRY_MS = 250;
+const int WRITER_RETRY_MAX_MS = 8000;
+const int WRITER_EXIT_ATTEMPTS = 3;
+
+struct SaveStats
+{
+    size_t requests = 0;        // Save requests received from the UI
+    size_t writes = 0;          // Batches actually written to disk
+    size_t merged = 0;          // Requests folded into another request's write
+    size_t failures = 0;
+    size_t retries = 0;         // Failed batches put back for another try
+    double lastLatencyMs = 0.0;
+    double maxLatencyMs = 0.0;
+    double totalLatencyMs = 0.0;
+};
+
+// Writer thread that owns every disk write of the playlist. Requests that
+// arrive while it is busy are merged into the next batch.
+struct PlaylistWriter
+{
+    thread worker;
+    mutex lock;
+    condition_variable wake;
+    bool stopping = false;
+
+    bool snapshotPending = false;
+    SongStore snapshot;
+    uint64_t snapshotSequence = 0;
+    string journalBytes;        // Records newer than any pending snapshot
+    size_t pendingRequests = 0;
+
+    // A failed append may leave part of a record at the end of the journal,
+    // so nothing more is appended until a snapshot truncates it
+    bool journalBroken = false;
+    bool snapshotWanted = false;    // Asks the UI for a snapshot, cleared when it is sent
+    bool failing = false;           // The last write failed; cleared by the next good one
+    bool failureShown = false;      // UI side: the user has heard about this failure
+
+    SaveStats stats;
+};
+
+struct PlaylistJournal
+{
+    PlaylistWriter writer;
+    uint64_t nextSequence = 1;
+    size_t recordCount = 0;
+    bool readOnly = false;      // The snapshot could not be read; nothing on disk is touched this session
+};
+
+// Read-only memory mapping of a whole file
+struct MappedFile
+{
+    const char* data = nullptr;
+    size_t size = 0;
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+
+    MappedFile() = default;
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile() { close(); }
+
+    bool open(const string& path);
+    void close();
+};
+
+// Zero-copy view over a mapped v2 playlist file
+struct PlaylistFileView
+{
+    const PlaylistFileHeader* header = nullptr;
+    const PlaylistFileRecord* records = nullptr;
+    const char* blob = nullptr;
+
+    size_t size() const { return header ? header->recordCount : 0; }
+    string_view text(uint32_t offset, uint32_t length) const { return string_view(blob + offset, length); }
+};
+
+// Metadata read straight from container headers, without a decoder
+struct AudioProbe
+{
+    float duration = 0.0f;
+    unsigned sampleRate = 0;
+    unsigned channels = 0;
+    string title;
+    string artist;
+    string album;
+    int year = 0;
+};
+
+// Largest WAV LIST chunk read for tags. Chunk sizes come from the file and
+// may be garbage; real INFO lists are a few hundred bytes.
+const uint32_t WAV_INFO_MAX_SIZE = 64 * 1024;
+
+// Probe results persisted across runs, keyed by normalized path and
+// invalidated when the file size or modification time changes
+const string PROBE_CACHE_FILE = "playlist_data/probe.cache";
+const char PROBE_CACHE_MAGIC[8] = {'B', 'T', 'S', 'P', 'R', 'O', 'B', '\0'};
+const uint32_t PROBE_CACHE_VERSION = 1;
+
+struct ProbeCacheEntry
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    AudioProbe probe;
+};
+
+struct ProbeCache
+{
+    mutex lock;
+    unordered_map<string, ProbeCacheEntry> entries;
+    atomic<size_t> hits{0};
+    atomic<size_t> misses{0};
+    bool dirty = false;
+};
+
+// Loudness analysis results, cached the same way as probes. Playback looks
+// them up and applies them; nothing is measured at play time.
+const string LOUDNESS_CACHE_FILE = "playlist_data/loudness.cache";
+const char LOUDNESS_CACHE_MAGIC[8] = {'B', 'T', 'S', 'L', 'O', 'U', 'D', '\0'};
+const uint32_t LOUDNESS_CACHE_VERSION = 1;
+const float LOUDNESS_TARGET_LUFS = -18.0f;     // ReplayGain 2.0 reference level
+const float LOUDNESS_MAX_BOOST_DB = 12.0f;
+const float SILENCE_THRESHOLD = 0.001f;         // -60 dBFS; quieter edges are skipped
+
+struct LoudnessInfo
+{
+    float integratedLufs = 0.0f;    // EBU R128 / ITU-R BS.1770 gated loudness
+    float peak = 0.0f;              // Sample peak, 1.0 = full scale
+    float gainDb = 0.0f;            // To reach the target, limited so the peak does not clip
+    float leadingSilence = 0.0f;    // Seconds
+    float trailingSilence = 0.0f;
+};
+
+struct LoudnessCacheEntry
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    LoudnessInfo info;
+};
+
+struct LoudnessCache
+{
+    mutex lock;
+    unordered_map<string, LoudnessCacheEntry> entries;
+    bool dirty = false;
+};
+
+// Streaming BS.1770 meter: K-weighting, 100 ms sub-blocks combined into
+// 400 ms gating blocks, plus peak and silence edges
+struct LoudnessMeter
+{
+    unsigned sampleRate = 0;
+    unsigned channels = 0;
+    double shelf[5] = {};               // Stage 1 biquad b0 b1 b2 a1 a2
+    double highPass[5] = {};            // Stage 2
+    vector<double> state;               // Four filter taps per channel and stage
+    size_t subBlockFrames = 0;
+    size_t subBlockFill = 0;
+    double subBlockEnergy = 0.0;
+    vector<double> subBlocks;           // Mean square of every 100 ms
+    float peak = 0.0f;
+    uint64_t frames = 0;
+    uint64_t firstAudible = UINT64_MAX;
+    uint64_t lastAudible = 0;
+
+    void start(unsigned rate, unsigned channelCount);
+    void add(const sf::Int16* samples, size_t count);
+    LoudnessInfo finish() const;
+};
+
+// Time-to-byte tables for Ogg and FLAC, built from page granule positions
+// and frame headers, so a seek can fetch the bytes it lands on before the
+// decoder searches for them. Cached like probes.
+const string SEEK_INDEX_FILE = "playlist_data/seek.cache";
+const char SEEK_INDEX_MAGIC[8] = {'B', 'T', 'S', 'S', 'E', 'E', 'K', '\0'};
+const uint32_t SEEK_INDEX_VERSION = 1;
+const unsigned SEEK_TABLE_SPACING = 1;          // Seconds between entries
+
+struct SeekTable
+{
+    uint32_t sampleRate = 0;
+    vector<uint64_t> frames;                    // First sample frame decoded from offsets[i]
+    vector<uint64_t> offsets;                   // Byte offset of that Ogg page or FLAC frame
+
+    uint64_t offsetFor(uint64_t frame) const;
+};
+
+struct SeekIndexEntry
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+    shared_ptr<const SeekTable> table;          // Shared with the streams playing the file
+};
+
+struct SeekIndex
+{
+    mutex lock;
+    unordered_map<string, SeekIndexEntry> entries;
+    bool dirty = false;
+};
+
+// Decoded audio of recent, upcoming and searched-for tracks, held under one
+// byte budget. A worker thread decodes each requested track: short ones in
+// full, so they play and seek without touching the disk, and longer ones
+// only for their opening, so playback starts from memory while the decoder
+// seeks and fills in behind. The least recently used are evicted once the
+// budget is exceeded.
+const float PREROLL_SECONDS = 3.0f;
+const size_t AUDIO_MEMORY_MIN_MB = 16;          // The default budget is a share of installed memory,
+const size_t AUDIO_MEMORY_MAX_MB = 256;         // kept within these; --memory-mb <n> overrides it
+const size_t AUDIO_MEMORY_RAM_SHARE = 64;
+const size_t AUDIO_FULL_DECODE_SHARE = 4;       // Tracks needing at most budget / 4 are decoded in full
+const size_t AUDIO_MEMORY_MAX_REQUESTS = 16;    // The oldest waiting requests are dropped beyond this
+const size_t AUDIO_MEMORY_LOOKAHEAD = 2;        // Queue entries warmed after the current one
+const size_t AUDIO_MEMORY_SEARCH_RESULTS = 3;   // Top search results warmed while typing
+
+struct DecodedAudio
+{
+    uint64_t size = 0;                          // File size and mtime when decoded
+    int64_t mtime = 0;
+    unsigned sampleRate = 0;
+    unsigned channels = 0;
+    bool complete = false;                      // The whole track, not just its opening
+    vector<sf::Int16> samples;                  // From the start of the file, before trimming and gain
+};
+
+struct AudioMemoryEntry
+{
+    shared_ptr<const DecodedAudio> clip;
+    list<string>::iterator recent;              // Position in AudioMemory::recency
+};
+
+struct AudioMemory
+{
+    thread worker;
+    mutex lock;
+    condition_variable wake;
+    bool stopping = false;
+
+    size_t budgetBytes = AUDIO_MEMORY_MIN_MB << 20;
+    size_t usedBytes = 0;
+    deque<string> requests;                     // Most urgent first
+    list<string> recency;                       // Most recently used first
+    unordered_map<string, AudioMemoryEntry> entries;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+};
+
+// Inverted trigram index over lowercased title, album and artist. Songs
+// get a stable id so reorders and removals do not rewrite posting lists.
+// Removed songs leave an empty slot until enough pile up to renumber.
+struct SearchIndex
+{
+    vector<string> text;            // Lowercased search text per song id
+    vector<uint64_t> letters;       // Per song id, bit (c & 63) set for each byte c in text
+    vector<uint32_t> idAt;          // Playlist position -> song id
+    vector<uint32_t> positionOf;    // Song id -> playlist position, UINT32_MAX once removed
+    unordered_map<uint32_t, vector<uint32_t>> postings;     // Trigram -> sorted song ids
+    size_t deadIds = 0;             // Slots of removed songs
+};
+
+// Type-ahead state: one result set per prefix of the query, so a new
+// character filters the previous result and backspace pops back to it
+struct SearchSession
+{
+    string query;                           // Lowercased query typed so far
+    vector<vector<uint32_t>> results;       // results[i] matches query.substr(0, i + 1)
+};
+
+// Query word prepared for bit-parallel approximate matching
+struct FuzzyPattern
+{
+    uint64_t peq[256] = {};     // Bit i set where the word's i-th letter is that byte
+    uint64_t letters = 0;       // Same letter mask as SearchIndex::letters
+    int length = 0;
+    int maxErrors = 0;
+};
+
+struct FuzzyMatch
+{
+    uint32_t position;
+    float score;                // Lower is better
+};
+
+// Import work item: a directory to list or an audio file to probe
+struct ImportTask
+{
+    fs::path path;
+    bool isDirectory = false;
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+// Per-worker task deque; the owner pops from the back, thieves take the front
+struct ImportQueue
+{
+    mutex lock;
+    deque<ImportTask> tasks;
+};
+
+struct ImportStats
+{
+    size_t directories = 0;
+    size_t filesProbed = 0;
+    size_t failed = 0;
+    size_t duplicates = 0;
+    double seconds = 0.0;
+};
+
+// Numeric column kept sorted by value for range lookups
+struct SortedColumn
+{
+    vector<float> values;
+    vector<uint32_t> positions;     // Playlist position of each value
+};
+
+// Songs sharing one album or artist. Common values keep a bitmap over
+// playlist positions; rare ones keep a position list, which is smaller.
+struct ValueColumn
+{
+    vector<uint64_t> bitmap;
+    vector<uint32_t> positions;
+};
+
+// Per-column indexes for structured filters, built on first use and
+// rebuilt whenever the library version changes
+struct FilterIndex
+{
+    uint64_t version = UINT64_MAX;
+    size_t songCount = 0;
+    size_t words = 0;               // 64-bit words per bitmap
+    SortedColumn years;
+    SortedColumn durations;
+    unordered_map<string, ValueColumn> albums;      // Keyed by lowercased name
+    unordered_map<string, ValueColumn> artists;
+};
+
+enum SortField
+{
+    SORT_TITLE,
+    SORT_ALBUM,
+    SORT_ARTIST,
+    SORT_YEAR,
+    SORT_DURATION
+};
+
+// Collation ranks and finished sort orders. Text keys are case-folded
+// once and replaced by integer ranks, so sorting compares integers only.
+// Everything is dropped when song content changes; reorders keep it.
+struct SortCache
+{
+    uint64_t contentVersion = UINT64_MAX;
+    vector<uint32_t> titleRanks;        // By stable song id
+    vector<uint32_t> nameRanks;         // By interned name id (artists and albums)
+    unordered_map<string, vector<uint32_t>> orders;     // Sort spec -> stable ids in order
+    size_t hits = 0;
+    size_t misses = 0;
+};
+
+enum FilterField
+{
+    FILTER_YEAR,
+    FILTER_DURATION,
+    FILTER_ALBUM,
+    FILTER_ARTIST
+};
+
+// One clause of a filter query. Numeric clauses select [low, high);
+// name clauses select any of the listed values.
+struct FilterPredicate
+{
+    FilterField field;
+    bool negate = false;
+    double low = 0.0;
+    double high = 0.0;
+    vector<string> values;
+};
+
+// One character cell of the terminal. A wide glyph fills two cells and the
+// right-hand one holds glyph 0.
+struct ScreenCell
+{
+    uint32_t glyph = ' ';
+    uint16_t style = 0;     // Foreground | background << 4 | bold << 8; colours as SGR code - 29, 0 = default
+
+    bool operator==(const ScreenCell& other) const { return glyph == other.glyph && style == other.style; }
+    bool operator!=(const ScreenCell& other) const { return !(*this == other); }
+};
+
+// Double-buffered cell grid for the full-screen views. A view draws the next
+// frame into back; present() compares it with front, which mirrors what the
+// terminal shows, and writes only the changed cells plus the cursor moves and
+// colour changes they need, in one write.
+struct TerminalScreen
+{
+    int columns = 0;
+    int rows = 0;
+    vector<ScreenCell> front;
+    vector<ScreenCell> back;
+    bool frontValid = false;    // False until a clear, and again after a resize
+    uint16_t pen = 0;           // Style used by print() and fill(), changed by escape codes in text
+
+    uint64_t frames = 0;
+    uint64_t bytesWritten = 0;
+    uint64_t cellsWritten = 0;
+
+    void begin();
+    int put(int row, int column, uint32_t glyph);
+    int print(int row, int column, string_view text);
+    int fill(int row, int column, int count, uint32_t glyph);
+    void present(int cursorRow, int cursorColumn);
+    void clear();
+};
+
+TerminalScreen terminal;
+
+#ifndef _WIN32
+// Second half of a translated arrow or paging key, handed out by the next read
+int pendingScanCode = -1;
+#endif
+
+// Blocks until a key arrives or a deadline passes, instead of polling the
+// keyboard. On POSIX the terminal is in raw mode while the waiter is open.
+struct InputWaiter
+{
+#ifdef _WIN32
+    HANDLE input = nullptr;
+#else
+    termios saved;
+    bool raw = false;
+#endif
+
+    InputWaiter() = default;
+    InputWaiter(const InputWaiter&) = delete;
+    InputWaiter& operator=(const InputWaiter&) = delete;
+    ~InputWaiter() { close(); }
+
+    void open();
+    void close();
+    int wait(int timeoutMs);    // Key code; -1 on timeout, resize or other console events
+};
+
+enum PlayerCommandType : uint8_t
+{
+    PLAYER_PLAY,            // Replace the play queue with the slot's queue, start at command.index
+    PLAYER_TOGGLE_PAUSE,
+    PLAYER_STOP,
+    PLAYER_NEXT,
+    PLAYER_PREVIOUS,
+    PLAYER_RESTART,
+    PLAYER_SEEK,            // By value seconds
+    PLAYER_VOLUME,          // By value percent
+    PLAYER_TOGGLE_REPEAT,
+    PLAYER_TOGGLE_LATENCY,  // Switch the stream between power-saving and low-latency buffering
+    PLAYER_CROSSFADE,       // Overlap consecutive tracks by value seconds, 0 for gapless joins
+    PLAYER_TOGGLE_FADE_CURVE,
+    PLAYER_TOGGLE_EQ,       // Turn the equalizer on or off
+    PLAYER_QUIT
+};
+
+// What the player works through: rows of a playlist snapshot that is
+// never modified, so queues cut from the same playlist version share it
+struct PlayQueue
+{
+    shared_ptr<const SongStore> songs;
+    vector<uint32_t> rows;          // Positions in songs, in play order
+
+    size_t size() const { return rows.size(); }
+    string filepath(size_t i) const { return songs->filepath(rows[i]); }
+    Song get(size_t i) const { return songs->get(rows[i]); }
+};
+
+// Kept trivially copyable so a ring slot is a plain copy; the queue a
+// PLAYER_PLAY carries travels beside it in PlayerEngine::queues
+struct PlayerCommand
+{
+    PlayerCommandType type = PLAYER_STOP;
+    float value = 0.0f;
+    uint32_t index = 0;
+};
+
+static_assert(is_trivially_copyable<PlayerCommand>::value, "player commands must stay trivially copyable");
+
+// Where the last track picked started playing from
+enum StartSource : uint8_t
+{
+    START_COLD,             // Opened and decoded from the file
+    START_PREROLL,          // Its decoded opening, then the file
+    START_MEMORY            // Decoded in full; the file is not read at all
+};
+
+// What the player screens draw, published by the player thread under a
+// sequence lock. Text is kept in fixed arrays so the state can be copied
+// with memcpy.
+struct PlayerState
+{
+    uint64_t track = 0;         // Bumped by every PLAYER_PLAY, even one that fails
+    uint64_t applied = 0;       // Commands processed so far
+    bool active = false;        // A song is loaded and not finished
+    bool paused = false;
+    bool repeat = false;
+    bool failed = false;        // The last PLAYER_PLAY could not open its file
+    float position = 0.0f;
+    float duration = 0.0f;
+    float volume = 100.0f;
+    int32_t year = 0;
+    uint32_t queuePosition = 0;
+    uint32_t queueLength = 0;
+
+    uint32_t transitions = 0;           // Automatic moves to the next track
+    uint32_t gaplessTransitions = 0;    // Of those, joined inside the stream
+    float lastGapMs = 0.0f;             // Silence between the last two tracks
+    float maxGapMs = 0.0f;
+
+    bool lowLatency = false;
+    float bufferMs = 0.0f;              // Decoded ahead of playback
+    float bufferTargetMs = 0.0f;        // What the decoder fills up to in this mode
+    uint64_t underruns = 0;             // Chunks padded with silence because the decoder fell behind
+    float lastSeekMs = 0.0f;            // Time the last seek held up the player thread
+    float lastStartMs = 0.0f;           // From opening the last track picked to its first audio
+    StartSource lastStartFrom = START_COLD;
+    uint64_t bytesMapped = 0;
+    uint64_t coldPages = 0;
+    uint64_t readStalls = 0;
+    float crossfadeSeconds = 0.0f;
+    bool equalPowerFade = true;
+    bool normalized = false;            // The track has cached loudness and is played at its gain
+    float gainDb = 0.0f;
+    bool eqEnabled = false;
+    float dspLoad = 0.0f;               // Percent of one core the DSP chain takes while it runs
+    float dspLastBlockUs = 0.0f;
+    float dspMaxBlockUs = 0.0f;
+    char eqPreset[32] = {};
+    char title[128] = {};
+    char artist[64] = {};
+    char album[64] = {};
+};
+
+const size_t PLAYER_QUEUE_SIZE = 64;
+
+enum StreamMode : uint8_t
+{
+    STREAM_POWER_SAVING,    // Decode far ahead in large batches, wake rarely
+    STREAM_LOW_LATENCY      // Keep only a few small chunks queued
+};
+
+struct StreamTuning
+{
+    int chunkMs;            // Audio handed to SFML per onGetData() call
+    int aheadMs;            // The decoder fills the ring up to this much
+    int refillMs;           // and is woken again when it drains below this
+};
+
+const StreamTuning STREAM_TUNING[] = {{100, 2000, 500}, {20, 60, 40}};  // By StreamMode
+const size_t STREAM_JOIN_SLOTS = 64;
+
+enum FadeCurve : uint8_t
+{
+    FADE_LINEAR,            // Gains sum to one; correlated material keeps its level
+    FADE_EQUAL_POWER        // Powers sum to one; avoids the dip between unrelated songs
+};
+
+const float CROSSFADE_CHOICES[] = {0.0f, 2.0f, 5.0f, 10.0f};   // Cycled with X in the player
+
+// Playback decodes out of a memory mapping instead of SFML's buffered file
+// reads, and asks the kernel to page in the window ahead of the reader, so
+// seeks and track changes find the bytes resident
+const size_t MAPPED_READAHEAD_BYTES = 1 << 20;
+const int MAPPED_READ_STALL_US = 1000;          // A read slower than this waited on the disk
+
+struct MappedReadStats
+{
+    atomic<uint64_t> bytesMapped{0};
+    atomic<uint64_t> bytesRead{0};
+    atomic<uint64_t> coldPages{0};              // Pages not yet resident when their window was hinted (POSIX only)
+    atomic<uint64_t> stalls{0};
+};
+
+// sf::InputStream over a MappedFile. The decoder's read() is the only copy.
+class MappedInputStream : public sf::InputStream
+{
+public:
+    bool open(const string& path, MappedReadStats& counters);
+    void prefetch(uint64_t offset);
+    sf::Int64 read(void* data, sf::Int64 size) override;
+    sf::Int64 seek(sf::Int64 position) override;
+    sf::Int64 tell() override;
+    sf::Int64 getSize() override;
+
+private:
+    size_t missingPages(uint64_t offset, size_t length) const;
+
+    MappedFile file;
+    uint64_t position = 0;
+    uint64_t hintedFrom = 0;                    // Readahead window last requested
+    uint64_t hintedUntil = 0;
+    MappedReadStats* stats = nullptr;
+};
+
+// The decoder is declared last so it is destroyed before the mapping it reads
+struct MappedSoundFile
+{
+    MappedInputStream data;
+    sf::InputSoundFile decoder;
+};
+
+// Parametric equalizer settings, shared by the Equalizer screen (writes)
+// and the audio thread (reads). Built-in presets come first; the user's own
+// presets follow them and are saved with the playlist.
+const string EQ_PRESET_FILE = "playlist_data/equalizer.dat";
+const char EQ_PRESET_MAGIC[8] = {'B', 'T', 'S', 'E', 'Q', 'L', 'Z', '\0'};
+const uint32_t EQ_PRESET_VERSION = 1;
+const size_t EQ_BANDS = 6;
+const float EQ_MAX_GAIN_DB = 12.0f;
+const size_t EQ_PRESET_NAME_LENGTH = 24;
+
+enum EqBandType : uint8_t
+{
+    EQ_PEAK,
+    EQ_LOW_SHELF,
+    EQ_HIGH_SHELF
+};
+
+struct EqBand
+{
+    EqBandType type = EQ_PEAK;
+    float frequency = 1000.0f;      // Hz
+    float gainDb = 0.0f;
+    float q = 1.0f;                 // Bandwidth for peaks, slope for shelves
+};
+
+struct EqPreset
+{
+    string name;
+    EqBand bands[EQ_BANDS];
+};
+
+struct Equalizer
+{
+    mutex lock;
+    vector<EqPreset> presets;
+    size_t builtIn = 0;             // Presets before this index cannot be edited or deleted
+    size_t active = 0;
+    bool enabled = false;
+    bool dirty = false;
+    atomic<uint64_t> version{0};    // Bumped after every change so the audio thread redesigns its filters
+};
+
+// Per-block cost of the DSP chain, written by SFML's thread
+struct DspStats
+{
+    atomic<uint64_t> blocks{0};
+    atomic<uint64_t> busyNs{0};     // Spent in the chain
+    atomic<uint64_t> audioNs{0};    // Audio those blocks last when played
+    atomic<float> lastBlockUs{0.0f};
+    atomic<float> maxBlockUs{0.0f};
+};
+
+// One step of the chain between the decoder and the output. Stages work in
+// place on interleaved float frames at 16-bit scale and keep their state
+// from block to block; reset() is called on a seek.
+class DspStage
+{
+public:
+    virtual ~DspStage() {}
+    virtual void configure(unsigned int sampleRate, unsigned int channels) = 0;
+    virtual void reset() = 0;
+    virtual bool prepare() = 0;     // Before each block; false skips the stage
+    virtual void process(float* samples, size_t frames) = 0;
+};
+
+// Transposed direct form II biquads side by side, one per lane. Arrays are
+// padded to a multiple of BIQUAD_LANE_WIDTH; padding lanes pass zeros.
+const size_t BIQUAD_LANE_WIDTH = 8;
+
+struct BiquadLanes
+{
+    size_t count = 0;
+    vector<float> b0, b1, b2, a1, a2;
+    vector<float> z1, z2;
+    vector<float> x, y;             // This step's inputs and outputs
+};
+
+// Cascaded biquad bands for every channel. Each lane is one band of one
+// channel (lane = band * channels + channel), so all bands of all channels
+// run in one vector step: band 0 takes the new frame and every later band
+// takes its predecessor's output from the step before. The cascade is thus
+// pipelined and delays the signal by EQ_BANDS - 1 frames.
+class ParametricEq : public DspStage
+{
+public:
+    explicit ParametricEq(Equalizer& settings) : settings(settings) {}
+
+    void configure(unsigned int sampleRate, unsigned int channels) override;
+    void reset() override;
+    bool prepare() override;
+    void process(float* samples, size_t frames) override;
+
+private:
+    void design(const EqPreset& preset);
+
+    Equalizer& settings;
+    uint64_t designed = 0;          // Settings version the coefficients match
+    bool stale = true;
+    bool enabled = false;
+    unsigned int rate = 0;
+    unsigned int channelCount = 0;
+    BiquadLanes lanes;
+};
+
+// A file in the stream with the loudness adjustments for it
+struct StreamSource
+{
+    unique_ptr<MappedSoundFile> file;   // Not opened when the whole track is in memory
+    shared_ptr<const DecodedAudio> memory;
+    uint64_t memoryAt = 0;              // Next sample read from memory
+    unsigned sampleRate = 0;
+    unsigned channels = 0;
+    string path;
+    shared_ptr<const SeekTable> seekTable;
+    float gain = 1.0f;              // Linear
+    sf::Time start;                 // Leading silence skipped
+    uint64_t end = 0;               // Sample offset where trailing silence begins
+    uint64_t resumeAt = 0;          // Sample offset to seek to before the next read, if not 0
+
+    bool isOpen() const { return file || memory; }
+    uint64_t offset() const { return memory ? memoryAt : resumeAt ? resumeAt : file->decoder.getSampleOffset(); }
+};
+
+// Streams the play queue back to back. A decode thread keeps a lock-free
+// single-producer single-consumer ring of samples filled ahead of playback,
+// and onGetData() only copies out of it, so SFML's thread never waits on
+// the disk or the decoder; if the ring runs dry the gap is filled with
+// silence and counted. While a track plays the next file is opened and its
+// first chunk decoded, and the decoder runs straight from one file into the
+// next, so tracks join without a gap. Files with another channel count or
+// sample rate cannot be joined and end the stream instead. Every file is
+// played at its analyzed gain, without its silent edges. A track decoded in
+// full by AudioMemory is read from there instead of its file.
+class PlaybackStream : public sf::SoundStream
+{
+public:
+    PlaybackStream();
+    ~PlaybackStream();
+
+    bool open(const string& path, const LoudnessInfo& level, shared_ptr<const DecodedAudio> audio, float& duration);
+    bool prepareNext(const string& path, const LoudnessInfo& level, shared_ptr<const DecodedAudio> audio, float& duration);
+    void dropNext();
+    bool hasNext();
+    void attachSeekTable(const string& path, shared_ptr<const SeekTable> table);
+    bool takeBoundary(sf::Time played, sf::Time& boundary);
+    void setCrossfade(float seconds, FadeCurve curve);
+    void setMode(StreamMode newMode);
+    StreamMode getMode() const { return mode.load(); }
+    float bufferedMs() const;
+    uint64_t underrunCount() const { return underruns.load(); }
+    const MappedReadStats& readStats() const { return reads; }
+    float startLatencyMs() const { return startMs.load(); }
+    void addDspStage(unique_ptr<DspStage> stage);
+    const DspStats& dspStats() const { return dsp; }
+
+protected:
+    bool onGetData(Chunk& data) override;
+    void onSeek(sf::Time timeOffset) override;
+
+private:
+    void runDecoder();
+    void decodeAhead();
+    bool openSource(StreamSource& source, const string& path, const LoudnessInfo& level,
+                    shared_ptr<const DecodedAudio> audio, float& duration);
+    size_t readSource(StreamSource& source, sf::Int16* samples, size_t count);
+    void usePreroll(StreamSource& source, const DecodedAudio& clip, vector<sf::Int16>& head);
+    size_t readCurrent(sf::Int16* samples, size_t count);
+    bool addJoin(uint64_t position);
+    void runDsp(sf::Int16* samples, size_t count);
+    void wakeDecoder();
+    void signalRefill();
+    size_t samplesFor(int ms) const;
+
+    // Decoder side, guarded by lock
+    mutex lock;
+    StreamSource current;                       // File being decoded
+    StreamSource next;                          // Opened ahead, joined when current ends
+    StreamSource previous;                      // Left by the last join: kept for a seek until the join
+                                                // is heard, and read until a crossfade out of it ends
+    bool joinPending = false;                   // A join is decoded but not heard yet
+    vector<sf::Int16> pending;                  // Decoded ahead from the start of current
+    size_t pendingRead = 0;
+    vector<sf::Int16> nextPending;
+    int crossfadeMs = 0;
+    FadeCurve fadeCurve = FADE_EQUAL_POWER;
+    uint64_t fadeTotal = 0;                     // Samples in the running crossfade
+    uint64_t fadeLeft = 0;
+    vector<sf::Int16> fadeOut;                  // Scratch for the outgoing track
+    unsigned int sampleRate = 0;                // Copies of the stream format for the decoder
+    unsigned int channelCount = 0;
+
+    // Written only by the decoder, read only by SFML's thread; indices
+    // count samples since the last seek and wrap through ringMask
+    vector<sf::Int16> ring;
+    size_t ringMask = 0;
+    atomic<uint64_t> writeIndex{0};
+    atomic<uint64_t> readIndex{0};
+    atomic<bool> finished{false};               // Nothing left to decode
+    uint64_t joins[STREAM_JOIN_SLOTS] = {};     // Ring index where a joined file starts
+    atomic<uint64_t> joinsWritten{0};
+    atomic<uint64_t> joinsRead{0};
+
+    // SFML's thread
+    vector<sf::Int16> chunk;
+    vector<unique_ptr<DspStage>> dspStages;     // Added before the first track plays
+    vector<float> dspBuffer;
+    DspStats dsp;
+    uint64_t fed = 0;                           // Samples handed to SFML since the last seek, silence included
+    mutex boundaryLock;
+    deque<sf::Time> boundaries;                 // Stream offsets where a joined file starts
+
+    atomic<StreamMode> mode{STREAM_POWER_SAVING};
+    atomic<uint64_t> underruns{0};
+    MappedReadStats reads;
+    chrono::steady_clock::time_point openedAt;  // Set by open() before SFML's thread starts
+    atomic<bool> starting{false};               // No audio handed to SFML since open()
+    atomic<float> startMs{0.0f};
+
+    // Parks the decoder between refills
+    mutex sleepLock;
+    condition_variable wake;
+    bool wakeRequested = false;
+    bool quitting = false;
+    thread decoder;
+
+    // SFML's thread waits on this, under sleepLock, when the ring runs dry
+    condition_variable refilled;
+    bool awaitingRefill = false;
+};
+
+// Playback thread that owns the audio stream and the play queue, so music
+// keeps going while the menus run. Commands travel through a single-producer single-consumer
+// ring (only the UI thread pushes); state comes back as PlayerState
+// snapshots that any screen can read without taking a lock.
+struct PlayerEngine
+{
+    thread worker;
+    PlayerCommand commands[PLAYER_QUEUE_SIZE];
+    shared_ptr<const PlayQueue> queues[PLAYER_QUEUE_SIZE];    // PLAYER_PLAY queue for the same slot
+    atomic<size_t> head{0};         // Next command the player takes
+    atomic<size_t> tail{0};         // Next free slot for the UI
+    uint64_t sent = 0;              // Commands pushed, UI side only
+
+    PlayerState state;
+    atomic<uint64_t> sequence{0};   // Odd while state is being rewritten
+
+    mutex sleepLock;                // Only parks the idle player thread
+    condition_variable wake;
+
+    LoudnessCache* loudness = nullptr;  // Read-only lookups from the player thread
+    SeekIndex* seekIndex = nullptr;     // Also filled in by the player as files are first played
+    AudioMemory* memory = nullptr;      // Decoded tracks and openings to start from
+    Equalizer* equalizer = nullptr;     // Settings the player's EQ stage follows
+};
+
 
 // Music player functions
 void initializePlayer();
-void playSong(const Song& song, bool& shouldExit, bool repeat);
-void editSong(vector<Song>& playlist);
-void searchSongs(const vector<Song>& playlist);
-void sortPlaylist(vector<Song>& playlist);
-void addSong(vector<Song>& playlist);
-void removeSong(vector<Song>& playlist);
+void playQueue(PlayerEngine& player, shared_ptr<const PlayQueue> queue, size_t start, bool& shouldExit);
+shared_ptr<const PlayQueue> queueFrom(const SongStore& playlist, weak_ptr<const SongStore>& snapshot, vector<uint32_t> rows);
+void showPlayer(PlayerEngine& player, bool& shouldExit);
+int editSong(SongStore& playlist, ProbeCache& cache);
+vector<uint32_t> searchSongs(const SongStore& playlist, const SearchIndex& index, AudioMemory& memory);
+vector<uint32_t> sortPlaylist(SongStore& playlist, SortCache& cache);
+void addSong(SongStore& playlist, ProbeCache& cache);
+int removeSong(SongStore& playlist);
+
+// Player engine
+void startPlayer(PlayerEngine& player, LoudnessCache& loudness, SeekIndex& seekIndex, AudioMemory& memory,
+                 Equalizer& equalizer);
+void stopPlayer(PlayerEngine& player);
+void runPlayer(PlayerEngine& player);
+bool sendPlayerCommand(PlayerEngine& player, PlayerCommand command, shared_ptr<const PlayQueue> queue = nullptr);
+bool takePlayerCommand(PlayerEngine& player, PlayerCommand& command, shared_ptr<const PlayQueue>& queue);
+void publishPlayerState(PlayerEngine& player, const PlayerState& state);
+PlayerState readPlayerState(const PlayerEngine& player);
+void waitForPlayer(const PlayerEngine& player);
+
+// Mixing
+void crossfadeMix(sf::Int16* incoming, const sf::Int16* outgoing, size_t count, float start, float step, FadeCurve curve);
+void crossfadeMixScalar(sf::Int16* incoming, const sf::Int16* outgoing, size_t count, float start, float step, FadeCurve curve);
+float fadeInGain(float t, FadeCurve curve);
+void applyGain(sf::Int16* samples, size_t count, float gain);
+void applyGainScalar(sf::Int16* samples, size_t count, float gain);
+void biquadStep(BiquadLanes& lanes);
+void biquadStepScalar(BiquadLanes& lanes, size_t first = 0);
+int runCrossfadeBenchmark();
+int runEqBenchmark();
+
+// Library import
+void importLibrary(SongStore& playlist, PlaylistJournal& journal, ProbeCache& cache);
+vector<Song> scanLibrary(const fs::path& root, const unordered_set<string>& known, ProbeCache& cache, ImportStats& stats);
+bool probeImportedFile(const ImportTask& task, const fs::path& root, ProbeCache& cache, Song& song);
+
+// Search index
+void buildSearchIndex(SearchIndex& index, const SongStore& playlist);
+void indexAdd(SearchIndex& index, const SongStore& playlist, size_t position);
+void indexRemove(SearchIndex& index, size_t position);
+void compactSearchIndex(SearchIndex& index);
+void indexEdit(SearchIndex& index, size_t position, const SongStore& playlist);
+void indexReorder(SearchIndex& index, const vector<uint32_t>& order);
+vector<uint32_t> querySearchIndex(const SearchIndex& index, const string& lowerQuery);
+vector<uint32_t> extractTrigrams(string_view text);
+void searchPush(SearchSession& session, const SearchIndex& index, char ch);
+void searchPop(SearchSession& session);
+vector<uint32_t> fuzzySearch(const SearchIndex& index, const string& lowerQuery);
+int myersDistance(const uint64_t* peq, int length, string_view text, size_t& bestEnd);
+string searchText(const SongStore& playlist, size_t position);
+uint64_t letterMask(string_view text);
+
+// Sorting
+vector<uint32_t> sortOrder(const SongStore& playlist, SortCache& cache, const vector<SortField>& fields, bool& cached);
+bool parseSortFields(const string& text, vector<SortField>& fields);
+void buildSortRanks(SortCache& cache, const SongStore& playlist);
+string collationKey(string_view text);
+uint64_t collationPrefix(string_view key);
+template <typename T, typename Less>
+void parallelSort(vector<T>& items, const Less& less);
+
+// Filter queries
+vector<uint32_t> filterSongs(const SongStore& playlist, FilterIndex& index, int& selected);
+void buildFilterIndex(FilterIndex& index, const SongStore& playlist);
+bool parseFilterQuery(const string& query, vector<FilterPredicate>& predicates, string& error);
+bool parseFilterNumber(const string& text, FilterField field, double& value);
+vector<uint32_t> runFilterQuery(const FilterIndex& index, const vector<FilterPredicate>& predicates);
+void markRange(const SortedColumn& column, double low, double high, vector<uint64_t>& bitmap);
+void markValue(const ValueColumn& column, vector<uint64_t>& bitmap);
+void bitmapAnd(uint64_t* target, const uint64_t* source, size_t words);
+void bitmapOr(uint64_t* target, const uint64_t* source, size_t words);
+void bitmapAndNot(uint64_t* target, const uint64_t* source, size_t words);
+
+// Audio metadata probing
+bool probeAudioFile(const string& filepath, AudioProbe& probe);
+bool probeOgg(ifstream& file, uint64_t fileSize, AudioProbe& probe);
+bool probeFlac(ifstream& file, AudioProbe& probe);
+bool probeWav(ifstream& file, AudioProbe& probe);
+void parseVorbisComments(const char* data, size_t size, AudioProbe& probe);
+void parseWavInfo(const char* data, size_t size, AudioProbe& probe);
+void applyTag(const string& key, const string& value, AudioProbe& probe);
+bool probeAudioFileCached(ProbeCache& cache, const string& filepath, AudioProbe& probe);
+bool probeAudioFileCached(ProbeCache& cache, const string& filepath, uint64_t size, int64_t mtime, AudioProbe& probe);
+void loadProbeCache(ProbeCache& cache);
+void saveProbeCache(ProbeCache& cache);
+uint32_t readLE16(const unsigned char* bytes);
+uint32_t readLE32(const unsigned char* bytes);
+uint64_t readLE64(const unsigned char* bytes);
+uint32_t readBE32(const unsigned char* bytes);
+
+// Loudness analysis
+bool analyzeLoudness(const string& filepath, LoudnessInfo& info);
+void analyzeLibrary(const SongStore& playlist, LoudnessCache& cache);
+bool lookupLoudness(LoudnessCache& cache, const string& filepath, LoudnessInfo& info);
+void loadLoudnessCache(LoudnessCache& cache);
+void saveLoudnessCache(LoudnessCache& cache);
+
+// Seek index
+bool buildSeekTable(const MappedFile& file, SeekTable& table);
+bool buildOggSeekTable(const unsigned char* data, size_t size, SeekTable& table);
+bool buildFlacSeekTable(const unsigned char* data, size_t size, SeekTable& table);
+shared_ptr<const SeekTable> lookupSeekTable(SeekIndex& index, const string& filepath, bool build);
+void loadSeekIndex(SeekIndex& index);
+void saveSeekIndex(SeekIndex& index);
+
+// Audio memory
+void startAudioMemory(AudioMemory& memory);
+void stopAudioMemory(AudioMemory& memory);
+void runAudioMemoryWorker(AudioMemory& memory);
+void requestAudio(AudioMemory& memory, const string& filepath);
+shared_ptr<const DecodedAudio> findAudio(AudioMemory& memory, const string& filepath);
+bool decodeAudio(const string& filepath, size_t fullLimit, DecodedAudio& clip);
+size_t defaultAudioBudget();
+
+// Equalizer
+void designBiquad(const EqBand& band, unsigned int sampleRate, float coefficients[5]);
+void addBuiltInPresets(Equalizer& eq);
+void changeEqualizer(Equalizer& eq, const function<void()>& change);
+void loadEqualizer(Equalizer& eq);
+void saveEqualizer(Equalizer& eq);
+void equalizerMenu(Equalizer& eq);
+bool readEqBand(EqBand& band);
 
 // Helper functions
-string getProgressBar(float percentage, bool isPaused);
+int drawProgressBar(int row, int column, float percentage, bool isPaused);
 bool validateAudioFile(string& filepath);
+bool hasAudioExtension(const fs::path& path);
+string guessArtist(const string& title);
 string formatDuration(float seconds);
+string fitText(string_view text, size_t width);
+uint32_t decodeUtf8(string_view text, size_t& pos);
+void appendUtf8(string& out, uint32_t code);
+int glyphWidth(uint32_t code);
 string toLower(const string str);
+void parallelFor(size_t count, const function<void(size_t, size_t)>& body);
 
 // Utility code
 void clearScreen();
+void handleResize(int signal);
 void hideCursor();
 void showCursor();
+void getConsoleSize(int& columns, int& rows);
+int readKey();
+bool keyPending();
+#ifndef _WIN32
+int readTerminalKey();
+#endif
 int get_int(string prompt);
+string get_text(const string& prompt, const string& fallback);
 
 // UI functions
-void displayMenu();
-void displayPlaylist(const vector<Song>& playlist, int currentSong = -1);
-void displayProgress(sf::Music& music, const Song& song, bool isPaused, float& volume);
+int displayMenu(int row);
+int browsePlaylist(const SongStore& playlist, const string& heading, const vector<uint32_t>* rows = nullptr);
+void displayProgress(const PlayerState& state);
 void displayError(const string& message);
 void displaySuccess(const string& message);
 void displayInfo(const string& message);
 void displayHelp();
-void displayLogo();
-void displayNowPlaying(const Song& song, bool isPaused, ostream& out);
+void displayStatistics(const SongStore& playlist, PlaylistJournal& journal, ProbeCache& cache, LoudnessCache& loudness, SeekIndex& seekIndex, AudioMemory& audio, const PlayerState& player);
+int displayLogo(int row);
+int displayNowPlaying(const PlayerState& state, int row);
+int displayPlayerStatus(const PlayerState& state, int row);
 
 
 // File I/O
-void savePlaylist(const vector<Song>& playlist);
-void loadPlaylist(vector<Song>& playlist);
-
-
-int main()
+void savePlaylist(const SongStore& playlist, uint64_t journalSequence = 0);
+string serializePlaylist(const SongStore& playlist, uint64_t journalSequence);
+bool writeFileData(const string& path, const string& data, bool append);
+bool writeFileAtomically(const string& path, const string& data);
+void startPlaylistWriter(PlaylistWriter& writer);
+void stopPlaylistWriter(PlaylistWriter& writer);
+void runPlaylistWriter(PlaylistWriter& writer);
+bool pollPlaylistWriter(PlaylistWriter& writer);
+void submitSnapshot(PlaylistWriter& writer, const SongStore& playlist, uint64_t journalSequence);
+void submitJournalRecord(PlaylistWriter& writer, const string& record);
+void loadPlaylist(SongStore& playlist, PlaylistJournal& journal);
+void compactPlaylist(const SongStore& playlist, PlaylistJournal& journal);
+void journalAdd(PlaylistJournal& journal, const Song& song);
+void journalRemove(PlaylistJournal& journal, size_t index);
+void journalEdit(PlaylistJournal& journal, size_t index, const Song& song);
+void journalReorder(PlaylistJournal& journal, const vector<uint32_t>& order);
+void appendJournal(PlaylistJournal& journal, JournalOp op, const string& payload);
+uint64_t replayJournal(SongStore& playlist, uint64_t snapshotSequence);
+void putU32(string& out, uint32_t value);
+void putString(string& out, const string& text);
+void putSong(string& out, const Song& song);
+bool readSong(PayloadReader& reader, Song& song, const fs::path& basePath, const string& basePrefix);
+string storedPathFor(const string& filepath, const fs::path& basePath, const string& basePrefix);
+string resolveStoredPath(string_view storedPath, const fs::path& basePath, const string& basePrefix);
+void loadLegacyPlaylist(SongStore& playlist);
+void loadPlaylistView(SongStore& playlist, const PlaylistFileView& view);
+bool openPlaylistView(const MappedFile& file, PlaylistFileView& view);
+uint64_t checksumBytes(const char* data, size_t size);
+bool readCacheHeader(const MappedFile& file, const char (&magic)[8], uint32_t version, size_t minimumEntrySize,
+                     PayloadReader& reader, uint32_t& count);
+
+
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && string(argv[1]) == "--bench-crossfade")
+    {
+        return runCrossfadeBenchmark();
+    }
+    if (argc > 1 && string(argv[1]) == "--bench-eq")
+    {
+        return runEqBenchmark();
+    }
+
     initializePlayer();
-    SetConsoleOutputCP(CP_UTF8);
-    SetConsoleTitle("BTS Music Player");
-    vector<Song> playlist;
+    SongStore playlist;
+    PlaylistJournal journal;
+    ProbeCache probeCache;
+    LoudnessCache loudnessCache;
+    SeekIndex seekIndex;
+    SearchIndex searchIndex;
+    FilterIndex filterIndex;
+    SortCache sortCache;
+    PlayerEngine player;
+    weak_ptr<const SongStore> playingSnapshot;  // Playlist copy behind the player's queue
+    AudioMemory audioMemory;
+    Equalizer equalizer;
     char choice;
     bool isPlaying = false;
     bool shouldExit = false;
 
-    // Load saved playlist
-    loadPlaylist(playlist);
+    audioMemory.budgetBytes = defaultAudioBudget();
+    for (int i = 1; i + 1 < argc; ++i)
+    {
+        if (string(argv[i]) == "--memory-mb")
+        {
+            audioMemory.budgetBytes = static_cast<size_t>(strtoull(argv[i + 1], nullptr, 10)) << 20;
+        }
+    }
+
+    // Load saved playlist and replay any edits journaled since the last snapshot
+    startPlaylistWriter(journal.writer);
+    loadLoudnessCache(loudnessCache);
+    loadSeekIndex(seekIndex);
+    loadEqualizer(equalizer);
+    startAudioMemory(audioMemory);
+    startPlayer(player, loudnessCache, seekIndex, audioMemory, equalizer);
+    loadPlaylist(playlist, journal);
+    loadProbeCache(probeCache);
+    buildSearchIndex(searchIndex, playlist);
 
     while (!shouldExit)
     {
-        system("CLS");
-        displayLogo();
-        displayMenu();
+        clearScreen();
+        terminal.begin();
+        int row = displayMenu(displayLogo(0));
+        row = displayPlayerStatus(readPlayerState(player), row);
+        terminal.present(row, 0);
         int choice = get_int("Choice: ");
 
         switch (choice)
         {
+            case 0: // Back to the player
+                if (readPlayerState(player).active)
+                {
+                    hideCursor();
+                    showPlayer(player, shouldExit);
+                    showCursor();
+                }
+                else
+                {
+                    displayError("Nothing is playing!");
+                }
+                break;
             case 1: // Add Song
-                addSong(playlist);
-                savePlaylist(playlist);
+            {
+                size_t previousSize = playlist.size();
+                addSong(playlist, probeCache);
+                if (playlist.size() > previousSize)
+                {
+                    journalAdd(journal, playlist.get(previousSize));
+                    indexAdd(searchIndex, playlist, previousSize);
+                }
                 break;
+            }
             case 2: // View Playlist
-                displayPlaylist(playlist);
-                cout << "\n" << CYAN << "Press Enter to continue..." << RESET;
-                cin.get();
+                browsePlaylist(playlist, "🎵 Current Playlist 🎵");
                 break;
             case 3: // Remove Song
-                removeSong(playlist);
-                savePlaylist(playlist);
+            {
+                int removed = removeSong(playlist);
+                if (removed >= 0)
+                {
+                    journalRemove(journal, removed);
+                    indexRemove(searchIndex, removed);
+                }
                 break;
+            }
             case 4: // Play Song
                 if (!playlist.empty())
                 {
-                    displayPlaylist(playlist);
-                    int index = get_int("Enter song number to play (0 to cancel): ");
-                    if (index > 0 && index <= playlist.size())
+                    int index = browsePlaylist(playlist, "🎵 Select a song to play 🎵");
+                    if (index >= 0)
                     {
+                        // Play on through the rest of the playlist
+                        vector<uint32_t> rows(playlist.size());
+                        iota(rows.begin(), rows.end(), 0);
                         hideCursor();
-                        playSong(playlist[index - 1], shouldExit, false);
+                        playQueue(player, queueFrom(playlist, playingSnapshot, move(rows)), index, shouldExit);
                     }
                 }
                 else
@@ -142,26 +1401,97 @@ int main()
                 showCursor();
                 break;
             case 5: // Edit Song
-                editSong(playlist);
-                savePlaylist(playlist);
-                break;
-            case 6: // Search Songs
-                searchSongs(playlist);
+            {
+                int edited = editSong(playlist, probeCache);
+                if (edited >= 0)
+                {
+                    journalEdit(journal, edited, playlist.get(edited));
+                    indexEdit(searchIndex, edited, playlist);
+                }
+                break;
+            }
+            case 6: // Search Songs
+            {
+                vector<uint32_t> matches = searchSongs(playlist, searchIndex, audioMemory);
+                if (!matches.empty())
+                {
+                    hideCursor();
+                    playQueue(player, queueFrom(playlist, playingSnapshot, move(matches)), 0, shouldExit);
+                    showCursor();
+                }
                 break;
+            }
             case 7: // Sort Playlist
-                sortPlaylist(playlist);
-                savePlaylist(playlist);
+            {
+                vector<uint32_t> order = sortPlaylist(playlist, sortCache);
+                if (!order.empty())
+                {
+                    journalReorder(journal, order);
+                    indexReorder(searchIndex, order);
+                }
+                break;
+            }
+            case 8: // Import Folder
+            {
+                size_t previousSize = playlist.size();
+                importLibrary(playlist, journal, probeCache);
+                for (size_t i = previousSize; i < playlist.size(); ++i)
+                {
+                    indexAdd(searchIndex, playlist, i);
+                }
+                break;
+            }
+            case 9: // Filter Songs
+            {
+                int selected;
+                vector<uint32_t> matches = filterSongs(playlist, filterIndex, selected);
+                if (selected >= 0)
+                {
+                    size_t start = find(matches.begin(), matches.end(), static_cast<uint32_t>(selected)) - matches.begin();
+                    hideCursor();
+                    playQueue(player, queueFrom(playlist, playingSnapshot, move(matches)), start, shouldExit);
+                    showCursor();
+                }
                 break;
-            case 8: // Help
+            }
+            case 10: // Analyze Loudness
+                analyzeLibrary(playlist, loudnessCache);
+                break;
+            case 11: // Equalizer
+                equalizerMenu(equalizer);
+                break;
+            case 12: // Statistics
+                displayStatistics(playlist, journal, probeCache, loudnessCache, seekIndex, audioMemory, readPlayerState(player));
+                break;
+            case 13: // Help
                 displayHelp();
                 break;
-            case 9: // Exit
+            case 14: // Exit
                 shouldExit = true;
                 break;
             default:
                 displayError("Invalid choice!");
         }
+
+        if (pollPlaylistWriter(journal.writer) || journal.recordCount >= JOURNAL_COMPACT_THRESHOLD)
+        {
+            compactPlaylist(playlist, journal);
+        }
+    }
+
+    // Fold the journal into a fresh snapshot and wait for the writer to finish
+    compactPlaylist(playlist, journal);
+    stopPlaylistWriter(journal.writer);
+    if (journal.writer.failing)
+    {
+        displayError("The playlist could not be saved; the latest changes are lost.");
     }
+    stopPlayer(player);
+    stopAudioMemory(audioMemory);
+    saveProbeCache(probeCache);
+    saveLoudnessCache(loudnessCache);
+    saveSeekIndex(seekIndex);
+    saveEqualizer(equalizer);
 
     cout << MAGENTA << "\nThank you for using BTS Music Player! 안녕히 가세요!\n" << RESET;
     return 0;
@@ -174,141 +1504,170 @@ void initializePlayer()
     // Set up terminal
     #ifdef _WIN32
         system("color");
+        SetConsoleOutputCP(CP_UTF8);
+        SetConsoleTitle("BTS Music Player");
     #else
-        // Handle terminal resize for Unix-like systems
-        signal(SIGWINCH, handleResize);
+        cout << "\033]0;BTS Music Player\007" << flush;
+
+        // Handle terminal resize for Unix-like systems. SA_RESTART keeps
+        // getline and other blocking reads going through a resize; poll is
+        // never restarted, so InputWaiter::wait still wakes up for it.
+        struct sigaction action = {};
+        action.sa_handler = handleResize;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(SIGWINCH, &action, nullptr);
     #endif
 
     // Create save directory if it doesn't exist
     fs::create_directories("playlist_data");
 }
 
-void playSong(const Song& song, bool& shouldExit, bool repeat)
+void playQueue(PlayerEngine& player, shared_ptr<const PlayQueue> queue, size_t start, bool& shouldExit)
 {
-    sf::Music music;
-    if (!music.openFromFile(song.filepath))
+    uint64_t track = readPlayerState(player).track;
+    PlayerCommand command;
+    command.type = PLAYER_PLAY;
+    command.index = static_cast<uint32_t>(start);
+    sendPlayerCommand(player, command, move(queue));
+    waitForPlayer(player);
+
+    PlayerState state = readPlayerState(player);
+    if (state.track == track || state.failed)
     {
         displayError("Error loading music file!");
         return;
     }
+    showPlayer(player, shouldExit);
+}
+
+shared_ptr<const PlayQueue> queueFrom(const SongStore& playlist, weak_ptr<const SongStore>& snapshot, vector<uint32_t> rows)
+{
+    // Reuse the snapshot the player already holds while the playlist is
+    // unchanged; only an edit since then costs a copy
+    auto songs = snapshot.lock();
+    if (!songs || songs->version != playlist.version)
+    {
+        songs = make_shared<const SongStore>(playlist);
+        snapshot = songs;
+    }
 
-    music.play();
-    bool isPaused = false;
-    float currentVolume = 100.0f;
-    music.setVolume(static_cast<float>(currentVolume));
+    auto queue = make_shared<PlayQueue>();
+    queue->songs = move(songs);
+    queue->rows = move(rows);
+    return queue;
+}
 
+void showPlayer(PlayerEngine& player, bool& shouldExit)
+{
+    InputWaiter waiter;
+    waiter.open();
     clearScreen();
 
-    auto lastUpdateTime = chrono::steady_clock::now();
-    while (music.getStatus() != sf::Music::Stopped && !shouldExit)
+    while (true)
     {
-        auto now = chrono::steady_clock::now();
-        if (chrono::duration_cast<chrono::milliseconds>(now - lastUpdateTime).count() >= 100)
+        // The song keeps playing on the player thread; this screen only
+        // draws snapshots and sends commands
+        PlayerState state = readPlayerState(player);
+        if (!state.active)
         {
-            displayProgress(music, song, isPaused, currentVolume);
-            lastUpdateTime = now;
+            return;     // Finished or stopped
         }
+        displayProgress(state);
 
-        if (music.getStatus() == sf::Music::Stopped)
+        // Sleep until a key, the next progress tick or the end of the track.
+        // Nothing moves while paused, so then only a key wakes the screen.
+        int timeout = -1;
+        if (!state.paused)
         {
-            if (repeat)
-            {
-                music.setPlayingOffset(sf::Time::Zero);
-                music.play();
-            }
-            else
-            {
-                // If not repeating, just exit the function to move to next song
-                return;
-            }
+            timeout = max(5, min(100, static_cast<int>((state.duration - state.position) * 1000.0f)));
         }
 
-        if (_kbhit())
+        int key = waiter.wait(timeout);
+        switch (key)
         {
-            char input = _getch();
-            bool needsRedraw = false;
-            switch (input)
-            {
-                case ' ': // Pause/Resume
-                    if (isPaused)
-                        music.play();
-                    else
-                        music.pause();
-                    isPaused = !isPaused;
-                    needsRedraw = true;
-                    break;
-                case 'q': // Stop
-                    music.stop();
-                    return;
-                case 27: // ESC - Exit program
-                    shouldExit = true;
-                    music.stop();
-                    return;
-                case 'r': // Restart
-                    music.setPlayingOffset(sf::Time::Zero);
-                    needsRedraw = true;
-                    break;
-                case '>': // Forward 5 seconds
-                    music.setPlayingOffset(music.getPlayingOffset() + sf::seconds(5.f));
-                    needsRedraw = true;
-                    break;
-                case '<': // Backward 5 seconds
-                    {
-                        sf::Time newTime = music.getPlayingOffset() - sf::seconds(5.f);
-                        music.setPlayingOffset(newTime < sf::Time::Zero ? sf::Time::Zero : newTime);
-                        needsRedraw = true;
-                    }
-                    break;
-                case '+': // Volume up
-                case '=': // Alternative volume up
-                    currentVolume = min(currentVolume + 5.0, 100.0);
-                    music.setVolume(static_cast<float>(currentVolume));
-                    needsRedraw = true;
-                    break;
-                case '-': // Volume down
-                    currentVolume = max(currentVolume - 5.0, 0.0);
-                    music.setVolume(static_cast<float>(currentVolume));
-                    needsRedraw = true;
-                    break;
-                case 'l': // Toggle repeat
-                    repeat = !repeat;
-                    needsRedraw = true;
-                    break;
-            }
-            if (needsRedraw)
+            case ' ': // Pause/Resume
+                sendPlayerCommand(player, {PLAYER_TOGGLE_PAUSE});
+                break;
+            case 'q': // Stop
+                sendPlayerCommand(player, {PLAYER_STOP});
+                waitForPlayer(player);
+                return;
+            case 'b': // Back to the menu, music keeps playing
+                return;
+            case 'n': // Next track in the queue
+                sendPlayerCommand(player, {PLAYER_NEXT});
+                break;
+            case 'p': // Previous track in the queue
+                sendPlayerCommand(player, {PLAYER_PREVIOUS});
+                break;
+            case 27: // ESC - Exit program
+                shouldExit = true;
+                return;
+            case 'r': // Restart
+                sendPlayerCommand(player, {PLAYER_RESTART});
+                break;
+            case '>': // Forward 5 seconds
+                sendPlayerCommand(player, {PLAYER_SEEK, 5.0f});
+                break;
+            case '<': // Backward 5 seconds
+                sendPlayerCommand(player, {PLAYER_SEEK, -5.0f});
+                break;
+            case '+': // Volume up
+            case '=': // Alternative volume up
+                sendPlayerCommand(player, {PLAYER_VOLUME, 5.0f});
+                break;
+            case '-': // Volume down
+                sendPlayerCommand(player, {PLAYER_VOLUME, -5.0f});
+                break;
+            case 'l': // Toggle repeat
+                sendPlayerCommand(player, {PLAYER_TOGGLE_REPEAT});
+                break;
+            case 'm': // Toggle low-latency buffering
+                sendPlayerCommand(player, {PLAYER_TOGGLE_LATENCY});
+                break;
+            case 'x': // Next crossfade length
             {
-                displayProgress(music, song, isPaused, currentVolume);
-                lastUpdateTime = now;
+                size_t choice = 0;
+                while (choice < size(CROSSFADE_CHOICES) && CROSSFADE_CHOICES[choice] <= state.crossfadeSeconds)
+                {
+                    ++choice;
+                }
+                sendPlayerCommand(player, {PLAYER_CROSSFADE, CROSSFADE_CHOICES[choice % size(CROSSFADE_CHOICES)]});
+                break;
             }
+            case 'c': // Linear or equal-power crossfade
+                sendPlayerCommand(player, {PLAYER_TOGGLE_FADE_CURVE});
+                break;
+            case 'e': // Equalizer on/off
+                sendPlayerCommand(player, {PLAYER_TOGGLE_EQ});
+                break;
+        }
+        if (key >= 0)
+        {
+            waitForPlayer(player);
         }
-
-        this_thread::sleep_for(chrono::milliseconds(10));
     }
 }
 
-void editSong(vector<Song>& playlist)
+
+int editSong(SongStore& playlist, ProbeCache& cache)
 {
     if (playlist.empty())
     {
         displayError("🎵 The playlist is empty! Add songs to edit.");
-        return;
+        return -1;
     }
 
-    displayPlaylist(playlist);
-    int index = get_int("🎶 Enter song number to edit (0 to cancel): ");
-
-    if (index == 0)
+    int index = browsePlaylist(playlist, "🎶 Select a song to edit 🎶");
+    if (index < 0)
     {
         displayInfo("❌ Edit canceled.");
-        return;
-    }
-    if (index < 1 || index > static_cast<int>(playlist.size()))
-    {
-        displayError("🚫 Invalid song number!");
-        return;
+        return -1;
     }
 
-    Song& song = playlist[index - 1];
+    Song song = playlist.get(index);
+    Song original = song;
 
     clearScreen();
     cout << MAGENTA << "    ╔═══════════════════════════════════════════════╗\n";
@@ -364,11 +1723,11 @@ void editSong(vector<Song>& playlist)
                     getline(cin, song.filepath);
                     if (validateAudioFile(song.filepath))
                     {
-                        // Update duration
-                        sf::Music music;
-                        if (music.openFromFile(song.filepath))
+                        // Update duration from the file headers
+                        AudioProbe probe;
+                        if (probeAudioFileCached(cache, song.filepath, probe))
                         {
-                            song.duration = music.getDuration().asSeconds();
+                            song.duration = probe.duration;
                         }
                         displaySuccess("✔️ Filepath and duration updated successfully!");
                         break;
@@ -381,19 +1740,33 @@ void editSong(vector<Song>& playlist)
                 displayError("🚫 Invalid option! Please enter a number between 1 and 4.");
         }
     }
+
+    // Report the edited index only when something actually changed
+    bool changed = song.title != original.title || song.album != original.album ||
+                   song.year != original.year || song.filepath != original.filepath;
+    if (!changed)
+    {
+        return -1;
+    }
+    playlist.set(index, song);
+    return index;
 }
 
-void searchSongs(const vector<Song>& playlist)
+vector<uint32_t> searchSongs(const SongStore& playlist, const SearchIndex& index, AudioMemory& memory)
 {
     if (playlist.empty())
     {
         displayError("🎵 Playlist is empty!");
-        Sleep(1500);
-        return;
+        this_thread::sleep_for(chrono::milliseconds(1500));
+        return {};
     }
 
+    // Results are shown up to one screenful; the rest is only counted
+    const size_t maxShown = 20;
     string searchTerm;
-    vector<Song> filteredSongs;
+    SearchSession session;
+    bool fuzzy = false;
+    vector<uint32_t> ranked;
 
     while (true)
     {
@@ -403,27 +1776,22 @@ void searchSongs(const vector<Song>& playlist)
         cout << BOLD << CYAN << "╚══════════════════════════════════════════╝" << RESET << '\n' << '\n';
 
         // Get the search term from the user
-        cout << YELLOW << "Enter search term (press Esc to exit): " << RESET;
+        cout << CYAN << "Mode: " << WHITE << (fuzzy ? "Fuzzy (ranked)" : "Exact") << CYAN
+             << "   (Tab to switch)" << RESET << '\n';
+        cout << YELLOW << "Enter search term (Enter to play the results, Esc to exit): " << RESET;
         cout << searchTerm;
 
         // Perform the search if the term is not empty
         if (!searchTerm.empty())
         {
-            filteredSongs.clear();
-            string lowerSearchTerm = toLower(searchTerm);
-            for (const auto& song : playlist)
+            if (fuzzy)
             {
-                string title = toLower(song.title);
-                string album = toLower(song.album);
-
-                if (title.find(lowerSearchTerm) != string::npos || album.find(lowerSearchTerm) != string::npos)
-                {
-                    filteredSongs.push_back(song);
-                }
+                ranked = fuzzySearch(index, toLower(searchTerm));
             }
+            const vector<uint32_t>& matches = fuzzy ? ranked : session.results.back();
 
             // Display results
-            if (!filteredSongs.empty())
+            if (!matches.empty())
             {
                 cout << "\n\n";
                 cout << CYAN << "┌───────────────────────────┬───────────────────────────┐" << RESET << '\n';
@@ -431,13 +1799,24 @@ void searchSongs(const vector<Song>& playlist)
                      << CYAN << " │ " << WHITE << setw(25) << left << "Album" << CYAN << " │" << RESET << '\n';
                 cout << CYAN << "├───────────────────────────┼───────────────────────────┤" << RESET << '\n';
 
-                for (const auto& song : filteredSongs)
+                for (size_t i = 0; i < matches.size() && i < maxShown; ++i)
                 {
-                    cout << CYAN << "│ " << WHITE << setw(25) << left << song.title
-                         << CYAN << " │ " << WHITE << setw(25) << left << song.album << CYAN << " │" << RESET << '\n';
+                    cout << CYAN << "│ " << WHITE << setw(25) << left << playlist.title(matches[i])
+                         << CYAN << " │ " << WHITE << setw(25) << left << playlist.album(matches[i]) << CYAN << " │" << RESET << '\n';
                 }
 
                 cout << CYAN << "└───────────────────────────┴───────────────────────────┘" << RESET << '\n';
+                if (matches.size() > maxShown)
+                {
+                    cout << YELLOW << "... and " << matches.size() - maxShown << " more" << RESET << '\n';
+                }
+
+                // Warm the top results while the user is still typing; the
+                // best match is requested last so it is decoded first
+                for (size_t i = min(matches.size(), AUDIO_MEMORY_SEARCH_RESULTS); i > 0; --i)
+                {
+                    requestAudio(memory, playlist.filepath(matches[i - 1]));
+                }
             }
             else
             {
@@ -446,33 +1825,43 @@ void searchSongs(const vector<Song>& playlist)
         }
 
         // Handle user input for search term
-        char ch = _getch();
+        char ch = readKey();
 
         if (ch == 27) // Escape key to exit
         {
-            break;
+            return {};
+        }
+        else if ((ch == '\r' || ch == '\n') && !searchTerm.empty()) // Play the results as a queue
+        {
+            return fuzzy ? ranked : session.results.back();
+        }
+        else if (ch == '\t') // Toggle fuzzy matching
+        {
+            fuzzy = !fuzzy;
         }
         else if (ch == 8) // Backspace to remove last character
         {
             if (!searchTerm.empty())
             {
                 searchTerm.pop_back();
+                searchPop(session);
             }
         }
         else if (isprint(ch)) // Handle printable characters
         {
             searchTerm += ch;
+            searchPush(session, index, ch);
         }
     }
 }
 
-void sortPlaylist(vector<Song>& playlist)
+vector<uint32_t> sortPlaylist(SongStore& playlist, SortCache& cache)
 {
     if (playlist.empty())
     {
         displayError("🎵 Playlist is empty!");
-        Sleep(1500);
-        return;
+        this_thread::sleep_for(chrono::milliseconds(1500));
+        return {};
     }
 
     while (true)
@@ -486,49 +1875,78 @@ void sortPlaylist(vector<Song>& playlist)
         cout << CYAN << "1. Title\n";
         cout << "2. Album\n";
         cout << "3. Year\n";
-        cout << "4. Duration\n" << RESET;
+        cout << "4. Duration\n";
+        cout << "5. Artist\n";
+        cout << "6. Album, then Year, then Title\n";
+        cout << "7. Custom keys\n" << RESET;
 
         int choice = get_int("Enter choice (0 to exit): ");
 
         if (choice == 0)
         {
             cout << YELLOW << "Returning to main menu...";
-            Sleep(1500);
-            return;
+            this_thread::sleep_for(chrono::milliseconds(1500));
+            return {};
         }
 
+        vector<SortField> fields;
+        string sortedBy;
         switch (choice)
         {
             case 1:
-                sort(playlist.begin(), playlist.end(),
-                    [](const Song& a, const Song& b) { return a.title < b.title; });
-                displaySuccess("Playlist sorted by Title!");
-                return;
+                fields = {SORT_TITLE};
+                sortedBy = "Title";
+                break;
             case 2:
-                sort(playlist.begin(), playlist.end(),
-                    [](const Song& a, const Song& b) { return a.album < b.album; });
-                displaySuccess("Playlist sorted by Album!");
-                return;
+                fields = {SORT_ALBUM};
+                sortedBy = "Album";
+                break;
             case 3:
-                sort(playlist.begin(), playlist.end(),
-                    [](const Song& a, const Song& b) { return a.year < b.year; });
-                displaySuccess("Playlist sorted by Year!");
-                return;
+                fields = {SORT_YEAR};
+                sortedBy = "Year";
+                break;
             case 4:
-                sort(playlist.begin(), playlist.end(),
-                    [](const Song& a, const Song& b) { return a.duration < b.duration; });
-                displaySuccess("Playlist sorted by Duration!");
-                return;
+                fields = {SORT_DURATION};
+                sortedBy = "Duration";
+                break;
+            case 5:
+                fields = {SORT_ARTIST};
+                sortedBy = "Artist";
+                break;
+            case 6:
+                fields = {SORT_ALBUM, SORT_YEAR, SORT_TITLE};
+                sortedBy = "Album, Year, Title";
+                break;
+            case 7:
+                sortedBy = get_text("Keys in order (title, album, artist, year, duration)", "album, year, title");
+                if (!parseSortFields(sortedBy, fields))
+                {
+                    displayError("Unknown sort key! Use title, album, artist, year or duration.");
+                    continue;
+                }
+                break;
             default:
                 displayError("Invalid choice! Please try again.");
-                break;
+                continue;
         }
+
+        // Sort an index order so the move can be journaled as a single reorder
+        bool cached;
+        auto start = chrono::steady_clock::now();
+        vector<uint32_t> order = sortOrder(playlist, cache, fields, cached);
+        playlist.permute(order);
+        double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        stringstream timing;
+        timing << fixed << setprecision(1) << elapsed << " ms" << (cached ? ", cached" : "");
+        displaySuccess("Playlist sorted by " + sortedBy + "! (" + timing.str() + ")");
+        return order;
     }
 }
 
-void addSong(vector<Song>& playlist)
+void addSong(SongStore& playlist, ProbeCache& cache)
 {
-    system("CLS");
+    clearScreen();
     cout << MAGENTA << BOLD << "╔════════════════════════════════════╗\n";
     cout << "║          🎵 Add New Song 🎵        ║\n";
     cout << "╚════════════════════════════════════╝" << RESET << "\n\n";
@@ -536,20 +1954,47 @@ void addSong(vector<Song>& playlist)
     Song song;
 
     // Check for immediate escape
-    if (_kbhit())
+    if (keyPending())
     {
-        char ch = _getch();
+        char ch = readKey();
         if (ch == 27) // Escape key to exit
         {
             return;
         }
     }
 
+    while (true)
+    {
+        cout << CYAN << "🔹 Enter audio filepath: " << RESET;
+        getline(cin, song.filepath);
+
+        // Trim whitespace from filepath
+        song.filepath.erase(0, song.filepath.find_first_not_of(" \t"));
+        song.filepath.erase(song.filepath.find_last_not_of(" \t") + 1);
+
+        if (!song.filepath.empty() && validateAudioFile(song.filepath))
+        {
+            break;
+        }
+        displayError("❌ Invalid audio file! Please check the path and try again.");
+    }
+
+    // Read duration and tags from the file headers; tags become the defaults below
+    AudioProbe probe;
+    if (probeAudioFileCached(cache, song.filepath, probe))
+    {
+        song.duration = probe.duration;
+    }
+    else
+    {
+        song.duration = 0.0f;
+        displayError("Could not determine song duration.");
+    }
+
     // Title input with non-empty validation
     while (true)
     {
-        cout << CYAN << "🔹 Enter song title: " << RESET;
-        getline(cin, song.title);
+        song.title = get_text("🔹 Enter song title", probe.title);
 
         if (!song.title.empty())
         {
@@ -558,605 +2003,7153 @@ void addSong(vector<Song>& playlist)
         displayError("Title cannot be empty!");
     }
 
-    if (toLower(song.title) == "the astronaut")
+    song.artist = probe.artist.empty() ? guessArtist(song.title) : probe.artist;
+
+
+    // Album input with non-empty validation
+    while (true)
     {
-        song.artist = "Jin";
+        song.album = get_text("🔹 Enter album name", probe.album);
+
+        if (!song.album.empty())
+        {
+            break;
+        }
+        displayError("Album name cannot be empty!");
     }
-    else if (toLower(song.title) == "my universe")
+
+    // Enter release year with robust input validation
+    while (true)
     {
-        song.artist = "Coldplay / BTS";
+        string yearInput = get_text("🔹 Enter release year", probe.year ? to_string(probe.year) : "");
+
+        try
+        {
+            song.year = stoi(yearInput);
+
+            if (song.year >= 1900 && song.year <= 2100)
+            {
+                break;
+            }
+
+            displayError("Invalid year! Please enter a year between 1900-2100.");
+        }
+        catch (const invalid_argument&)
+        {
+            displayError("Invalid input! Please enter a numeric year.");
+        }
+        catch (const out_of_range&)
+        {
+            displayError("Year is out of valid range!");
+        }
     }
-    else
+
+    playlist.add(song);
+
+    displaySuccess("✅ Song added successfully!");
+}
+
+int removeSong(SongStore& playlist)
+{
+    if (playlist.empty())
+    {
+        displayInfo("Playlist is empty! There are no songs to remove.");
+        return -1;
+    }
+
+    int selected = browsePlaylist(playlist, "🎵 Select a song to remove 🎵");
+    if (selected < 0)
+    {
+        displayInfo("Song removal cancelled.");
+        return -1;
+    }
+
+    clearScreen();
+
+    // Display the current playlist header
+    cout << MAGENTA << BOLD << "╔════════════════════════════════════════╗\n";
+    cout << "║          🎵 Remove a Song 🎵           ║\n";
+    cout << "╚════════════════════════════════════════╝" << RESET << "\n\n";
+
+    size_t indexToRemove = static_cast<size_t>(selected);
+    string removedSongTitle(playlist.title(indexToRemove));
+
+    cout << RED << "\nAre you sure you want to remove \"" << removedSongTitle << "\"? (y/n): " << RESET;
+    string confirmation;
+    getline(cin, confirmation);
+
+    if (toLower(confirmation) != "y" && toLower(confirmation) != "yes")
+    {
+        displayInfo("Song removal cancelled.");
+        this_thread::sleep_for(chrono::milliseconds(2000));
+        return -1;
+    }
+
+    playlist.erase(indexToRemove);
+
+    displaySuccess("✅ Successfully removed \"" + removedSongTitle + "\" from the playlist.");
+    this_thread::sleep_for(chrono::milliseconds(2000));
+
+    return static_cast<int>(indexToRemove);
+}
+
+
+// Song store
+string SongStore::filepath(size_t i) const
+{
+    string path = directoryNames[directories[i]];
+    path += text(fileNames[i]);
+    return path;
+}
+
+Song SongStore::get(size_t i) const
+{
+    Song song;
+    song.title = string(title(i));
+    song.artist = artist(i);
+    song.filepath = filepath(i);
+    song.album = album(i);
+    song.year = years[i];
+    song.duration = durations[i];
+    return song;
+}
+
+void SongStore::add(const Song& song)
+{
+    size_t split = song.filepath.find_last_of("/\\");
+    split = split == string::npos ? 0 : split + 1;
+    string_view directory = string_view(song.filepath).substr(0, split);
+
+    // Loads and imports arrive grouped by album and folder, so most songs
+    // reuse the previous song's ids without hashing anything
+    bool sameArtist = !empty() && names[artists.back()] == song.artist;
+    bool sameAlbum = !empty() && names[albums.back()] == song.album;
+    bool sameDirectory = !empty() && directoryNames[directories.back()] == directory;
+
+    titles.push_back(storeText(song.title));
+    fileNames.push_back(storeText(string_view(song.filepath).substr(split)));
+    artists.push_back(sameArtist ? artists.back() : internName(song.artist));
+    albums.push_back(sameAlbum ? albums.back() : internName(song.album));
+    directories.push_back(sameDirectory ? directories.back() : internDirectory(directory));
+    years.push_back(song.year);
+    durations.push_back(song.duration);
+    ids.push_back(nextId++);
+    ++version;
+    ++contentVersion;
+}
+
+void SongStore::set(size_t i, const Song& song)
+{
+    size_t split = song.filepath.find_last_of("/\\");
+    split = split == string::npos ? 0 : split + 1;
+
+    deadBytes += titles[i].length + fileNames[i].length;
+    titles[i] = storeText(song.title);
+    fileNames[i] = storeText(string_view(song.filepath).substr(split));
+    artists[i] = internName(song.artist);
+    albums[i] = internName(song.album);
+    directories[i] = internDirectory(string_view(song.filepath).substr(0, split));
+    years[i] = song.year;
+    durations[i] = song.duration;
+    ++version;
+    ++contentVersion;
+
+    if (deadBytes > arena.size() / 2)
+    {
+        compactArena();
+    }
+}
+
+void SongStore::erase(size_t i)
+{
+    deadBytes += titles[i].length + fileNames[i].length;
+    titles.erase(titles.begin() + i);
+    fileNames.erase(fileNames.begin() + i);
+    artists.erase(artists.begin() + i);
+    albums.erase(albums.begin() + i);
+    directories.erase(directories.begin() + i);
+    years.erase(years.begin() + i);
+    durations.erase(durations.begin() + i);
+    ids.erase(ids.begin() + i);
+    ++version;
+    ++contentVersion;
+
+    if (deadBytes > arena.size() / 2)
+    {
+        compactArena();
+    }
+}
+
+void SongStore::permute(const vector<uint32_t>& order)
+{
+    // order[i] is the current position of the song that moves to position i
+    auto gather = [&](auto& column)
+    {
+        typename remove_reference<decltype(column)>::type moved;
+        moved.reserve(column.size());
+        for (uint32_t from : order)
+        {
+            moved.push_back(column[from]);
+        }
+        column = move(moved);
+    };
+    gather(titles);
+    gather(fileNames);
+    gather(artists);
+    gather(albums);
+    gather(directories);
+    gather(years);
+    gather(durations);
+    gather(ids);
+    ++version;
+}
+
+void SongStore::reserve(size_t count)
+{
+    titles.reserve(count);
+    fileNames.reserve(count);
+    artists.reserve(count);
+    albums.reserve(count);
+    directories.reserve(count);
+    years.reserve(count);
+    durations.reserve(count);
+    ids.reserve(count);
+}
+
+size_t SongStore::memoryUsage() const
+{
+    // Column and arena capacity plus the dictionaries; hash node overhead is estimated
+    size_t bytes = titles.capacity() * sizeof(TextRef) + fileNames.capacity() * sizeof(TextRef) +
+                   (artists.capacity() + albums.capacity() + directories.capacity()) * sizeof(uint32_t) +
+                   years.capacity() * sizeof(int32_t) + durations.capacity() * sizeof(float) +
+                   ids.capacity() * sizeof(uint32_t) + arena.capacity();
+    for (const auto& name : names)
+    {
+        bytes += 2 * (sizeof(string) + name.capacity()) + 32;
+    }
+    for (const auto& directory : directoryNames)
+    {
+        bytes += 2 * (sizeof(string) + directory.capacity()) + 32;
+    }
+    return bytes;
+}
+
+TextRef SongStore::storeText(string_view value)
+{
+    TextRef ref;
+    ref.offset = static_cast<uint32_t>(arena.size());
+    ref.length = static_cast<uint32_t>(value.size());
+    arena.append(value.data(), value.size());
+    return ref;
+}
+
+uint32_t SongStore::internName(const string& name)
+{
+    auto it = nameIds.find(name);
+    if (it != nameIds.end())
+    {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(names.size());
+    names.push_back(name);
+    nameIds.emplace(name, id);
+    return id;
+}
+
+uint32_t SongStore::internDirectory(string_view directory)
+{
+    string key(directory);
+    auto it = directoryIds.find(key);
+    if (it != directoryIds.end())
+    {
+        return it->second;
+    }
+    uint32_t id = static_cast<uint32_t>(directoryNames.size());
+    directoryNames.push_back(key);
+    directoryIds.emplace(move(key), id);
+    return id;
+}
+
+void SongStore::compactArena()
+{
+    // Rewrite the arena with only the text that live songs still point at
+    string packed;
+    packed.reserve(arena.size() - deadBytes);
+    auto repack = [&](TextRef& ref)
+    {
+        uint32_t offset = static_cast<uint32_t>(packed.size());
+        packed.append(arena, ref.offset, ref.length);
+        ref.offset = offset;
+    };
+    for (size_t i = 0; i < size(); ++i)
+    {
+        repack(titles[i]);
+        repack(fileNames[i]);
+    }
+    arena = move(packed);
+    deadBytes = 0;
+}
+
+
+// Player engine
+void startPlayer(PlayerEngine& player, LoudnessCache& loudness, SeekIndex& seekIndex, AudioMemory& memory,
+                 Equalizer& equalizer)
+{
+    player.loudness = &loudness;
+    player.seekIndex = &seekIndex;
+    player.memory = &memory;
+    player.equalizer = &equalizer;
+    player.worker = thread(runPlayer, ref(player));
+}
+
+void stopPlayer(PlayerEngine& player)
+{
+    sendPlayerCommand(player, {PLAYER_QUIT});
+    if (player.worker.joinable())
+    {
+        player.worker.join();
+    }
+}
+
+void runPlayer(PlayerEngine& player)
+{
+    PlaybackStream stream;
+    PlayerState state;
+    shared_ptr<const PlayQueue> queue = make_shared<const PlayQueue>();
+    size_t queuePosition = 0;
+    sf::Time trackOrigin = sf::Time::Zero;  // Stream offset where the audible track starts
+    size_t preparedPosition = 0;            // Queue entry opened ahead in the stream
+    float preparedDuration = 0.0f;
+    LoudnessInfo preparedLevel;
+    bool preparedAnalyzed = false;
+    bool prepareTried = false;              // Once per track; a failure is not retried
+    auto expectedEnd = chrono::steady_clock::now();
+    bool running = true;
+    thread indexer;                         // Builds seek tables for files played the first time
+    atomic<bool> indexing{false};
+
+    stream.addDspStage(make_unique<ParametricEq>(*player.equalizer));
+
+    auto copyText = [](char* target, size_t size, const string& text)
+    {
+        // Cut on a character boundary so the fixed field stays valid UTF-8
+        size_t length = min(text.size(), size - 1);
+        while (length > 0 && length < text.size() && (static_cast<unsigned char>(text[length]) & 0xC0) == 0x80)
+        {
+            --length;
+        }
+        memcpy(target, text.data(), length);
+        target[length] = '\0';
+    };
+
+    // Unanalyzed files get a default level: no gain and nothing trimmed
+    auto findLevel = [&](size_t position, LoudnessInfo& level)
+    {
+        level = LoudnessInfo();
+        return player.loudness && lookupLoudness(*player.loudness, queue->filepath(position), level);
+    };
+
+    // A cached table is attached at once. Otherwise one is built in the
+    // background; while a build runs, other new files wait until next time.
+    auto indexTrack = [&](const string& path)
+    {
+        if (!player.seekIndex)
+        {
+            return;
+        }
+        if (auto table = lookupSeekTable(*player.seekIndex, path, false))
+        {
+            stream.attachSeekTable(path, table);
+            return;
+        }
+        if (indexing.load())
+        {
+            return;
+        }
+        if (indexer.joinable())
+        {
+            indexer.join();
+        }
+        indexing.store(true);
+        indexer = thread([&stream, &indexing, index = player.seekIndex, path]
+        {
+            if (auto table = lookupSeekTable(*index, path, true))
+            {
+                stream.attachSeekTable(path, table);
+            }
+            indexing.store(false);
+        });
+    };
+
+    auto findClip = [&](size_t position)
+    {
+        return player.memory ? findAudio(*player.memory, queue->filepath(position)) : nullptr;
+    };
+
+    auto showTrack = [&](size_t position, float duration, const LoudnessInfo& level, bool analyzed)
+    {
+        // Keep this track in memory for a replay and decode the ones likely
+        // to be picked next; the nearest is requested last, so it goes first
+        if (player.memory)
+        {
+            for (size_t ahead = AUDIO_MEMORY_LOOKAHEAD; ahead > 0; --ahead)
+            {
+                if (position + ahead < queue->size())
+                {
+                    requestAudio(*player.memory, queue->filepath(position + ahead));
+                }
+            }
+            requestAudio(*player.memory, queue->filepath(position));
+        }
+
+        Song song = queue->get(position);
+        queuePosition = position;
+        prepareTried = false;
+        state.queuePosition = static_cast<uint32_t>(position);
+        state.duration = duration;
+        state.normalized = analyzed;
+        state.gainDb = level.gainDb;
+        state.year = song.year;
+        copyText(state.title, sizeof(state.title), song.title);
+        copyText(state.artist, sizeof(state.artist), song.artist);
+        copyText(state.album, sizeof(state.album), song.album);
+    };
+
+    // Open a queue entry from scratch; with skipFailures, unreadable files
+    // are passed over on the way to the next playable one
+    auto startTrack = [&](size_t position, bool skipFailures)
+    {
+        float duration;
+        LoudnessInfo level;
+        for (; position < queue->size(); ++position)
+        {
+            bool analyzed = findLevel(position, level);
+            auto clip = findClip(position);
+            if (stream.open(queue->filepath(position), level, clip, duration))
+            {
+                state.lastStartFrom = !clip ? START_COLD : clip->complete ? START_MEMORY : START_PREROLL;
+                if (!clip || !clip->complete)
+                {
+                    indexTrack(queue->filepath(position));
+                }
+                stream.setVolume(state.volume);
+                stream.play();
+                trackOrigin = sf::Time::Zero;
+                state.paused = false;
+                showTrack(position, duration, level, analyzed);
+                return true;
+            }
+            if (!skipFailures)
+            {
+                break;
+            }
+        }
+        stream.stop();
+        return false;
+    };
+
+    while (running)
+    {
+        // Tracks joined inside the stream become current once they are heard
+        sf::Time boundary;
+        while (state.active && stream.takeBoundary(stream.getPlayingOffset(), boundary))
+        {
+            trackOrigin = boundary;
+            showTrack(preparedPosition, preparedDuration, preparedLevel, preparedAnalyzed);
+            ++state.transitions;
+            ++state.gaplessTransitions;
+            state.lastGapMs = 0.0f;
+        }
+
+        PlayerCommand command;
+        shared_ptr<const PlayQueue> nextQueue;
+        while (takePlayerCommand(player, command, nextQueue))
+        {
+            switch (command.type)
+            {
+                case PLAYER_PLAY:
+                    queue = move(nextQueue);
+                    ++state.track;
+                    state.queueLength = static_cast<uint32_t>(queue->size());
+                    state.failed = !startTrack(command.index, false);
+                    state.active = !state.failed;
+                    break;
+                case PLAYER_TOGGLE_PAUSE:
+                    if (state.active)
+                    {
+                        if (state.paused)
+                            stream.play();
+                        else
+                            stream.pause();
+                        state.paused = !state.paused;
+                    }
+                    break;
+                case PLAYER_STOP:
+                    stream.stop();
+                    state.active = false;
+                    state.paused = false;
+                    break;
+                case PLAYER_NEXT:
+                    if (state.active && queuePosition + 1 < queue->size())
+                    {
+                        state.active = startTrack(queuePosition + 1, true);
+                    }
+                    break;
+                case PLAYER_PREVIOUS:
+                    if (state.active && queuePosition > 0)
+                    {
+                        state.active = startTrack(queuePosition - 1, false);
+                    }
+                    break;
+                case PLAYER_RESTART:
+                    stream.setPlayingOffset(sf::Time::Zero);
+                    trackOrigin = sf::Time::Zero;
+                    prepareTried = false;
+                    break;
+                case PLAYER_SEEK:
+                {
+                    // Seeking before a join was heard drops the joined file; it is prepared again below
+                    float position = (stream.getPlayingOffset() - trackOrigin).asSeconds() + command.value;
+                    auto started = chrono::steady_clock::now();
+                    stream.setPlayingOffset(sf::seconds(max(0.0f, min(position, state.duration))));
+                    state.lastSeekMs = chrono::duration<float, milli>(chrono::steady_clock::now() - started).count();
+                    trackOrigin = sf::Time::Zero;
+                    prepareTried = false;
+                    break;
+                }
+                case PLAYER_VOLUME:
+                    state.volume = max(0.0f, min(100.0f, state.volume + command.value));
+                    stream.setVolume(state.volume);
+                    break;
+                case PLAYER_TOGGLE_REPEAT:
+                    state.repeat = !state.repeat;
+                    stream.dropNext();
+                    prepareTried = false;
+                    break;
+                case PLAYER_TOGGLE_LATENCY:
+                    state.lowLatency = !state.lowLatency;
+                    stream.setMode(state.lowLatency ? STREAM_LOW_LATENCY : STREAM_POWER_SAVING);
+                    break;
+                case PLAYER_CROSSFADE:
+                case PLAYER_TOGGLE_FADE_CURVE:
+                    if (command.type == PLAYER_CROSSFADE)
+                        state.crossfadeSeconds = max(0.0f, command.value);
+                    else
+                        state.equalPowerFade = !state.equalPowerFade;
+                    stream.setCrossfade(state.crossfadeSeconds, state.equalPowerFade ? FADE_EQUAL_POWER : FADE_LINEAR);
+                    break;
+                case PLAYER_TOGGLE_EQ:
+                    changeEqualizer(*player.equalizer, [&] { player.equalizer->enabled = !player.equalizer->enabled; });
+                    break;
+                case PLAYER_QUIT:
+                    running = false;
+                    break;
+            }
+            ++state.applied;
+        }
+
+        // Keep the following track opened and decoded ahead; repeat joins
+        // the song to itself
+        size_t following = state.repeat ? queuePosition : queuePosition + 1;
+        if (state.active && !prepareTried && following < queue->size() && !stream.hasNext())
+        {
+            prepareTried = true;
+            preparedPosition = following;
+            preparedAnalyzed = findLevel(following, preparedLevel);
+            auto clip = findClip(following);
+            if (stream.prepareNext(queue->filepath(following), preparedLevel, clip, preparedDuration) &&
+                (!clip || !clip->complete))
+            {
+                indexTrack(queue->filepath(following));
+            }
+        }
+
+        if (state.active && !state.paused && stream.getStatus() == sf::SoundStream::Stopped)
+        {
+            // The stream ran dry: end of the queue, or a track that could not
+            // be joined. Restarting costs a gap, which is measured from when
+            // the previous track should have ended.
+            if (following < queue->size() && startTrack(following, true))
+            {
+                float gap = chrono::duration<float, milli>(chrono::steady_clock::now() - expectedEnd).count();
+                ++state.transitions;
+                state.lastGapMs = max(0.0f, gap);
+                state.maxGapMs = max(state.maxGapMs, state.lastGapMs);
+            }
+            else
+            {
+                state.active = false;
+            }
+        }
+
+        state.position = state.active ? (stream.getPlayingOffset() - trackOrigin).asSeconds() : 0.0f;
+        state.bufferMs = state.active ? stream.bufferedMs() : 0.0f;
+        state.bufferTargetMs = static_cast<float>(STREAM_TUNING[stream.getMode()].aheadMs);
+        state.underruns = stream.underrunCount();
+        state.bytesMapped = stream.readStats().bytesMapped.load();
+        state.coldPages = stream.readStats().coldPages.load();
+        state.readStalls = stream.readStats().stalls.load();
+        state.lastStartMs = stream.startLatencyMs();
+        const DspStats& dsp = stream.dspStats();
+        uint64_t audioNs = dsp.audioNs.load(memory_order_relaxed);
+        state.dspLoad = audioNs ? 100.0f * dsp.busyNs.load(memory_order_relaxed) / audioNs : 0.0f;
+        state.dspLastBlockUs = dsp.lastBlockUs.load(memory_order_relaxed);
+        state.dspMaxBlockUs = dsp.maxBlockUs.load(memory_order_relaxed);
+        {
+            lock_guard<mutex> eqGuard(player.equalizer->lock);
+            state.eqEnabled = player.equalizer->enabled;
+            copyText(state.eqPreset, sizeof(state.eqPreset), player.equalizer->presets[player.equalizer->active].name);
+        }
+        if (state.active && !state.paused)
+        {
+            expectedEnd = chrono::steady_clock::now() +
+                          chrono::microseconds(static_cast<int64_t>((state.duration - state.position) * 1e6f));
+        }
+        publishPlayerState(player, state);
+
+        // Park until the next command. While playing, also wake for the next
+        // position update and the end of the track.
+        unique_lock<mutex> guard(player.sleepLock);
+        auto pending = [&]
+        {
+            return player.head.load(memory_order_relaxed) != player.tail.load(memory_order_acquire);
+        };
+        if (!running)
+        {
+            break;
+        }
+        if (state.active && !state.paused)
+        {
+            int timeout = max(5, min(100, static_cast<int>((state.duration - state.position) * 1000.0f)));
+            player.wake.wait_for(guard, chrono::milliseconds(timeout), pending);
+        }
+        else
+        {
+            player.wake.wait(guard, pending);
+        }
+    }
+    stream.stop();
+    if (indexer.joinable())
+    {
+        indexer.join();
+    }
+}
+
+PlaybackStream::PlaybackStream()
+{
+    decoder = thread(&PlaybackStream::runDecoder, this);
+}
+
+PlaybackStream::~PlaybackStream()
+{
+    stop();
+    {
+        lock_guard<mutex> guard(sleepLock);
+        quitting = true;
+    }
+    wake.notify_one();
+    decoder.join();
+}
+
+bool PlaybackStream::open(const string& path, const LoudnessInfo& level, shared_ptr<const DecodedAudio> audio, float& duration)
+{
+    StreamSource source;
+    if (!openSource(source, path, level, audio, duration))
+    {
+        return false;
+    }
+    vector<sf::Int16> head;
+    if (audio && source.file)
+    {
+        usePreroll(source, *audio, head);
+    }
+
+    stop();
+    unsigned int channels = source.channels;
+    unsigned int rate = source.sampleRate;
+    {
+        lock_guard<mutex> guard(lock);
+        current = move(source);
+        sampleRate = rate;
+        channelCount = channels;
+        next = StreamSource();
+        previous = StreamSource();
+        joinPending = false;
+        fadeLeft = 0;
+        pending = move(head);
+        pendingRead = 0;
+        nextPending.clear();
+
+        // Room for the deepest decode-ahead plus a chunk, rounded to a power of two
+        size_t needed = 0;
+        for (const StreamTuning& tuning : STREAM_TUNING)
+        {
+            needed = max(needed, static_cast<size_t>(rate) * (tuning.aheadMs + tuning.chunkMs) / 1000 * channels);
+        }
+        size_t capacity = 1;
+        while (capacity < needed)
+        {
+            capacity <<= 1;
+        }
+        ring.assign(capacity, 0);
+        ringMask = capacity - 1;
+        writeIndex.store(0);
+        readIndex.store(0);
+        joinsWritten.store(0);
+        joinsRead.store(0);
+        finished.store(false);
+        fed = 0;
+        for (auto& stage : dspStages)
+        {
+            stage->configure(rate, channels);
+        }
+        openedAt = chrono::steady_clock::now();
+        starting.store(true);
+        lock_guard<mutex> boundaryGuard(boundaryLock);
+        boundaries.clear();
+    }
+    initialize(channels, rate);
+    wakeDecoder();
+    return true;
+}
+
+bool PlaybackStream::prepareNext(const string& path, const LoudnessInfo& level, shared_ptr<const DecodedAudio> audio, float& duration)
+{
+    StreamSource source;
+    if (!openSource(source, path, level, audio, duration) ||
+        source.channels != getChannelCount() || source.sampleRate != getSampleRate())
+    {
+        return false;
+    }
+
+    // Decode the first chunk here so the join never waits on the disk
+    vector<sf::Int16> first;
+    if (audio && source.file)
+    {
+        usePreroll(source, *audio, first);
+    }
+    if (first.empty())
+    {
+        first.resize(samplesFor(STREAM_TUNING[STREAM_POWER_SAVING].chunkMs));
+        first.resize(readSource(source, first.data(), first.size()));
+    }
+
+    lock_guard<mutex> guard(lock);
+    next = move(source);
+    nextPending = move(first);
+
+    // The decoder may be waiting at a fade, or already at the end; it can
+    // still join as long as SFML has not caught up
+    finished.store(false);
+    wakeDecoder();
+    return true;
+}
+
+bool PlaybackStream::openSource(StreamSource& source, const string& path, const LoudnessInfo& level,
+                                shared_ptr<const DecodedAudio> audio, float& duration)
+{
+    // A track decoded in full plays from memory and never opens the file
+    uint64_t sampleCount;
+    if (audio && audio->complete)
+    {
+        source.memory = move(audio);
+        source.sampleRate = source.memory->sampleRate;
+        source.channels = source.memory->channels;
+        sampleCount = source.memory->samples.size();
+    }
+    else
+    {
+        source.file = make_unique<MappedSoundFile>();
+        if (!source.file->data.open(path, reads) || !source.file->decoder.openFromStream(source.file->data))
+        {
+            return false;
+        }
+        source.sampleRate = source.file->decoder.getSampleRate();
+        source.channels = source.file->decoder.getChannelCount();
+        sampleCount = source.file->decoder.getSampleCount();
+    }
+    source.path = path;
+
+    // Trim the silent edges; the track then runs from 0 to the trimmed duration
+    float length = static_cast<float>(sampleCount / source.channels) / source.sampleRate;
+    float lead = min(level.leadingSilence, length);
+    float tail = min(level.trailingSilence, length - lead);
+    uint64_t trailingSamples = static_cast<uint64_t>(tail * source.sampleRate) * source.channels;
+    uint64_t leadingSamples = static_cast<uint64_t>(lead * source.sampleRate) * source.channels;
+
+    source.gain = pow(10.0f, level.gainDb / 20.0f);
+    source.start = sf::seconds(lead);
+    source.end = sampleCount - min(trailingSamples, sampleCount);
+    if (source.memory)
+    {
+        source.memoryAt = min(leadingSamples, sampleCount);
+    }
+    else
+    {
+        source.resumeAt = leadingSamples;
+    }
+    duration = length - lead - tail;
+    return true;
+}
+
+void PlaybackStream::usePreroll(StreamSource& source, const DecodedAudio& clip, vector<sf::Int16>& head)
+{
+    // The clip stands in for the decoder up to where it ends; the decoder
+    // seeks there only when the head has been played out
+    if (clip.sampleRate != source.sampleRate || clip.channels != source.channels ||
+        clip.samples.size() <= source.resumeAt || source.end <= source.resumeAt)
+    {
+        return;
+    }
+    uint64_t stop = min<uint64_t>(clip.samples.size(), source.end);
+    head.assign(clip.samples.begin() + source.resumeAt, clip.samples.begin() + stop);
+    if (source.gain != 1.0f)
+    {
+        applyGain(head.data(), head.size(), source.gain);
+    }
+    source.resumeAt = stop;
+}
+
+void PlaybackStream::dropNext()
+{
+    lock_guard<mutex> guard(lock);
+    next = StreamSource();
+    nextPending.clear();
+}
+
+void PlaybackStream::attachSeekTable(const string& path, shared_ptr<const SeekTable> table)
+{
+    // Tables are built in the background, so the file may have moved on
+    lock_guard<mutex> guard(lock);
+    for (StreamSource* source : {&current, &next, &previous})
+    {
+        if (source->file && source->path == path)
+        {
+            source->seekTable = table;
+        }
+    }
+}
+
+bool PlaybackStream::hasNext()
+{
+    // A join that has been decoded but not heard yet also counts
+    lock_guard<mutex> guard(lock);
+    return next.isOpen() || joinPending;
+}
+
+bool PlaybackStream::takeBoundary(sf::Time played, sf::Time& boundary)
+{
+    bool lastJoin;
+    {
+        lock_guard<mutex> guard(boundaryLock);
+        if (boundaries.empty() || played < boundaries.front())
+        {
+            return false;
+        }
+        boundary = boundaries.front();
+        boundaries.pop_front();
+        lastJoin = boundaries.empty() && joinsRead.load() == joinsWritten.load();
+    }
+    if (lastJoin)
+    {
+        lock_guard<mutex> guard(lock);
+        joinPending = false;
+        if (fadeLeft == 0)
+        {
+            previous = StreamSource();
+        }
+    }
+    return true;
+}
+
+void PlaybackStream::setCrossfade(float seconds, FadeCurve curve)
+{
+    // Applies from the next join; a fade already under way keeps its length
+    lock_guard<mutex> guard(lock);
+    crossfadeMs = static_cast<int>(seconds * 1000.0f);
+    fadeCurve = curve;
+}
+
+void PlaybackStream::setMode(StreamMode newMode)
+{
+    mode.store(newMode);
+    wakeDecoder();
+}
+
+float PlaybackStream::bufferedMs() const
+{
+    uint64_t buffered = writeIndex.load() - readIndex.load();
+    return buffered * 1000.0f / max(1u, getSampleRate() * getChannelCount());
+}
+
+size_t PlaybackStream::samplesFor(int ms) const
+{
+    return max<size_t>(1, static_cast<size_t>(sampleRate) * ms / 1000) * channelCount;
+}
+
+void PlaybackStream::wakeDecoder()
+{
+    {
+        lock_guard<mutex> guard(sleepLock);
+        wakeRequested = true;
+    }
+    wake.notify_one();
+}
+
+void PlaybackStream::signalRefill()
+{
+    // Called after the decoder publishes samples or reaches the end
+    bool waiting;
+    {
+        lock_guard<mutex> guard(sleepLock);
+        waiting = awaitingRefill;
+    }
+    if (waiting)
+    {
+        refilled.notify_one();
+    }
+}
+
+void PlaybackStream::runDecoder()
+{
+    while (true)
+    {
+        {
+            unique_lock<mutex> guard(sleepLock);
+            wake.wait(guard, [&] { return quitting || wakeRequested; });
+            if (quitting)
+            {
+                return;
+            }
+            wakeRequested = false;
+        }
+        lock_guard<mutex> guard(lock);
+        decodeAhead();
+    }
+}
+
+void PlaybackStream::decodeAhead()
+{
+    size_t target = min(samplesFor(STREAM_TUNING[mode.load()].aheadMs), ring.size());
+    while (current.isOpen() && !finished.load(memory_order_relaxed))
+    {
+        uint64_t write = writeIndex.load(memory_order_relaxed);
+        size_t buffered = static_cast<size_t>(write - readIndex.load(memory_order_acquire));
+        if (buffered >= target)
+        {
+            break;
+        }
+
+        // Largest piece that fits before the ring wraps
+        size_t offset = static_cast<size_t>(write & ringMask);
+        size_t count = min(target - buffered, ring.size() - offset);
+
+        if (fadeLeft > 0)
+        {
+            // Crossfade: the incoming track goes straight into the ring and
+            // the outgoing one is mixed over it. Either may run short.
+            count = static_cast<size_t>(min<uint64_t>(count, fadeLeft));
+            size_t got = readCurrent(ring.data() + offset, count);
+            fill(ring.begin() + offset + got, ring.begin() + offset + count, sf::Int16(0));
+            fadeOut.resize(count);
+            got = readSource(previous, fadeOut.data(), count);
+            fill(fadeOut.begin() + got, fadeOut.end(), sf::Int16(0));
+
+            float step = 1.0f / fadeTotal;
+            crossfadeMix(ring.data() + offset, fadeOut.data(), count, (fadeTotal - fadeLeft) * step, step, fadeCurve);
+            fadeLeft -= count;
+            if (fadeLeft == 0 && !joinPending)
+            {
+                previous = StreamSource();
+            }
+            writeIndex.store(write + count, memory_order_release);
+            signalRefill();
+            continue;
+        }
+
+        if (crossfadeMs > 0 && pendingRead == pending.size())
+        {
+            // Stop plain decoding where the fade into the next track begins
+            uint64_t offset = current.offset();
+            uint64_t remaining = current.end > offset ? current.end - offset : 0;
+            size_t fadeSamples = samplesFor(crossfadeMs);
+            if (remaining > fadeSamples)
+            {
+                count = static_cast<size_t>(min<uint64_t>(count, remaining - fadeSamples));
+            }
+            else if (next.isOpen() && remaining > 0)
+            {
+                if (!addJoin(write))
+                {
+                    break;
+                }
+                previous = move(current);
+                current = move(next);
+                pending = move(nextPending);
+                pendingRead = 0;
+                nextPending.clear();
+                fadeTotal = fadeLeft = remaining;
+                continue;
+            }
+            else if (!next.isOpen() && buffered >= samplesFor(STREAM_TUNING[mode.load()].refillMs))
+            {
+                // No next track yet: wait here while the buffer lasts, so one
+                // prepared late still gets its fade; the end of the queue only
+                // costs a shallower buffer
+                break;
+            }
+        }
+
+        size_t got = readCurrent(ring.data() + offset, count);
+        if (got > 0)
+        {
+            writeIndex.store(write + got, memory_order_release);
+            signalRefill();
+            continue;
+        }
+
+        // Current file ended: carry straight on with the next one
+        if (!next.isOpen())
+        {
+            finished.store(true, memory_order_release);
+            signalRefill();
+            break;
+        }
+        if (!addJoin(write))
+        {
+            break;
+        }
+        previous = move(current);
+        current = move(next);
+        pending = move(nextPending);
+        pendingRead = 0;
+        nextPending.clear();
+    }
+}
+
+size_t PlaybackStream::readCurrent(sf::Int16* samples, size_t count)
+{
+    // The pre-decoded head first, then the file
+    size_t got = min(count, pending.size() - pendingRead);
+    copy_n(pending.begin() + pendingRead, got, samples);
+    pendingRead += got;
+    return got + readSource(current, samples + got, count - got);
+}
+
+size_t PlaybackStream::readSource(StreamSource& source, sf::Int16* samples, size_t count)
+{
+    if (source.resumeAt > 0)
+    {
+        source.file->decoder.seek(source.resumeAt);
+        source.resumeAt = 0;
+    }
+    uint64_t offset = source.offset();
+    count = static_cast<size_t>(min<uint64_t>(count, source.end > offset ? source.end - offset : 0));
+    size_t got;
+    if (source.memory)
+    {
+        got = count;
+        copy_n(source.memory->samples.begin() + offset, got, samples);
+        source.memoryAt += got;
+    }
+    else
+    {
+        got = static_cast<size_t>(source.file->decoder.read(samples, count));
+    }
+    if (source.gain != 1.0f)
+    {
+        applyGain(samples, got, source.gain);
+    }
+    return got;
+}
+
+bool PlaybackStream::addJoin(uint64_t position)
+{
+    uint64_t joined = joinsWritten.load(memory_order_relaxed);
+    if (joined - joinsRead.load(memory_order_acquire) == STREAM_JOIN_SLOTS)
+    {
+        return false;
+    }
+    joins[joined % STREAM_JOIN_SLOTS] = position;
+    joinsWritten.store(joined + 1, memory_order_release);
+    joinPending = true;
+    return true;
+}
+
+void PlaybackStream::addDspStage(unique_ptr<DspStage> stage)
+{
+    dspStages.push_back(move(stage));
+}
+
+void PlaybackStream::runDsp(sf::Int16* samples, size_t count)
+{
+    // Converted to float only when some stage has work to do, so an
+    // all-bypassed chain costs nothing
+    auto started = chrono::steady_clock::now();
+    size_t frames = count / channelCount;
+    bool converted = false;
+    for (auto& stage : dspStages)
+    {
+        if (!stage->prepare() || frames == 0)
+        {
+            continue;
+        }
+        if (!converted)
+        {
+            dspBuffer.assign(samples, samples + count);
+            converted = true;
+        }
+        stage->process(dspBuffer.data(), frames);
+    }
+    if (!converted)
+    {
+        return;
+    }
+    for (size_t i = 0; i < count; ++i)
+    {
+        samples[i] = static_cast<sf::Int16>(lrintf(min(max(dspBuffer[i], -32768.0f), 32767.0f)));
+    }
+
+    float busyUs = chrono::duration<float, micro>(chrono::steady_clock::now() - started).count();
+    dsp.blocks.fetch_add(1, memory_order_relaxed);
+    dsp.busyNs.fetch_add(static_cast<uint64_t>(busyUs * 1000.0f), memory_order_relaxed);
+    dsp.audioNs.fetch_add(uint64_t(frames) * 1000000000 / sampleRate, memory_order_relaxed);
+    dsp.lastBlockUs.store(busyUs, memory_order_relaxed);
+    dsp.maxBlockUs.store(max(dsp.maxBlockUs.load(memory_order_relaxed), busyUs), memory_order_relaxed);
+}
+
+bool PlaybackStream::onGetData(Chunk& data)
+{
+    const StreamTuning& tuning = STREAM_TUNING[mode.load()];
+    size_t wanted = samplesFor(tuning.chunkMs);
+    chunk.resize(wanted);
+
+    uint64_t read = readIndex.load(memory_order_relaxed);
+    auto available = [&] { return static_cast<size_t>(writeIndex.load(memory_order_acquire) - read); };
+    if (available() < wanted && !finished.load(memory_order_acquire))
+    {
+        // Running dry: give the decoder up to one chunk's time to catch up,
+        // and take the samples the moment it has published enough
+        wakeDecoder();
+        unique_lock<mutex> guard(sleepLock);
+        awaitingRefill = true;
+        refilled.wait_for(guard, chrono::milliseconds(tuning.chunkMs),
+            [&] { return available() >= wanted || finished.load(memory_order_acquire); });
+        awaitingRefill = false;
+    }
+
+    bool ending = finished.load(memory_order_acquire);
+    size_t count = min(available(), wanted);
+    size_t offset = static_cast<size_t>(read & ringMask);
+    size_t first = min(count, ring.size() - offset);
+    copy_n(ring.begin() + offset, first, chunk.begin());
+    copy_n(ring.begin(), count - first, chunk.begin() + first);
+
+    // Joins inside this chunk become boundaries in stream time
+    uint64_t joinRead = joinsRead.load(memory_order_relaxed);
+    while (joinRead < joinsWritten.load(memory_order_acquire) && joins[joinRead % STREAM_JOIN_SLOTS] < read + count)
+    {
+        uint64_t sample = fed + (joins[joinRead % STREAM_JOIN_SLOTS] - read);
+        uint64_t samplesPerSecond = uint64_t(sampleRate) * channelCount;
+        lock_guard<mutex> guard(boundaryLock);
+        boundaries.push_back(sf::microseconds(static_cast<sf::Int64>(sample * 1000000 / samplesPerSecond)));
+        joinsRead.store(++joinRead, memory_order_release);
+    }
+
+    readIndex.store(read + count, memory_order_release);
+    fed += count;
+    if (count > 0 && starting.exchange(false))
+    {
+        startMs.store(chrono::duration<float, milli>(chrono::steady_clock::now() - openedAt).count());
+    }
+    if (count < wanted && !ending)
+    {
+        fill(chunk.begin() + count, chunk.end(), sf::Int16(0));
+        fed += wanted - count;
+        count = wanted;
+        underruns.fetch_add(1);
+    }
+    if (available() + count < samplesFor(tuning.refillMs) + wanted && !ending)
+    {
+        wakeDecoder();
+    }
+    runDsp(chunk.data(), count);
+
+    data.samples = chunk.data();
+    data.sampleCount = count;
+    return count == wanted;
+}
+
+void PlaybackStream::onSeek(sf::Time timeOffset)
+{
+    // SFML's thread is stopped here, and holding lock keeps the decoder out
+    lock_guard<mutex> guard(lock);
+    if (joinPending)
+    {
+        // The join was decoded but not heard: go back to the audible file
+        current = move(previous);
+    }
+    previous = StreamSource();
+    joinPending = false;
+    fadeLeft = 0;
+    pending.clear();
+    pendingRead = 0;
+    if (current.memory)
+    {
+        uint64_t frame = static_cast<uint64_t>((current.start + timeOffset).asSeconds() * current.sampleRate);
+        current.memoryAt = min<uint64_t>(frame * current.channels, current.memory->samples.size());
+    }
+    else if (current.file)
+    {
+        sf::Time target = current.start + timeOffset;
+        current.resumeAt = 0;
+        if (current.seekTable)
+        {
+            // Page in where the seek lands before the decoder searches for it
+            uint64_t frame = static_cast<uint64_t>(target.asSeconds() * current.seekTable->sampleRate);
+            current.file->data.prefetch(current.seekTable->offsetFor(frame));
+        }
+        current.file->decoder.seek(target);
+    }
+
+    writeIndex.store(0);
+    readIndex.store(0);
+    joinsWritten.store(0);
+    joinsRead.store(0);
+    finished.store(false);
+    fed = static_cast<uint64_t>(timeOffset.asSeconds() * sampleRate) * channelCount;
+    {
+        lock_guard<mutex> boundaryGuard(boundaryLock);
+        boundaries.clear();
+    }
+    for (auto& stage : dspStages)
+    {
+        stage->reset();
+    }
+    wakeDecoder();
+}
+
+bool MappedInputStream::open(const string& path, MappedReadStats& counters)
+{
+    stats = &counters;
+    position = 0;
+    hintedFrom = hintedUntil = 0;
+    if (!file.open(path))
+    {
+        return false;
+    }
+    stats->bytesMapped.fetch_add(file.size, memory_order_relaxed);
+
+    // The headers and first frames are needed as soon as the file is
+    // opened, which for the next track is well before it is joined
+    prefetch(0);
+    return true;
+}
+
+sf::Int64 MappedInputStream::read(void* data, sf::Int64 size)
+{
+    if (!file.data || size < 0)
+    {
+        return -1;
+    }
+    size_t count = static_cast<size_t>(min<uint64_t>(size, file.size - position));
+
+    // Renew the hint half way through the window, so the kernel is already
+    // reading the next one when the decoder gets there
+    if (position + count + MAPPED_READAHEAD_BYTES / 2 > hintedUntil)
+    {
+        prefetch(position);
+    }
+
+    auto started = chrono::steady_clock::now();
+    memcpy(data, file.data + position, count);
+    if (chrono::steady_clock::now() - started > chrono::microseconds(MAPPED_READ_STALL_US))
+    {
+        stats->stalls.fetch_add(1, memory_order_relaxed);
+    }
+
+    position += count;
+    stats->bytesRead.fetch_add(count, memory_order_relaxed);
+    return static_cast<sf::Int64>(count);
+}
+
+sf::Int64 MappedInputStream::seek(sf::Int64 target)
+{
+    if (!file.data || target < 0)
+    {
+        return -1;
+    }
+    position = min<uint64_t>(target, file.size);
+
+    // A seek outside the window would otherwise fault page by page
+    if (position < hintedFrom || position >= hintedUntil)
+    {
+        prefetch(position);
+    }
+    return static_cast<sf::Int64>(position);
+}
+
+sf::Int64 MappedInputStream::tell()
+{
+    return file.data ? static_cast<sf::Int64>(position) : -1;
+}
+
+sf::Int64 MappedInputStream::getSize()
+{
+    return file.data ? static_cast<sf::Int64>(file.size) : -1;
+}
+
+void MappedInputStream::prefetch(uint64_t offset)
+{
+    if (offset >= file.size)
+    {
+        return;
+    }
+    size_t length = static_cast<size_t>(min<uint64_t>(MAPPED_READAHEAD_BYTES, file.size - offset));
+
+    // Residency is sampled once per window, over the part the last hint did
+    // not already cover, rather than on every small decoder read
+    uint64_t fresh = offset >= hintedFrom && offset < hintedUntil ? hintedUntil : offset;
+    if (offset + length > fresh)
+    {
+        stats->coldPages.fetch_add(missingPages(fresh, static_cast<size_t>(offset + length - fresh)), memory_order_relaxed);
+    }
+    hintedFrom = offset;
+    hintedUntil = offset + length;
+
+#ifdef _WIN32
+    // PrefetchVirtualMemory only exists from Windows 8 on, and the headers
+    // hide it unless _WIN32_WINNT says so, so look it up at run time.
+    // The range matches WIN32_MEMORY_RANGE_ENTRY, hidden the same way.
+    struct PrefetchRange
+    {
+        void* address;
+        size_t size;
+    };
+    using PrefetchFunction = BOOL (WINAPI*)(HANDLE, ULONG_PTR, PrefetchRange*, ULONG);
+    static const PrefetchFunction prefetchMemory = reinterpret_cast<PrefetchFunction>(
+        GetProcAddress(GetModuleHandleA("kernel32.dll"), "PrefetchVirtualMemory"));
+    if (prefetchMemory)
+    {
+        PrefetchRange range = {const_cast<char*>(file.data + offset), length};
+        prefetchMemory(GetCurrentProcess(), 1, &range, 0);
+    }
+#else
+    // madvise() takes a page-aligned start
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(file.data + offset) & ~(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(file.data + offset + length);
+    madvise(reinterpret_cast<void*>(begin), end - begin, MADV_WILLNEED);
+#endif
+}
+
+size_t MappedInputStream::missingPages(uint64_t offset, size_t length) const
+{
+    size_t missing = 0;
+#ifndef _WIN32
+    if (length == 0)
+    {
+        return 0;
+    }
+    uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    uintptr_t begin = reinterpret_cast<uintptr_t>(file.data + offset) & ~(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(file.data + offset + length);
+
+    // Sized so one readahead window of 4 KiB pages takes a single call
+    unsigned char resident[MAPPED_READAHEAD_BYTES / 4096];
+    for (uintptr_t at = begin; at < end; at += sizeof(resident) * page)
+    {
+        size_t span = min<uintptr_t>(end - at, sizeof(resident) * page);
+        if (mincore(reinterpret_cast<void*>(at), span, resident) != 0)
+        {
+            break;
+        }
+        for (size_t i = 0; i < (span + page - 1) / page; ++i)
+        {
+            missing += (resident[i] & 1) == 0;
+        }
+    }
+#endif
+    return missing;
+}
+
+bool sendPlayerCommand(PlayerEngine& player, PlayerCommand command, shared_ptr<const PlayQueue> queue)
+{
+    size_t tail = player.tail.load(memory_order_relaxed);
+    if (tail - player.head.load(memory_order_acquire) == PLAYER_QUEUE_SIZE)
+    {
+        return false;   // Player is far behind; drop the command
+    }
+    player.commands[tail % PLAYER_QUEUE_SIZE] = command;
+    player.queues[tail % PLAYER_QUEUE_SIZE] = move(queue);
+    player.tail.store(tail + 1, memory_order_release);
+    ++player.sent;
+
+    // Taking the lock orders this push against a player that is just
+    // about to park, so the wakeup cannot be lost
+    {
+        lock_guard<mutex> guard(player.sleepLock);
+    }
+    player.wake.notify_one();
+    return true;
+}
+
+bool takePlayerCommand(PlayerEngine& player, PlayerCommand& command, shared_ptr<const PlayQueue>& queue)
+{
+    size_t head = player.head.load(memory_order_relaxed);
+    if (head == player.tail.load(memory_order_acquire))
+    {
+        return false;
+    }
+    command = player.commands[head % PLAYER_QUEUE_SIZE];
+    queue = move(player.queues[head % PLAYER_QUEUE_SIZE]);
+    player.head.store(head + 1, memory_order_release);
+    return true;
+}
+
+void publishPlayerState(PlayerEngine& player, const PlayerState& state)
+{
+    // Readers retry when they see an odd sequence or a change across their copy
+    uint64_t sequence = player.sequence.load(memory_order_relaxed);
+    player.sequence.store(sequence + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    memcpy(&player.state, &state, sizeof(state));
+    player.sequence.store(sequence + 2, memory_order_release);
+}
+
+PlayerState readPlayerState(const PlayerEngine& player)
+{
+    PlayerState state;
+    while (true)
+    {
+        uint64_t before = player.sequence.load(memory_order_acquire);
+        if (before & 1)
+        {
+            this_thread::yield();
+            continue;
+        }
+        memcpy(&state, &player.state, sizeof(state));
+        atomic_thread_fence(memory_order_acquire);
+        if (player.sequence.load(memory_order_relaxed) == before)
+        {
+            return state;
+        }
+    }
+}
+
+void waitForPlayer(const PlayerEngine& player)
+{
+    // Commands are applied within a few milliseconds; waiting lets the next
+    // frame show their effect
+    for (int i = 0; i < 2000 && readPlayerState(player).applied < player.sent; ++i)
+    {
+        this_thread::sleep_for(chrono::milliseconds(1));
+    }
+}
+
+// Mixing
+// sin(t * pi / 2) on [0, 1] as an odd polynomial, so the SIMD kernels can
+// evaluate the equal-power curve without a libm call. The error stays
+// below 1e-5, a tenth of an LSB.
+const float FADE_SIN_C1 = 1.5707963f;
+const float FADE_SIN_C3 = -0.6459641f;
+const float FADE_SIN_C5 = 0.0796926f;
+const float FADE_SIN_C7 = -0.0046818f;
+const float FADE_SIN_C9 = 0.0001604f;
+
+float fadeInGain(float t, FadeCurve curve)
+{
+    t = max(0.0f, min(1.0f, t));
+    if (curve == FADE_LINEAR)
+    {
+        return t;
+    }
+    float t2 = t * t;
+    return t * (FADE_SIN_C1 + t2 * (FADE_SIN_C3 + t2 * (FADE_SIN_C5 + t2 * (FADE_SIN_C7 + t2 * FADE_SIN_C9))));
+}
+
+void crossfadeMixScalar(sf::Int16* incoming, const sf::Int16* outgoing, size_t count, float start, float step, FadeCurve curve)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        // The fade-out curve is the fade-in curve run backwards
+        float t = start + step * static_cast<float>(i);
+        float mixed = incoming[i] * fadeInGain(t, curve) + outgoing[i] * fadeInGain(1.0f - t, curve);
+        incoming[i] = static_cast<sf::Int16>(max(-32768.0f, min(32767.0f, nearbyint(mixed))));
+    }
+}
+
+// The ramp advances per sample rather than per frame, so the channels of a
+// frame differ by half a step, far below one LSB for any audible fade
+void crossfadeMix(sf::Int16* incoming, const sf::Int16* outgoing, size_t count, float start, float step, FadeCurve curve)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 lanes = _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7);
+    auto gain = [&](__m256 t)
+    {
+        if (curve == FADE_LINEAR)
+        {
+            return t;
+        }
+        __m256 t2 = _mm256_mul_ps(t, t);
+        __m256 p = _mm256_add_ps(_mm256_set1_ps(FADE_SIN_C7), _mm256_mul_ps(t2, _mm256_set1_ps(FADE_SIN_C9)));
+        p = _mm256_add_ps(_mm256_set1_ps(FADE_SIN_C5), _mm256_mul_ps(t2, p));
+        p = _mm256_add_ps(_mm256_set1_ps(FADE_SIN_C3), _mm256_mul_ps(t2, p));
+        p = _mm256_add_ps(_mm256_set1_ps(FADE_SIN_C1), _mm256_mul_ps(t2, p));
+        return _mm256_mul_ps(t, p);
+    };
+    auto mix = [&](const sf::Int16* in, const sf::Int16* out, size_t index)
+    {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))));
+        __m256 b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(out))));
+        __m256 t = _mm256_add_ps(_mm256_set1_ps(start), _mm256_mul_ps(_mm256_set1_ps(step),
+                                 _mm256_add_ps(_mm256_set1_ps(static_cast<float>(index)), lanes)));
+        t = _mm256_min_ps(one, _mm256_max_ps(zero, t));
+        __m256 mixed = _mm256_add_ps(_mm256_mul_ps(a, gain(t)), _mm256_mul_ps(b, gain(_mm256_sub_ps(one, t))));
+        return _mm256_cvtps_epi32(mixed);
+    };
+    for (; i + 16 <= count; i += 16)
+    {
+        // packs works within 128-bit lanes, so put the quarters back in order
+        __m256i packed = _mm256_packs_epi32(mix(incoming + i, outgoing + i, i), mix(incoming + i + 8, outgoing + i + 8, i + 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(incoming + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+#elif defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 lanes = _mm_setr_ps(0, 1, 2, 3);
+    auto gain = [&](__m128 t)
+    {
+        if (curve == FADE_LINEAR)
+        {
+            return t;
+        }
+        __m128 t2 = _mm_mul_ps(t, t);
+        __m128 p = _mm_add_ps(_mm_set1_ps(FADE_SIN_C7), _mm_mul_ps(t2, _mm_set1_ps(FADE_SIN_C9)));
+        p = _mm_add_ps(_mm_set1_ps(FADE_SIN_C5), _mm_mul_ps(t2, p));
+        p = _mm_add_ps(_mm_set1_ps(FADE_SIN_C3), _mm_mul_ps(t2, p));
+        p = _mm_add_ps(_mm_set1_ps(FADE_SIN_C1), _mm_mul_ps(t2, p));
+        return _mm_mul_ps(t, p);
+    };
+    auto mix = [&](__m128i in, __m128i out, size_t index)
+    {
+        // Sign-extend four samples to 32 bits by shifting them down from the top half
+        __m128 a = _mm_cvtepi32_ps(_mm_srai_epi32(in, 16));
+        __m128 b = _mm_cvtepi32_ps(_mm_srai_epi32(out, 16));
+        __m128 t = _mm_add_ps(_mm_set1_ps(start), _mm_mul_ps(_mm_set1_ps(step),
+                              _mm_add_ps(_mm_set1_ps(static_cast<float>(index)), lanes)));
+        t = _mm_min_ps(one, _mm_max_ps(zero, t));
+        __m128 mixed = _mm_add_ps(_mm_mul_ps(a, gain(t)), _mm_mul_ps(b, gain(_mm_sub_ps(one, t))));
+        return _mm_cvtps_epi32(mixed);
+    };
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(incoming + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(outgoing + i));
+        __m128i low = mix(_mm_unpacklo_epi16(a, a), _mm_unpacklo_epi16(b, b), i);
+        __m128i high = mix(_mm_unpackhi_epi16(a, a), _mm_unpackhi_epi16(b, b), i + 4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(incoming + i), _mm_packs_epi32(low, high));
+    }
+#endif
+    crossfadeMixScalar(incoming + i, outgoing + i, count - i, start + step * static_cast<float>(i), step, curve);
+}
+
+void applyGainScalar(sf::Int16* samples, size_t count, float gain)
+{
+    for (size_t i = 0; i < count; ++i)
+    {
+        samples[i] = static_cast<sf::Int16>(max(-32768.0f, min(32767.0f, nearbyint(samples[i] * gain))));
+    }
+}
+
+void biquadStep(BiquadLanes& lanes)
+{
+    size_t i = 0;
+    float* x = lanes.x.data();
+    float* y = lanes.y.data();
+    float* z1 = lanes.z1.data();
+    float* z2 = lanes.z2.data();
+#if defined(__AVX2__)
+    for (; i + 8 <= lanes.count; i += 8)
+    {
+        __m256 in = _mm256_loadu_ps(x + i);
+        __m256 out = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(lanes.b0.data() + i), in), _mm256_loadu_ps(z1 + i));
+        __m256 s1 = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(lanes.b1.data() + i), in),
+                                                _mm256_mul_ps(_mm256_loadu_ps(lanes.a1.data() + i), out)),
+                                  _mm256_loadu_ps(z2 + i));
+        __m256 s2 = _mm256_sub_ps(_mm256_mul_ps(_mm256_loadu_ps(lanes.b2.data() + i), in),
+                                  _mm256_mul_ps(_mm256_loadu_ps(lanes.a2.data() + i), out));
+        _mm256_storeu_ps(y + i, out);
+        _mm256_storeu_ps(z1 + i, s1);
+        _mm256_storeu_ps(z2 + i, s2);
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= lanes.count; i += 4)
+    {
+        __m128 in = _mm_loadu_ps(x + i);
+        __m128 out = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(lanes.b0.data() + i), in), _mm_loadu_ps(z1 + i));
+        __m128 s1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(lanes.b1.data() + i), in),
+                                          _mm_mul_ps(_mm_loadu_ps(lanes.a1.data() + i), out)),
+                               _mm_loadu_ps(z2 + i));
+        __m128 s2 = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(lanes.b2.data() + i), in),
+                               _mm_mul_ps(_mm_loadu_ps(lanes.a2.data() + i), out));
+        _mm_storeu_ps(y + i, out);
+        _mm_storeu_ps(z1 + i, s1);
+        _mm_storeu_ps(z2 + i, s2);
+    }
+#endif
+    biquadStepScalar(lanes, i);
+}
+
+void biquadStepScalar(BiquadLanes& lanes, size_t first)
+{
+    for (size_t i = first; i < lanes.count; ++i)
+    {
+        float in = lanes.x[i];
+        float out = lanes.b0[i] * in + lanes.z1[i];
+        lanes.z1[i] = lanes.b1[i] * in - lanes.a1[i] * out + lanes.z2[i];
+        lanes.z2[i] = lanes.b2[i] * in - lanes.a2[i] * out;
+        lanes.y[i] = out;
+    }
+}
+
+void applyGain(sf::Int16* samples, size_t count, float gain)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256 factor = _mm256_set1_ps(gain);
+    auto scale = [&](const sf::Int16* in)
+    {
+        __m256 a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(in))));
+        return _mm256_cvtps_epi32(_mm256_mul_ps(a, factor));
+    };
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i packed = _mm256_packs_epi32(scale(samples + i), scale(samples + i + 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(samples + i), _mm256_permute4x64_epi64(packed, 0xD8));
+    }
+#elif defined(__SSE2__)
+    const __m128 factor = _mm_set1_ps(gain);
+    auto scale = [&](__m128i in)
+    {
+        return _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(in, 16)), factor));
+    };
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(samples + i));
+        __m128i low = scale(_mm_unpacklo_epi16(a, a));
+        __m128i high = scale(_mm_unpackhi_epi16(a, a));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(samples + i), _mm_packs_epi32(low, high));
+    }
+#endif
+    applyGainScalar(samples + i, count - i, gain);
+}
+
+int runCrossfadeBenchmark()
+{
+    // Ten seconds of stereo 44.1 kHz noise, faded end to end
+    const size_t count = 44100 * 2 * 10;
+    const int rounds = 20;
+    vector<sf::Int16> incoming(count), outgoing(count), mixed, reference;
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < count; ++i)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        incoming[i] = static_cast<sf::Int16>(seed >> 16);
+        outgoing[i] = static_cast<sf::Int16>(seed);
+    }
+
+#if defined(__AVX2__)
+    const char* kernel = "AVX2";
+#elif defined(__SSE2__)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    cout << "Crossfade kernel: " << kernel << ", " << count << " samples x " << rounds << " rounds\n";
+
+    for (FadeCurve curve : {FADE_LINEAR, FADE_EQUAL_POWER})
+    {
+        auto time = [&](auto mixer, vector<sf::Int16>& target)
+        {
+            double best = numeric_limits<double>::max();
+            for (int round = 0; round < rounds; ++round)
+            {
+                target = incoming;
+                auto started = chrono::steady_clock::now();
+                mixer(target.data(), outgoing.data(), count, 0.0f, 1.0f / count, curve);
+                best = min(best, chrono::duration<double, nano>(chrono::steady_clock::now() - started).count());
+            }
+            return best / count;
+        };
+        double vectorNs = time(crossfadeMix, mixed);
+        double scalarNs = time(crossfadeMixScalar, reference);
+
+        int maxError = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            maxError = max(maxError, abs(mixed[i] - reference[i]));
+        }
+        cout << fixed << setprecision(3);
+        cout << (curve == FADE_LINEAR ? "linear:      " : "equal power: ")
+             << vectorNs << " ns/sample (scalar " << scalarNs << ", "
+             << setprecision(1) << scalarNs / vectorNs << "x), max difference " << maxError << " LSB\n";
+        cout << defaultfloat;
+    }
+    return 0;
+}
+
+int runEqBenchmark()
+{
+    // Ten seconds of 48 kHz stereo noise through every band, in the blocks
+    // SFML asks for in low-latency mode
+    const unsigned int rate = 48000, channels = 2;
+    const size_t frames = rate * 10, block = rate / 50;
+    const int rounds = 5;
+    vector<float> input(frames * channels), output;
+    uint32_t seed = 12345;
+    for (float& sample : input)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        sample = static_cast<sf::Int16>(seed >> 16) * 0.5f;
+    }
+
+    Equalizer settings;
+    addBuiltInPresets(settings);
+    EqPreset preset = settings.presets[0];
+    preset.name = "Benchmark";
+    for (size_t band = 0; band < EQ_BANDS; ++band)
+    {
+        preset.bands[band].gainDb = band % 2 ? -4.0f : 4.0f;
+    }
+    settings.presets.push_back(preset);
+    settings.active = settings.presets.size() - 1;
+    settings.enabled = true;
+
+    ParametricEq eq(settings);
+    eq.configure(rate, channels);
+
+#if defined(__AVX2__)
+    const char* kernel = "AVX2";
+#elif defined(__SSE2__)
+    const char* kernel = "SSE2";
+#else
+    const char* kernel = "scalar";
+#endif
+    cout << "Biquad kernel: " << kernel << ", " << EQ_BANDS << " bands x " << channels << " channels, "
+         << frames << " frames x " << rounds << " rounds\n";
+
+    double best = numeric_limits<double>::max();
+    for (int round = 0; round < rounds; ++round)
+    {
+        output = input;
+        eq.reset();
+        auto started = chrono::steady_clock::now();
+        for (size_t offset = 0; offset < frames; offset += block)
+        {
+            if (eq.prepare())
+            {
+                eq.process(output.data() + offset * channels, min(block, frames - offset));
+            }
+        }
+        best = min(best, chrono::duration<double, nano>(chrono::steady_clock::now() - started).count());
+    }
+    double load = 100.0 * best / (frames * 1e9 / rate);   // Share of the time the audio lasts
+
+    // The vector kernel has to match the scalar one on the same lanes
+    BiquadLanes lanes[2];
+    for (BiquadLanes& copy : lanes)
+    {
+        copy.count = BIQUAD_LANE_WIDTH * 2;
+        for (vector<float>* values : {&copy.b0, &copy.b1, &copy.b2, &copy.a1, &copy.a2,
+                                      &copy.z1, &copy.z2, &copy.x, &copy.y})
+        {
+            values->assign(copy.count, 0.0f);
+        }
+        for (size_t lane = 0; lane < copy.count; ++lane)
+        {
+            float coefficients[5];
+            designBiquad(preset.bands[lane % EQ_BANDS], rate, coefficients);
+            copy.b0[lane] = coefficients[0];
+            copy.b1[lane] = coefficients[1];
+            copy.b2[lane] = coefficients[2];
+            copy.a1[lane] = coefficients[3];
+            copy.a2[lane] = coefficients[4];
+        }
+    }
+    float maxError = 0.0f;
+    for (size_t frame = 0; frame < frames; ++frame)
+    {
+        for (size_t lane = 0; lane < lanes[0].count; ++lane)
+        {
+            lanes[0].x[lane] = lanes[1].x[lane] = input[(frame * lanes[0].count + lane) % input.size()];
+        }
+        biquadStep(lanes[0]);
+        biquadStepScalar(lanes[1]);
+        for (size_t lane = 0; lane < lanes[0].count; ++lane)
+        {
+            maxError = max(maxError, fabs(lanes[0].y[lane] - lanes[1].y[lane]));
+        }
+    }
+
+    cout << fixed << setprecision(3);
+    cout << "equalizer: " << best / frames << " ns/frame, " << setprecision(2) << load
+         << "% of one core at 48 kHz stereo\n";
+    cout << "kernel check: max difference from scalar " << setprecision(4) << maxError << " (16-bit scale)\n";
+    cout << defaultfloat;
+    return 0;
+}
+
+// Library import
+void importLibrary(SongStore& playlist, PlaylistJournal& journal, ProbeCache& cache)
+{
+    clearScreen();
+    cout << MAGENTA << BOLD << "╔════════════════════════════════════════╗\n";
+    cout << "║          🎵 Import a Folder 🎵         ║\n";
+    cout << "╚════════════════════════════════════════╝" << RESET << "\n\n";
+
+    cout << CYAN << "🔹 Enter folder to import (blank for playlist_data): " << RESET;
+    string rootInput;
+    getline(cin, rootInput);
+    rootInput.erase(0, rootInput.find_first_not_of(" \t"));
+    rootInput.erase(rootInput.find_last_not_of(" \t") + 1);
+
+    fs::path root = rootInput.empty() ? fs::path("playlist_data") : fs::path(rootInput);
+    error_code ec;
+    if (!fs::is_directory(root, ec))
+    {
+        displayError("Folder not found: " + root.string());
+        return;
+    }
+    root = fs::absolute(root, ec).lexically_normal();
+
+    displayInfo("Scanning " + root.string() + " ...");
+
+    // Files that are already in the playlist are skipped without probing
+    unordered_set<string> known;
+    for (size_t i = 0; i < playlist.size(); ++i)
+    {
+        known.insert(fs::path(playlist.filepath(i)).lexically_normal().string());
+    }
+
+    ImportStats stats;
+    size_t hitsBefore = cache.hits;
+    vector<Song> found = scanLibrary(root, known, cache, stats);
+    size_t added = found.size();
+
+    playlist.reserve(playlist.size() + found.size());
+    for (const auto& song : found)
+    {
+        playlist.add(song);
+    }
+
+    // One snapshot for the whole batch instead of a journal record per file
+    if (added > 0)
+    {
+        compactPlaylist(playlist, journal);
+    }
+    saveProbeCache(cache);
+
+    double filesPerSecond = stats.seconds > 0.0 ? stats.filesProbed / stats.seconds : 0.0;
+    cout << "\n" << CYAN << "Folders scanned:  " << WHITE << stats.directories << "\n";
+    cout << CYAN << "Audio files:      " << WHITE << stats.filesProbed << "\n";
+    cout << CYAN << "Unreadable:       " << WHITE << stats.failed << "\n";
+    cout << CYAN << "Already present:  " << WHITE << stats.duplicates << "\n";
+    cout << CYAN << "Probe cache hits: " << WHITE << cache.hits - hitsBefore << "\n";
+    cout << CYAN << "Scan time:        " << WHITE << fixed << setprecision(2) << stats.seconds << " s ("
+         << setprecision(0) << filesPerSecond << " files/s)" << defaultfloat << RESET << "\n\n";
+    displaySuccess("✅ Imported " + to_string(added) + " song(s).");
+}
+
+vector<Song> scanLibrary(const fs::path& root, const unordered_set<string>& known, ProbeCache& cache, ImportStats& stats)
+{
+    auto start = chrono::steady_clock::now();
+    size_t workerCount = max(1u, thread::hardware_concurrency());
+
+    vector<ImportQueue> queues(workerCount);
+    vector<vector<Song>> results(workerCount);
+    vector<ImportStats> workerStats(workerCount);
+    atomic<size_t> outstanding(1);
+
+    // Idle workers park here until someone pushes tasks or the walk ends
+    mutex idleLock;
+    condition_variable idle;
+    uint64_t pushes = 0;
+
+    // Directories already listed, by canonical path, so symlinked folders are
+    // followed once and a link cycle cannot keep the walk going forever
+    mutex visitedLock;
+    unordered_set<string> visited;
+
+    queues[0].tasks.push_back({root, true});
+
+    auto popTask = [&](size_t self, ImportTask& task)
+    {
+        // Own queue first (LIFO keeps the walk depth-first and cache-warm)
+        {
+            lock_guard<mutex> guard(queues[self].lock);
+            if (!queues[self].tasks.empty())
+            {
+                task = move(queues[self].tasks.back());
+                queues[self].tasks.pop_back();
+                return true;
+            }
+        }
+        // Then steal the oldest task from someone else
+        for (size_t offset = 1; offset < workerCount; ++offset)
+        {
+            ImportQueue& victim = queues[(self + offset) % workerCount];
+            lock_guard<mutex> guard(victim.lock);
+            if (!victim.tasks.empty())
+            {
+                task = move(victim.tasks.front());
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto worker = [&](size_t self)
+    {
+        ImportTask task;
+        while (outstanding.load() > 0)
+        {
+            uint64_t seen;
+            {
+                lock_guard<mutex> guard(idleLock);
+                seen = pushes;
+            }
+            if (!popTask(self, task))
+            {
+                unique_lock<mutex> guard(idleLock);
+                idle.wait(guard, [&] { return pushes != seen || outstanding.load() == 0; });
+                continue;
+            }
+
+            error_code ec;
+            fs::path canonical = task.isDirectory ? fs::canonical(task.path, ec) : fs::path();
+            bool firstVisit = true;
+            if (task.isDirectory && !ec)
+            {
+                lock_guard<mutex> guard(visitedLock);
+                firstVisit = visited.insert(canonical.string()).second;
+            }
+
+            if (task.isDirectory && firstVisit)
+            {
+                workerStats[self].directories++;
+                vector<ImportTask> children;
+                for (fs::directory_iterator it(task.path, ec), end; !ec && it != end; it.increment(ec))
+                {
+                    error_code typeEc;
+                    if (it->is_directory(typeEc))
+                    {
+                        children.push_back({it->path(), true});
+                    }
+                    else if (it->is_regular_file(typeEc) && hasAudioExtension(it->path()))
+                    {
+                        // Size and mtime come with the directory listing and key the probe cache
+                        ImportTask file{it->path(), false};
+                        file.size = it->file_size(typeEc);
+                        file.mtime = it->last_write_time(typeEc).time_since_epoch().count();
+                        children.push_back(move(file));
+                    }
+                }
+
+                if (!children.empty())
+                {
+                    outstanding += children.size();
+                    {
+                        lock_guard<mutex> guard(queues[self].lock);
+                        for (auto& child : children)
+                        {
+                            queues[self].tasks.push_back(move(child));
+                        }
+                    }
+                    lock_guard<mutex> guard(idleLock);
+                    ++pushes;
+                    idle.notify_all();
+                }
+            }
+            else if (!task.isDirectory)
+            {
+                Song song;
+                if (known.count(task.path.lexically_normal().string()))
+                {
+                    workerStats[self].duplicates++;
+                }
+                else if (probeImportedFile(task, root, cache, song))
+                {
+                    results[self].push_back(move(song));
+                    workerStats[self].filesProbed++;
+                }
+                else
+                {
+                    workerStats[self].failed++;
+                }
+            }
+
+            if (--outstanding == 0)
+            {
+                lock_guard<mutex> guard(idleLock);
+                idle.notify_all();
+            }
+        }
+    };
+
+    vector<thread> threads;
+    for (size_t i = 1; i < workerCount; ++i)
+    {
+        threads.emplace_back(worker, i);
+    }
+    worker(0);
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    vector<Song> songs;
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        stats.directories += workerStats[i].directories;
+        stats.filesProbed += workerStats[i].filesProbed;
+        stats.failed += workerStats[i].failed;
+        stats.duplicates += workerStats[i].duplicates;
+        move(results[i].begin(), results[i].end(), back_inserter(songs));
+    }
+
+    // Workers finish in any order; keep the import order stable by path
+    sort(songs.begin(), songs.end(),
+        [](const Song& a, const Song& b) { return a.filepath < b.filepath; });
+
+    stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return songs;
+}
+
+bool probeImportedFile(const ImportTask& task, const fs::path& root, ProbeCache& cache, Song& song)
+{
+    const fs::path& path = task.path;
+    AudioProbe probe;
+    if (!probeAudioFileCached(cache, path.string(), task.size, task.mtime, probe))
+    {
+        return false;
+    }
+
+    song.filepath = path.lexically_normal().string();
+    song.title = probe.title.empty() ? path.stem().string() : probe.title;
+    song.artist = probe.artist.empty() ? guessArtist(song.title) : probe.artist;
+
+    // Without an album tag, use the containing folder unless the file sits in the root
+    fs::path parent = path.parent_path();
+    if (!probe.album.empty())
+    {
+        song.album = probe.album;
+    }
+    else
+    {
+        song.album = parent.lexically_normal() == root ? "Unknown Album" : parent.filename().string();
+    }
+    song.year = probe.year;
+    song.duration = probe.duration;
+    return true;
+}
+
+
+// Search index
+string searchText(const SongStore& playlist, size_t position)
+{
+    // Fields are separated by newlines so no trigram spans two fields
+    return toLower(string(playlist.title(position))) + '\n' + toLower(playlist.album(position)) + '\n' +
+           toLower(playlist.artist(position));
+}
+
+uint64_t letterMask(string_view text)
+{
+    uint64_t mask = 0;
+    for (unsigned char c : text)
+    {
+        mask |= 1ULL << (c & 63);
+    }
+    return mask;
+}
+
+vector<uint32_t> extractTrigrams(string_view text)
+{
+    vector<uint32_t> trigrams;
+    for (size_t i = 0; i + 3 <= text.size(); ++i)
+    {
+        if (text[i] == '\n' || text[i + 1] == '\n' || text[i + 2] == '\n')
+        {
+            continue;
+        }
+        trigrams.push_back((uint32_t(uint8_t(text[i])) << 16) |
+                           (uint32_t(uint8_t(text[i + 1])) << 8) |
+                            uint32_t(uint8_t(text[i + 2])));
+    }
+    sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
+
+void buildSearchIndex(SearchIndex& index, const SongStore& playlist)
+{
+    index = SearchIndex();
+    for (size_t i = 0; i < playlist.size(); ++i)
+    {
+        indexAdd(index, playlist, i);
+    }
+}
+
+void indexAdd(SearchIndex& index, const SongStore& playlist, size_t position)
+{
+    // Songs are indexed as they are appended, so position is the next free slot
+    uint32_t id = static_cast<uint32_t>(index.text.size());
+    index.text.push_back(searchText(playlist, position));
+    index.letters.push_back(letterMask(index.text[id]));
+    index.positionOf.push_back(static_cast<uint32_t>(index.idAt.size()));
+    index.idAt.push_back(id);
+
+    // Ids only grow, so appending keeps every posting list sorted
+    for (uint32_t trigram : extractTrigrams(index.text[id]))
+    {
+        index.postings[trigram].push_back(id);
+    }
+}
+
+void indexRemove(SearchIndex& index, size_t position)
+{
+    uint32_t id = index.idAt[position];
+    for (uint32_t trigram : extractTrigrams(index.text[id]))
+    {
+        auto it = index.postings.find(trigram);
+        if (it == index.postings.end()) continue;
+
+        vector<uint32_t>& ids = it->second;
+        auto found = lower_bound(ids.begin(), ids.end(), id);
+        if (found != ids.end() && *found == id)
+        {
+            ids.erase(found);
+        }
+        if (ids.empty())
+        {
+            index.postings.erase(it);
+        }
+    }
+
+    index.text[id].clear();
+    index.text[id].shrink_to_fit();
+    index.letters[id] = 0;
+    index.positionOf[id] = UINT32_MAX;
+    index.idAt.erase(index.idAt.begin() + position);
+    for (size_t i = position; i < index.idAt.size(); ++i)
+    {
+        index.positionOf[index.idAt[i]] = static_cast<uint32_t>(i);
+    }
+
+    if (++index.deadIds > index.text.size() / 2)
+    {
+        compactSearchIndex(index);
+    }
+}
+
+void compactSearchIndex(SearchIndex& index)
+{
+    // Give live songs dense ids in their old order; the mapping only ever
+    // moves ids down, so every posting list stays sorted as it is rewritten
+    vector<uint32_t> renamed(index.text.size(), UINT32_MAX);
+    uint32_t next = 0;
+    for (uint32_t id = 0; id < index.text.size(); ++id)
+    {
+        if (index.positionOf[id] == UINT32_MAX)
+        {
+            continue;
+        }
+        if (next != id)
+        {
+            index.text[next] = move(index.text[id]);
+            index.letters[next] = index.letters[id];
+            index.positionOf[next] = index.positionOf[id];
+        }
+        renamed[id] = next++;
+    }
+    index.text.resize(next);
+    index.letters.resize(next);
+    index.positionOf.resize(next);
+
+    for (uint32_t& id : index.idAt)
+    {
+        id = renamed[id];
+    }
+    for (auto& posting : index.postings)
+    {
+        for (uint32_t& id : posting.second)
+        {
+            id = renamed[id];
+        }
+    }
+    index.deadIds = 0;
+}
+
+void indexEdit(SearchIndex& index, size_t position, const SongStore& playlist)
+{
+    uint32_t id = index.idAt[position];
+    string updated = searchText(playlist, position);
+    if (updated == index.text[id])
+    {
+        return;
+    }
+
+    vector<uint32_t> before = extractTrigrams(index.text[id]);
+    vector<uint32_t> after = extractTrigrams(updated);
+
+    // Only trigrams that appear or disappear touch their posting lists
+    vector<uint32_t> removed, added;
+    set_difference(before.begin(), before.end(), after.begin(), after.end(), back_inserter(removed));
+    set_difference(after.begin(), after.end(), before.begin(), before.end(), back_inserter(added));
+
+    for (uint32_t trigram : removed)
+    {
+        auto it = index.postings.find(trigram);
+        if (it == index.postings.end()) continue;
+        vector<uint32_t>& ids = it->second;
+        auto found = lower_bound(ids.begin(), ids.end(), id);
+        if (found != ids.end() && *found == id)
+        {
+            ids.erase(found);
+        }
+        if (ids.empty())
+        {
+            index.postings.erase(it);
+        }
+    }
+    for (uint32_t trigram : added)
+    {
+        vector<uint32_t>& ids = index.postings[trigram];
+        ids.insert(lower_bound(ids.begin(), ids.end(), id), id);
+    }
+
+    index.text[id] = move(updated);
+    index.letters[id] = letterMask(index.text[id]);
+}
+
+void indexReorder(SearchIndex& index, const vector<uint32_t>& order)
+{
+    // Ids are stable, so a reorder only rewrites the position maps
+    vector<uint32_t> idAt(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        idAt[i] = index.idAt[order[i]];
+        index.positionOf[idAt[i]] = static_cast<uint32_t>(i);
+    }
+    index.idAt = move(idAt);
+}
+
+vector<uint32_t> querySearchIndex(const SearchIndex& index, const string& lowerQuery)
+{
+    vector<uint32_t> positions;
+    if (lowerQuery.empty())
+    {
+        return positions;
+    }
+
+    vector<uint32_t> trigrams = extractTrigrams(lowerQuery);
+    if (trigrams.empty())
+    {
+        // Too short for a trigram: scan the prebuilt lowercase text instead
+        for (size_t position = 0; position < index.idAt.size(); ++position)
+        {
+            if (index.text[index.idAt[position]].find(lowerQuery) != string::npos)
+            {
+                positions.push_back(static_cast<uint32_t>(position));
+            }
+        }
+        return positions;
+    }
+
+    // Intersect posting lists, rarest first, so the work follows the smallest list
+    vector<const vector<uint32_t>*> lists;
+    for (uint32_t trigram : trigrams)
+    {
+        auto it = index.postings.find(trigram);
+        if (it == index.postings.end())
+        {
+            return positions;
+        }
+        lists.push_back(&it->second);
+    }
+    sort(lists.begin(), lists.end(),
+        [](const vector<uint32_t>* a, const vector<uint32_t>* b) { return a->size() < b->size(); });
+
+    vector<uint32_t> candidates = *lists[0];
+    for (size_t i = 1; i < lists.size() && !candidates.empty(); ++i)
+    {
+        const vector<uint32_t>& ids = *lists[i];
+        size_t kept = 0;
+        auto cursor = ids.begin();
+        for (uint32_t id : candidates)
+        {
+            cursor = lower_bound(cursor, ids.end(), id);
+            if (cursor == ids.end()) break;
+            if (*cursor == id)
+            {
+                candidates[kept++] = id;
+            }
+        }
+        candidates.resize(kept);
+    }
+
+    // Trigrams only narrow things down; confirm the substring on the survivors.
+    // A three-letter query is its own trigram and needs no check.
+    bool verify = lowerQuery.size() > 3;
+    for (uint32_t id : candidates)
+    {
+        if (!verify || index.text[id].find(lowerQuery) != string::npos)
+        {
+            positions.push_back(index.positionOf[id]);
+        }
+    }
+
+    // Large result sets are put back in playlist order with a mark-and-sweep
+    // pass instead of a comparison sort
+    if (positions.size() > index.idAt.size() / 16)
+    {
+        vector<uint8_t> marked(index.idAt.size(), 0);
+        for (uint32_t position : positions)
+        {
+            marked[position] = 1;
+        }
+        positions.clear();
+        for (size_t position = 0; position < marked.size(); ++position)
+        {
+            if (marked[position])
+            {
+                positions.push_back(static_cast<uint32_t>(position));
+            }
+        }
+    }
+    else
+    {
+        sort(positions.begin(), positions.end());
+    }
+    return positions;
+}
+void searchPush(SearchSession& session, const SearchIndex& index, char ch)
+{
+    session.query += static_cast<char>(tolower(static_cast<unsigned char>(ch)));
+
+    if (session.results.empty())
+    {
+        session.results.push_back(querySearchIndex(index, session.query));
+        return;
+    }
+
+    // Anything matching the longer query also matched the shorter one, so
+    // only the previous result needs checking, unless the index already has
+    // a smaller candidate list for it
+    const vector<uint32_t>& previous = session.results.back();
+    size_t smallestPosting = SIZE_MAX;
+    for (uint32_t trigram : extractTrigrams(session.query))
+    {
+        auto it = index.postings.find(trigram);
+        smallestPosting = min(smallestPosting, it == index.postings.end() ? size_t(0) : it->second.size());
+    }
+    if (smallestPosting < previous.size())
+    {
+        session.results.push_back(querySearchIndex(index, session.query));
+        return;
+    }
+
+    vector<uint32_t> refined;
+    refined.reserve(previous.size());
+    for (uint32_t position : previous)
+    {
+        if (index.text[index.idAt[position]].find(session.query) != string::npos)
+        {
+            refined.push_back(position);
+        }
+    }
+    session.results.push_back(move(refined));
+}
+
+void searchPop(SearchSession& session)
+{
+    if (!session.query.empty())
+    {
+        session.query.pop_back();
+        session.results.pop_back();
+    }
+}
+
+int myersDistance(const uint64_t* peq, int length, string_view text, size_t& bestEnd)
+{
+    // Myers' bit-vector edit distance, with a free start anywhere in the text
+    const uint64_t highBit = 1ULL << (length - 1);
+    uint64_t pv = length == 64 ? ~0ULL : (1ULL << length) - 1;
+    uint64_t mv = 0;
+    int score = length;
+    int best = length;
+    bestEnd = 0;
+
+    for (size_t i = 0; i < text.size(); ++i)
+    {
+        uint64_t eq = peq[static_cast<unsigned char>(text[i])];
+        uint64_t xv = eq | mv;
+        uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+        uint64_t ph = mv | ~(xh | pv);
+        uint64_t mh = pv & xh;
+
+        if (ph & highBit) score++;
+        else if (mh & highBit) score--;
+
+        ph <<= 1;
+        mh <<= 1;
+        pv = mh | ~(xv | ph);
+        mv = ph & xv;
+
+        if (score < best)
+        {
+            best = score;
+            bestEnd = i;
+            if (best == 0) break;
+        }
+    }
+    return best;
+}
+
+vector<uint32_t> fuzzySearch(const SearchIndex& index, const string& lowerQuery)
+{
+    // Each word of the query is matched on its own, so "perm dance" finds
+    // "Permission to Dance"; longer words tolerate more typos
+    vector<FuzzyPattern> patterns;
+    istringstream words(lowerQuery);
+    string word;
+    while (words >> word)
+    {
+        FuzzyPattern pattern;
+        pattern.length = static_cast<int>(min<size_t>(word.size(), 64));
+        pattern.maxErrors = pattern.length <= 3 ? 0 : (pattern.length <= 6 ? 1 : 2);
+        for (int i = 0; i < pattern.length; ++i)
+        {
+            pattern.peq[static_cast<unsigned char>(word[i])] |= 1ULL << i;
+        }
+        pattern.letters = letterMask(string_view(word).substr(0, pattern.length));
+        patterns.push_back(pattern);
+    }
+
+    vector<FuzzyMatch> matches;
+    if (patterns.empty())
+    {
+        return {};
+    }
+
+    // Score the library in parallel chunks; each chunk collects its own matches
+    const size_t count = index.idAt.size();
+    mutex matchesLock;
+    parallelFor(count, [&](size_t begin, size_t end)
+    {
+        vector<FuzzyMatch> local;
+        for (size_t position = begin; position < end; ++position)
+        {
+            uint32_t id = index.idAt[position];
+            const string& text = index.text[id];
+
+            // Every letter of a word missing from the text costs at least one
+            // edit, so most songs are rejected before running the matcher
+            bool matched = true;
+            for (const auto& pattern : patterns)
+            {
+                if (__builtin_popcountll(pattern.letters & ~index.letters[id]) > pattern.maxErrors)
+                {
+                    matched = false;
+                    break;
+                }
+            }
+            if (!matched)
+            {
+                continue;
+            }
+
+            size_t titleLength = min(text.find('\n'), text.size());
+            float score = 0.0f;
+            for (const auto& pattern : patterns)
+            {
+                size_t bestEnd;
+                int distance = myersDistance(pattern.peq, pattern.length, text, bestEnd);
+                if (distance > pattern.maxErrors)
+                {
+                    matched = false;
+                    break;
+                }
+
+                // Typos cost the most; hits outside the title rank below title hits
+                score += distance * 10.0f + (bestEnd >= titleLength ? 3.0f : 0.0f);
+            }
+
+            if (matched)
+            {
+                // Among equal scores prefer shorter, more specific titles
+                score += titleLength / 100.0f;
+                local.push_back({static_cast<uint32_t>(position), score});
+            }
+        }
+
+        lock_guard<mutex> guard(matchesLock);
+        matches.insert(matches.end(), local.begin(), local.end());
+    });
+
+    sort(matches.begin(), matches.end(), [](const FuzzyMatch& a, const FuzzyMatch& b)
+    {
+        return a.score != b.score ? a.score < b.score : a.position < b.position;
+    });
+
+    vector<uint32_t> ranked;
+    ranked.reserve(matches.size());
+    for (const auto& match : matches)
+    {
+        ranked.push_back(match.position);
+    }
+    return ranked;
+}
+
+// Sorting
+vector<uint32_t> sortOrder(const SongStore& playlist, SortCache& cache, const vector<SortField>& fields, bool& cached)
+{
+    cached = false;
+    if (playlist.empty())
+    {
+        return {};
+    }
+    if (cache.contentVersion != playlist.contentVersion)
+    {
+        buildSortRanks(cache, playlist);
+    }
+
+    string spec;
+    for (SortField field : fields)
+    {
+        spec += static_cast<char>('0' + field);
+    }
+
+    // Orders are cached as stable ids so they outlive the reorder they cause
+    auto it = cache.orders.find(spec);
+    cached = it != cache.orders.end();
+    if (cached)
+    {
+        cache.hits++;
+        vector<uint32_t> positionOf(playlist.nextId);
+        for (size_t i = 0; i < playlist.size(); ++i)
+        {
+            positionOf[playlist.ids[i]] = static_cast<uint32_t>(i);
+        }
+
+        vector<uint32_t> order(playlist.size());
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = positionOf[it->second[i]];
+        }
+        return order;
+    }
+    cache.misses++;
+
+    // Every field becomes an unsigned column whose integer order is the sort order
+    vector<vector<uint32_t>> columns(fields.size(), vector<uint32_t>(playlist.size()));
+    for (size_t f = 0; f < fields.size(); ++f)
+    {
+        vector<uint32_t>& column = columns[f];
+        for (size_t i = 0; i < playlist.size(); ++i)
+        {
+            switch (fields[f])
+            {
+                case SORT_TITLE:
+                    column[i] = cache.titleRanks[playlist.ids[i]];
+                    break;
+                case SORT_ALBUM:
+                    column[i] = cache.nameRanks[playlist.albums[i]];
+                    break;
+                case SORT_ARTIST:
+                    column[i] = cache.nameRanks[playlist.artists[i]];
+                    break;
+                case SORT_YEAR:
+                    column[i] = static_cast<uint32_t>(playlist.years[i]) ^ 0x80000000u;
+                    break;
+                case SORT_DURATION:
+                {
+                    uint32_t bits;
+                    memcpy(&bits, &playlist.durations[i], sizeof(bits));
+                    column[i] = (bits & 0x80000000u) ? ~bits : bits | 0x80000000u;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Ties fall back to the order songs were added in, so the result is stable
+    // and does not depend on the order the playlist happened to be in
+    vector<uint32_t> lows(columns.size());
+    vector<int> widths(columns.size());
+    int idBits = 64 - __builtin_clzll(uint64_t(playlist.nextId) | 1);
+    int bits = idBits;
+    for (size_t f = 0; f < columns.size(); ++f)
+    {
+        auto range = minmax_element(columns[f].begin(), columns[f].end());
+        lows[f] = *range.first;
+        widths[f] = 64 - __builtin_clzll(uint64_t(*range.second - *range.first) | 1);
+        bits += widths[f];
+    }
+
+    vector<uint32_t> order(playlist.size());
+    if (bits <= 64)
+    {
+        // Common case: every column's value range plus the id fit in one
+        // integer per song, so the sort compares plain 64-bit keys
+        vector<uint64_t> packed(playlist.size());
+        vector<uint32_t> positionOf(playlist.nextId);
+        for (size_t i = 0; i < packed.size(); ++i)
+        {
+            uint64_t key = 0;
+            for (size_t f = 0; f < columns.size(); ++f)
+            {
+                key = (key << widths[f]) | (columns[f][i] - lows[f]);
+            }
+            packed[i] = (key << idBits) | playlist.ids[i];
+            positionOf[playlist.ids[i]] = static_cast<uint32_t>(i);
+        }
+
+        parallelSort(packed, less<uint64_t>());
+
+        uint64_t idMask = (uint64_t(1) << idBits) - 1;
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = positionOf[packed[i] & idMask];
+        }
+    }
+    else
+    {
+        for (size_t i = 0; i < order.size(); ++i)
+        {
+            order[i] = static_cast<uint32_t>(i);
+        }
+        parallelSort(order, [&](uint32_t a, uint32_t b)
+        {
+            for (const auto& column : columns)
+            {
+                if (column[a] != column[b])
+                {
+                    return column[a] < column[b];
+                }
+            }
+            return playlist.ids[a] < playlist.ids[b];
+        });
+    }
+
+    vector<uint32_t>& sortedIds = cache.orders[spec];
+    sortedIds.resize(order.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        sortedIds[i] = playlist.ids[order[i]];
+    }
+    return order;
+}
+
+bool parseSortFields(const string& text, vector<SortField>& fields)
+{
+    fields.clear();
+    stringstream keys(text);
+    string key;
+    while (getline(keys, key, ','))
+    {
+        key.erase(0, key.find_first_not_of(" \t"));
+        key.erase(key.find_last_not_of(" \t") + 1);
+        key = toLower(key);
+
+        if (key.empty()) continue;
+        if (key == "title") fields.push_back(SORT_TITLE);
+        else if (key == "album") fields.push_back(SORT_ALBUM);
+        else if (key == "artist") fields.push_back(SORT_ARTIST);
+        else if (key == "year") fields.push_back(SORT_YEAR);
+        else if (key == "duration" || key == "length") fields.push_back(SORT_DURATION);
+        else return false;
+    }
+    return !fields.empty();
+}
+
+void buildSortRanks(SortCache& cache, const SongStore& playlist)
+{
+    cache.contentVersion = playlist.contentVersion;
+    cache.orders.clear();
+
+    // Sorting by (8-byte prefix, full key) settles most comparisons on one
+    // integer; equal keys share a rank
+    auto assignRanks = [](const vector<string>& keys, vector<uint32_t>& ranks)
+    {
+        vector<uint64_t> prefixes(keys.size());
+        vector<uint32_t> order(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            prefixes[i] = collationPrefix(keys[i]);
+            order[i] = static_cast<uint32_t>(i);
+        }
+
+        parallelSort(order, [&](uint32_t a, uint32_t b)
+        {
+            if (prefixes[a] != prefixes[b])
+            {
+                return prefixes[a] < prefixes[b];
+            }
+            return keys[a] < keys[b];
+        });
+
+        ranks.assign(keys.size(), 0);
+        uint32_t rank = 0;
+        for (size_t i = 1; i < order.size(); ++i)
+        {
+            if (keys[order[i]] != keys[order[i - 1]])
+            {
+                ++rank;
+            }
+            ranks[order[i]] = rank;
+        }
+    };
+
+    vector<string> keys(playlist.names.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        keys[i] = collationKey(playlist.names[i]);
+    }
+    assignRanks(keys, cache.nameRanks);
+
+    keys.assign(playlist.size(), string());
+    for (size_t i = 0; i < playlist.size(); ++i)
+    {
+        keys[i] = collationKey(playlist.title(i));
+    }
+    vector<uint32_t> ranks;
+    assignRanks(keys, ranks);
+
+    cache.titleRanks.assign(playlist.nextId, 0);
+    for (size_t i = 0; i < playlist.size(); ++i)
+    {
+        cache.titleRanks[playlist.ids[i]] = ranks[i];
+    }
+}
+
+string collationKey(string_view text)
+{
+    // ASCII letters are case-folded and whitespace is trimmed and collapsed;
+    // other bytes (Hangul, accents) compare by their UTF-8 encoding
+    string key;
+    key.reserve(text.size());
+    bool pendingSpace = false;
+    for (unsigned char c : text)
+    {
+        if (c == ' ' || c == '\t')
+        {
+            pendingSpace = !key.empty();
+            continue;
+        }
+        if (pendingSpace)
+        {
+            key += ' ';
+            pendingSpace = false;
+        }
+        key += static_cast<char>(c < 128 ? tolower(c) : c);
+    }
+    return key;
+}
+
+uint64_t collationPrefix(string_view key)
+{
+    // First eight bytes, big-endian, so integer order matches byte order
+    uint64_t prefix = 0;
+    for (size_t i = 0; i < 8; ++i)
+    {
+        prefix = (prefix << 8) | (i < key.size() ? static_cast<unsigned char>(key[i]) : 0);
+    }
+    return prefix;
+}
+
+// Filter queries
+vector<uint32_t> filterSongs(const SongStore& playlist, FilterIndex& index, int& selected)
+{
+    selected = -1;
+    if (playlist.empty())
+    {
+        displayError("🎵 Playlist is empty!");
+        return {};
+    }
+
+    if (index.version != playlist.version)
+    {
+        buildFilterIndex(index, playlist);
+    }
+
+    while (true)
+    {
+        clearScreen();
+        cout << BOLD << CYAN << "╔══════════════════════════════════════════╗" << RESET << '\n';
+        cout << BOLD << CYAN << "║           🎶 Filter Songs 🎶             ║" << RESET << '\n';
+        cout << BOLD << CYAN << "╚══════════════════════════════════════════╝" << RESET << '\n' << '\n';
+
+        cout << "Fields: year, duration, album, artist. Separate clauses with commas.\n";
+        cout << "Example: " << WHITE << "year 2017-2020, duration < 4:00, album = BE | Butter" << RESET << "\n\n";
+
+        string query;
+        cout << YELLOW << "Filter (Enter to return): " << RESET;
+        getline(cin, query);
+        if (query.find_first_not_of(" \t") == string::npos)
+        {
+            return {};
+        }
+
+        vector<FilterPredicate> predicates;
+        string error;
+        if (!parseFilterQuery(query, predicates, error))
+        {
+            displayError(error);
+            continue;
+        }
+
+        auto start = chrono::steady_clock::now();
+        vector<uint32_t> matches = runFilterQuery(index, predicates);
+        double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        if (matches.empty())
+        {
+            displayInfo("No songs match that filter.");
+            this_thread::sleep_for(chrono::milliseconds(1500));
+            continue;
+        }
+
+        stringstream heading;
+        heading << "🎵 " << matches.size() << " matching songs (" << fixed << setprecision(2) << elapsed << " ms) 🎵";
+        selected = browsePlaylist(playlist, heading.str(), &matches);
+        return matches;
+    }
+}
+
+void buildFilterIndex(FilterIndex& index, const SongStore& playlist)
+{
+    index = FilterIndex();
+    index.version = playlist.version;
+    index.songCount = playlist.size();
+    index.words = (playlist.size() + 63) / 64;
+
+    // Names are lowercased once per interned spelling, not once per song
+    vector<ValueColumn*> albumOf(playlist.names.size()), artistOf(playlist.names.size());
+    auto columnFor = [&](vector<ValueColumn*>& seen, unordered_map<string, ValueColumn>& columns, uint32_t name)
+    {
+        if (!seen[name])
+        {
+            seen[name] = &columns[toLower(playlist.names[name])];
+        }
+        return seen[name];
+    };
+
+    vector<pair<float, uint32_t>> years, durations;
+    years.reserve(playlist.size());
+    durations.reserve(playlist.size());
+    for (size_t i = 0; i < playlist.size(); ++i)
+    {
+        uint32_t position = static_cast<uint32_t>(i);
+        years.emplace_back(static_cast<float>(playlist.years[i]), position);
+        durations.emplace_back(playlist.durations[i], position);
+        columnFor(albumOf, index.albums, playlist.albums[i])->positions.push_back(position);
+        columnFor(artistOf, index.artists, playlist.artists[i])->positions.push_back(position);
+    }
+
+    auto fillColumn = [](vector<pair<float, uint32_t>>& entries, SortedColumn& column)
+    {
+        sort(entries.begin(), entries.end());
+        column.values.reserve(entries.size());
+        column.positions.reserve(entries.size());
+        for (const auto& entry : entries)
+        {
+            column.values.push_back(entry.first);
+            column.positions.push_back(entry.second);
+        }
+    };
+    fillColumn(years, index.years);
+    fillColumn(durations, index.durations);
+
+    // A position list costs 32 bits per song, a bitmap one bit per playlist entry
+    auto packColumns = [&](unordered_map<string, ValueColumn>& columns)
+    {
+        for (auto& entry : columns)
+        {
+            ValueColumn& column = entry.second;
+            if (column.positions.size() * 32 < playlist.size())
+            {
+                continue;
+            }
+            column.bitmap.assign(index.words, 0);
+            for (uint32_t position : column.positions)
+            {
+                column.bitmap[position / 64] |= 1ULL << (position % 64);
+            }
+            column.positions.clear();
+            column.positions.shrink_to_fit();
+        }
+    };
+    packColumns(index.albums);
+    packColumns(index.artists);
+}
+
+bool parseFilterQuery(const string& query, vector<FilterPredicate>& predicates, string& error)
+{
+    // Accept the en dash people paste for ranges ("2017–2020")
+    string text = query;
+    for (size_t dash = text.find("\xE2\x80\x93"); dash != string::npos; dash = text.find("\xE2\x80\x93", dash))
+    {
+        text.replace(dash, 3, "-");
+    }
+
+    auto trim = [](const string& value)
+    {
+        size_t first = value.find_first_not_of(" \t");
+        if (first == string::npos) return string();
+        return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+    };
+
+    stringstream clauses(text);
+    string clause;
+    while (getline(clauses, clause, ','))
+    {
+        clause = trim(clause);
+        if (clause.empty()) continue;
+
+        size_t nameEnd = 0;
+        while (nameEnd < clause.size() && isalpha(static_cast<unsigned char>(clause[nameEnd])))
+        {
+            ++nameEnd;
+        }
+        string name = toLower(clause.substr(0, nameEnd));
+
+        FilterPredicate predicate;
+        if (name == "year") predicate.field = FILTER_YEAR;
+        else if (name == "duration" || name == "length") predicate.field = FILTER_DURATION;
+        else if (name == "album") predicate.field = FILTER_ALBUM;
+        else if (name == "artist") predicate.field = FILTER_ARTIST;
+        else
+        {
+            error = "Unknown filter field '" + clause.substr(0, max<size_t>(nameEnd, 1)) + "'.";
+            return false;
+        }
+
+        string rest = trim(clause.substr(nameEnd));
+        string op;
+        for (const char* candidate : {"<=", ">=", "!=", "=", "<", ">"})
+        {
+            if (rest.compare(0, strlen(candidate), candidate) == 0)
+            {
+                op = candidate;
+                break;
+            }
+        }
+        string value = trim(rest.substr(op.size()));
+        if (value.empty())
+        {
+            error = "Missing value for '" + name + "'.";
+            return false;
+        }
+
+        if (predicate.field == FILTER_ALBUM || predicate.field == FILTER_ARTIST)
+        {
+            if (op != "" && op != "=" && op != "!=")
+            {
+                error = "Use = or != with " + name + ".";
+                return false;
+            }
+            predicate.negate = op == "!=";
+
+            // "album = BE | Butter" matches either album
+            stringstream alternatives(value);
+            string alternative;
+            while (getline(alternatives, alternative, '|'))
+            {
+                alternative = trim(alternative);
+                if (!alternative.empty())
+                {
+                    predicate.values.push_back(toLower(alternative));
+                }
+            }
+            predicates.push_back(move(predicate));
+            continue;
+        }
+
+        // Numbers compare at whole-unit resolution, the way they are displayed
+        double number;
+        size_t dash = value.find('-', 1);
+        if ((op.empty() || op == "=") && dash != string::npos)
+        {
+            double upper;
+            if (!parseFilterNumber(trim(value.substr(0, dash)), predicate.field, number) ||
+                !parseFilterNumber(trim(value.substr(dash + 1)), predicate.field, upper))
+            {
+                error = "Invalid range '" + value + "'.";
+                return false;
+            }
+            predicate.low = min(number, upper);
+            predicate.high = max(number, upper) + 1;
+        }
+        else
+        {
+            if (!parseFilterNumber(value, predicate.field, number))
+            {
+                error = "Invalid " + name + " '" + value + "'.";
+                return false;
+            }
+
+            const double infinity = numeric_limits<double>::infinity();
+            if (op == "<") { predicate.low = -infinity; predicate.high = number; }
+            else if (op == "<=") { predicate.low = -infinity; predicate.high = number + 1; }
+            else if (op == ">") { predicate.low = number + 1; predicate.high = infinity; }
+            else if (op == ">=") { predicate.low = number; predicate.high = infinity; }
+            else { predicate.low = number; predicate.high = number + 1; }
+            predicate.negate = op == "!=";
+        }
+        predicates.push_back(move(predicate));
+    }
+
+    if (predicates.empty())
+    {
+        error = "Filter is empty.";
+        return false;
+    }
+    return true;
+}
+
+bool parseFilterNumber(const string& text, FilterField field, double& value)
+{
+    // Durations may be written as m:ss or as plain seconds
+    size_t colon = text.find(':');
+    if (field == FILTER_DURATION && colon != string::npos)
+    {
+        double minutes, seconds;
+        if (!parseFilterNumber(text.substr(0, colon), FILTER_YEAR, minutes) ||
+            !parseFilterNumber(text.substr(colon + 1), FILTER_YEAR, seconds) || seconds >= 60)
+        {
+            return false;
+        }
+        value = minutes * 60 + seconds;
+        return true;
+    }
+
+    if (text.empty()) return false;
+    char* end;
+    value = strtod(text.c_str(), &end);
+    return *end == '\0' && value >= 0;
+}
+
+vector<uint32_t> runFilterQuery(const FilterIndex& index, const vector<FilterPredicate>& predicates)
+{
+    vector<uint64_t> result(index.words, ~0ULL);
+    if (index.songCount % 64 != 0)
+    {
+        result.back() = (1ULL << (index.songCount % 64)) - 1;
+    }
+
+    vector<uint64_t> matched(index.words);
+    for (const auto& predicate : predicates)
+    {
+        fill(matched.begin(), matched.end(), 0);
+        switch (predicate.field)
+        {
+            case FILTER_YEAR:
+                markRange(index.years, predicate.low, predicate.high, matched);
+                break;
+            case FILTER_DURATION:
+                markRange(index.durations, predicate.low, predicate.high, matched);
+                break;
+            case FILTER_ALBUM:
+            case FILTER_ARTIST:
+            {
+                const auto& columns = predicate.field == FILTER_ALBUM ? index.albums : index.artists;
+                for (const auto& value : predicate.values)
+                {
+                    auto it = columns.find(value);
+                    if (it != columns.end())
+                    {
+                        markValue(it->second, matched);
+                    }
+                }
+                break;
+            }
+        }
+
+        if (predicate.negate)
+        {
+            bitmapAndNot(result.data(), matched.data(), index.words);
+        }
+        else
+        {
+            bitmapAnd(result.data(), matched.data(), index.words);
+        }
+    }
+
+    // Set bits come out in playlist order
+    vector<uint32_t> positions;
+    for (size_t word = 0; word < result.size(); ++word)
+    {
+        for (uint64_t bits = result[word]; bits != 0; bits &= bits - 1)
+        {
+            positions.push_back(static_cast<uint32_t>(word * 64 + __builtin_ctzll(bits)));
+        }
+    }
+    return positions;
+}
+
+void markRange(const SortedColumn& column, double low, double high, vector<uint64_t>& bitmap)
+{
+    auto begin = lower_bound(column.values.begin(), column.values.end(), low);
+    auto end = lower_bound(begin, column.values.end(), high);
+    for (size_t i = begin - column.values.begin(); i < static_cast<size_t>(end - column.values.begin()); ++i)
+    {
+        uint32_t position = column.positions[i];
+        bitmap[position / 64] |= 1ULL << (position % 64);
+    }
+}
+
+void markValue(const ValueColumn& column, vector<uint64_t>& bitmap)
+{
+    if (!column.bitmap.empty())
+    {
+        bitmapOr(bitmap.data(), column.bitmap.data(), bitmap.size());
+        return;
+    }
+    for (uint32_t position : column.positions)
+    {
+        bitmap[position / 64] |= 1ULL << (position % 64);
+    }
+}
+
+void bitmapAnd(uint64_t* target, const uint64_t* source, size_t words)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= words; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_and_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= words; i += 2)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_and_si128(a, b));
+    }
+#endif
+    for (; i < words; ++i)
+    {
+        target[i] &= source[i];
+    }
+}
+
+void bitmapOr(uint64_t* target, const uint64_t* source, size_t words)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= words; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_or_si256(a, b));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= words; i += 2)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_or_si128(a, b));
+    }
+#endif
+    for (; i < words; ++i)
+    {
+        target[i] |= source[i];
+    }
+}
+
+void bitmapAndNot(uint64_t* target, const uint64_t* source, size_t words)
+{
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 4 <= words; i += 4)
+    {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(target + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(source + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(target + i), _mm256_andnot_si256(b, a));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= words; i += 2)
+    {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(target + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(source + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(target + i), _mm_andnot_si128(b, a));
+    }
+#endif
+    for (; i < words; ++i)
+    {
+        target[i] &= ~source[i];
+    }
+}
+
+// Audio metadata probing
+uint32_t readLE16(const unsigned char* bytes)
+{
+    return bytes[0] | (bytes[1] << 8);
+}
+
+uint32_t readLE32(const unsigned char* bytes)
+{
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | (uint32_t(bytes[3]) << 24);
+}
+
+uint64_t readLE64(const unsigned char* bytes)
+{
+    return readLE32(bytes) | (uint64_t(readLE32(bytes + 4)) << 32);
+}
+
+uint32_t readBE32(const unsigned char* bytes)
+{
+    return (uint32_t(bytes[0]) << 24) | (bytes[1] << 16) | (bytes[2] << 8) | bytes[3];
+}
+
+bool probeAudioFile(const string& filepath, AudioProbe& probe)
+{
+    probe = AudioProbe();
+
+    ifstream file(filepath, ios::binary);
+    if (!file)
+    {
+        return false;
+    }
+
+    file.seekg(0, ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    file.seekg(0);
+
+    char magic[4] = {};
+    file.read(magic, sizeof(magic));
+    file.seekg(0);
+
+    bool ok = false;
+    if (memcmp(magic, "OggS", 4) == 0)
+    {
+        ok = probeOgg(file, fileSize, probe);
+    }
+    else if (memcmp(magic, "fLaC", 4) == 0 || memcmp(magic, "ID3", 3) == 0)
+    {
+        ok = probeFlac(file, probe);
+    }
+    else if (memcmp(magic, "RIFF", 4) == 0)
+    {
+        ok = probeWav(file, probe);
+    }
+
+    if (!ok)
+    {
+        // Formats we do not parse (MP3) fall back to SFML's header reader
+        sf::InputSoundFile soundFile;
+        if (!soundFile.openFromFile(filepath))
+        {
+            return false;
+        }
+        probe.duration = soundFile.getDuration().asSeconds();
+        probe.sampleRate = soundFile.getSampleRate();
+        probe.channels = soundFile.getChannelCount();
+    }
+    return true;
+}
+
+bool probeOgg(ifstream& file, uint64_t fileSize, AudioProbe& probe)
+{
+    // Walk pages until the identification and comment packets are complete
+    const size_t maxHeaderBytes = 4 << 20;
+    vector<string> packets(1);
+    uint32_t serial = 0;
+    bool firstPage = true;
+    size_t bytesRead = 0;
+
+    while (packets.size() <= 2 && bytesRead < maxHeaderBytes)
+    {
+        unsigned char header[27];
+        if (!file.read(reinterpret_cast<char*>(header), sizeof(header)) || memcmp(header, "OggS", 4) != 0)
+        {
+            return false;
+        }
+
+        unsigned char lacing[255];
+        int segments = header[26];
+        if (!file.read(reinterpret_cast<char*>(lacing), segments))
+        {
+            return false;
+        }
+
+        size_t bodySize = 0;
+        for (int i = 0; i < segments; ++i)
+        {
+            bodySize += lacing[i];
+        }
+
+        string body(bodySize, '\0');
+        if (!file.read(&body[0], bodySize))
+        {
+            return false;
+        }
+        bytesRead += sizeof(header) + segments + bodySize;
+
+        uint32_t pageSerial = readLE32(header + 14);
+        if (firstPage)
+        {
+            serial = pageSerial;
+            firstPage = false;
+        }
+        if (pageSerial != serial)
+        {
+            continue;   // Another multiplexed stream
+        }
+
+        size_t offset = 0;
+        for (int i = 0; i < segments && packets.size() <= 2; ++i)
+        {
+            packets.back().append(body, offset, lacing[i]);
+            offset += lacing[i];
+            if (lacing[i] < 255)
+            {
+                packets.emplace_back();
+            }
+        }
+    }
+
+    if (packets.size() < 3)
+    {
+        return false;
+    }
+
+    const string& ident = packets[0];
+    const string& comments = packets[1];
+    uint64_t preSkip = 0;
+    uint32_t granuleRate = 0;
+
+    if (ident.size() >= 30 && ident.compare(0, 7, "\x01vorbis") == 0)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(ident.data());
+        probe.channels = bytes[11];
+        probe.sampleRate = readLE32(bytes + 12);
+        granuleRate = probe.sampleRate;
+        if (comments.compare(0, 7, "\x03vorbis") == 0)
+        {
+            parseVorbisComments(comments.data() + 7, comments.size() - 7, probe);
+        }
+    }
+    else if (ident.size() >= 19 && ident.compare(0, 8, "OpusHead") == 0)
+    {
+        const auto* bytes = reinterpret_cast<const unsigned char*>(ident.data());
+        probe.channels = bytes[9];
+        preSkip = readLE16(bytes + 10);
+        probe.sampleRate = readLE32(bytes + 12);
+        granuleRate = 48000;    // Opus granules always count 48 kHz samples
+        if (comments.compare(0, 8, "OpusTags") == 0)
+        {
+            parseVorbisComments(comments.data() + 8, comments.size() - 8, probe);
+        }
+    }
+    else
+    {
+        return false;
+    }
+
+    if (granuleRate == 0)
+    {
+        return false;
+    }
+
+    // Duration is the granule position of the last page of our stream
+    uint64_t tailSize = min<uint64_t>(fileSize, 65536 + 27 + 255);
+    string tail(tailSize, '\0');
+    file.clear();
+    file.seekg(fileSize - tailSize);
+    if (!file.read(&tail[0], tailSize))
+    {
+        return false;
+    }
+
+    for (size_t pos = tail.size() >= 27 ? tail.size() - 27 : 0; pos != string::npos; pos = pos ? pos - 1 : string::npos)
+    {
+        if (tail.compare(pos, 4, "OggS") != 0)
+        {
+            continue;
+        }
+        const auto* page = reinterpret_cast<const unsigned char*>(tail.data() + pos);
+        uint64_t granule = readLE64(page + 6);
+        if (readLE32(page + 14) == serial && granule != ~0ULL)
+        {
+            probe.duration = static_cast<float>(double(granule > preSkip ? granule - preSkip : 0) / granuleRate);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool probeFlac(ifstream& file, AudioProbe& probe)
+{
+    unsigned char header[10];
+    if (!file.read(reinterpret_cast<char*>(header), 4))
+    {
+        return false;
+    }
+
+    // Skip an ID3v2 tag some taggers put in front of the stream
+    if (memcmp(header, "ID3", 3) == 0)
+    {
+        if (!file.read(reinterpret_cast<char*>(header + 4), 6))
+        {
+            return false;
+        }
+        uint32_t tagSize = (header[6] << 21) | (header[7] << 14) | (header[8] << 7) | header[9];
+        file.seekg(10 + tagSize);
+        if (!file.read(reinterpret_cast<char*>(header), 4))
+        {
+            return false;
+        }
+    }
+    if (memcmp(header, "fLaC", 4) != 0)
+    {
+        return false;
+    }
+
+    bool sawStreamInfo = false;
+    bool lastBlock = false;
+    while (!lastBlock)
+    {
+        unsigned char blockHeader[4];
+        if (!file.read(reinterpret_cast<char*>(blockHeader), sizeof(blockHeader)))
+        {
+            break;
+        }
+        lastBlock = (blockHeader[0] & 0x80) != 0;
+        int type = blockHeader[0] & 0x7F;
+        uint32_t length = (blockHeader[1] << 16) | (blockHeader[2] << 8) | blockHeader[3];
+
+        if (type == 0 && length >= 18) // STREAMINFO
+        {
+            unsigned char info[34] = {};
+            if (!file.read(reinterpret_cast<char*>(info), min<uint32_t>(length, sizeof(info))))
+            {
+                return false;
+            }
+            file.seekg(length - min<uint32_t>(length, sizeof(info)), ios::cur);
+
+            probe.sampleRate = (info[10] << 12) | (info[11] << 4) | (info[12] >> 4);
+            probe.channels = ((info[12] >> 1) & 0x07) + 1;
+            uint64_t totalSamples = (uint64_t(info[13] & 0x0F) << 32) | readBE32(info + 14);
+            if (probe.sampleRate > 0)
+            {
+                probe.duration = static_cast<float>(double(totalSamples) / probe.sampleRate);
+            }
+            sawStreamInfo = true;
+        }
+        else if (type == 4) // VORBIS_COMMENT
+        {
+            string block(length, '\0');
+            if (!file.read(&block[0], length))
+            {
+                break;
+            }
+            parseVorbisComments(block.data(), block.size(), probe);
+        }
+        else
+        {
+            file.seekg(length, ios::cur);
+        }
+    }
+    return sawStreamInfo;
+}
+
+bool probeWav(ifstream& file, AudioProbe& probe)
+{
+    unsigned char riff[12];
+    if (!file.read(reinterpret_cast<char*>(riff), sizeof(riff)) || memcmp(riff + 8, "WAVE", 4) != 0)
+    {
+        return false;
+    }
+
+    uint32_t byteRate = 0;
+    uint64_t dataSize = 0;
+    bool sawFormat = false;
+
+    unsigned char chunk[8];
+    while (file.read(reinterpret_cast<char*>(chunk), sizeof(chunk)))
+    {
+        uint32_t size = readLE32(chunk + 4);
+        streamoff next = static_cast<streamoff>(file.tellg()) + size + (size & 1);
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16)
+        {
+            unsigned char format[16];
+            if (!file.read(reinterpret_cast<char*>(format), sizeof(format)))
+            {
+                break;  // Truncated inside the format chunk
+            }
+            probe.channels = readLE16(format + 2);
+            probe.sampleRate = readLE32(format + 4);
+            byteRate = readLE32(format + 8);
+            sawFormat = true;
+        }
+        else if (memcmp(chunk, "data", 4) == 0)
+        {
+            dataSize = size;
+        }
+        else if (memcmp(chunk, "LIST", 4) == 0 && size >= 4 && size <= WAV_INFO_MAX_SIZE)
+        {
+            string list(size, '\0');
+            if (!file.read(&list[0], size))
+            {
+                break;  // Chunk runs past the end of the file
+            }
+            if (list.compare(0, 4, "INFO") == 0)
+            {
+                parseWavInfo(list.data() + 4, list.size() - 4, probe);
+            }
+        }
+        file.seekg(next);
+    }
+
+    if (!sawFormat || byteRate == 0)
+    {
+        return false;
+    }
+    probe.duration = static_cast<float>(double(dataSize) / byteRate);
+    return true;
+}
+
+void parseVorbisComments(const char* data, size_t size, AudioProbe& probe)
+{
+    PayloadReader reader;
+    reader.data = string_view(data, size);
+
+    string_view vendor;
+    uint32_t count;
+    if (!reader.readString(vendor) || !reader.readU32(count))
+    {
+        return;
+    }
+
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        string_view comment;
+        if (!reader.readString(comment))
+        {
+            return;
+        }
+        size_t equals = comment.find('=');
+        if (equals != string_view::npos)
+        {
+            applyTag(toLower(string(comment.substr(0, equals))), string(comment.substr(equals + 1)), probe);
+        }
+    }
+}
+
+void parseWavInfo(const char* data, size_t size, AudioProbe& probe)
+{
+    const auto* bytes = reinterpret_cast<const unsigned char*>(data);
+    size_t pos = 0;
+    while (pos + 8 <= size)
+    {
+        string id(data + pos, 4);
+        uint32_t length = readLE32(bytes + pos + 4);
+        pos += 8;
+        if (length > size - pos)
+        {
+            break;
+        }
+
+        string value(data + pos, length);
+        value.erase(value.find_last_not_of('\0') + 1);
+
+        if (id == "INAM") applyTag("title", value, probe);
+        else if (id == "IART") applyTag("artist", value, probe);
+        else if (id == "IPRD") applyTag("album", value, probe);
+        else if (id == "ICRD") applyTag("date", value, probe);
+
+        pos += length + (length & 1);
+    }
+}
+
+void applyTag(const string& key, const string& value, AudioProbe& probe)
+{
+    if (value.empty())
+    {
+        return;
+    }
+
+    if (key == "title" && probe.title.empty())
+    {
+        probe.title = value;
+    }
+    else if (key == "artist")
+    {
+        // Several ARTIST comments are joined the way the playlist writes collaborations
+        probe.artist = probe.artist.empty() ? value : probe.artist + " / " + value;
+    }
+    else if (key == "album" && probe.album.empty())
+    {
+        probe.album = value;
+    }
+    else if ((key == "date" || key == "year") && probe.year == 0 && value.size() >= 4 &&
+             all_of(value.begin(), value.begin() + 4, [](unsigned char c) { return isdigit(c); }))
+    {
+        probe.year = stoi(value.substr(0, 4));
+    }
+}
+
+
+// Probe cache
+bool probeAudioFileCached(ProbeCache& cache, const string& filepath, AudioProbe& probe)
+{
+    error_code ec;
+    uint64_t size = fs::file_size(filepath, ec);
+    if (ec)
+    {
+        return false;
+    }
+    int64_t mtime = fs::last_write_time(filepath, ec).time_since_epoch().count();
+    if (ec)
+    {
+        return false;
+    }
+    return probeAudioFileCached(cache, filepath, size, mtime, probe);
+}
+
+bool probeAudioFileCached(ProbeCache& cache, const string& filepath, uint64_t size, int64_t mtime, AudioProbe& probe)
+{
+    string key = fs::path(filepath).lexically_normal().string();
+    {
+        lock_guard<mutex> guard(cache.lock);
+        auto it = cache.entries.find(key);
+        if (it != cache.entries.end() && it->second.size == size && it->second.mtime == mtime)
+        {
+            probe = it->second.probe;
+            cache.hits++;
+            return true;
+        }
+    }
+
+    // Probe outside the lock so import workers do not serialize on it
+    cache.misses++;
+    if (!probeAudioFile(filepath, probe))
+    {
+        return false;
+    }
+
+    lock_guard<mutex> guard(cache.lock);
+    cache.entries[key] = ProbeCacheEntry{size, mtime, probe};
+    cache.dirty = true;
+    return true;
+}
+
+void loadProbeCache(ProbeCache& cache)
+{
+    MappedFile file;
+    if (!file.open(PROBE_CACHE_FILE)) return;
+
+    // Path, fixed fields, then three tag strings
+    const size_t fixedSize = 2 * sizeof(uint64_t) + sizeof(float) + 2 * sizeof(uint32_t) + sizeof(int32_t);
+    PayloadReader reader;
+    uint32_t count;
+    if (!readCacheHeader(file, PROBE_CACHE_MAGIC, PROBE_CACHE_VERSION, fixedSize + 4 * sizeof(uint32_t), reader, count))
+    {
+        return;
+    }
+
+    lock_guard<mutex> guard(cache.lock);
+    cache.entries.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        string_view path, title, artist, album;
+        ProbeCacheEntry entry;
+
+        if (!reader.readString(path) || reader.data.size() - reader.pos < fixedSize)
+        {
+            break;
+        }
+
+        const char* fixed = reader.data.data() + reader.pos;
+        uint32_t sampleRate, channels;
+        int32_t year;
+        memcpy(&entry.size, fixed, 8);
+        memcpy(&entry.mtime, fixed + 8, 8);
+        memcpy(&entry.probe.duration, fixed + 16, 4);
+        memcpy(&sampleRate, fixed + 20, 4);
+        memcpy(&channels, fixed + 24, 4);
+        memcpy(&year, fixed + 28, 4);
+        reader.pos += fixedSize;
+
+        if (!reader.readString(title) || !reader.readString(artist) || !reader.readString(album))
+        {
+            break;
+        }
+
+        entry.probe.sampleRate = sampleRate;
+        entry.probe.channels = channels;
+        entry.probe.year = year;
+        entry.probe.title = title;
+        entry.probe.artist = artist;
+        entry.probe.album = album;
+        cache.entries.emplace(string(path), move(entry));
+    }
+}
+
+void saveProbeCache(ProbeCache& cache)
+{
+    string data(PROBE_CACHE_MAGIC, sizeof(PROBE_CACHE_MAGIC));
+    {
+        lock_guard<mutex> guard(cache.lock);
+        if (!cache.dirty)
+        {
+            return;
+        }
+
+        putU32(data, PROBE_CACHE_VERSION);
+        putU32(data, static_cast<uint32_t>(cache.entries.size()));
+        for (const auto& [path, entry] : cache.entries)
+        {
+            uint32_t sampleRate = entry.probe.sampleRate;
+            uint32_t channels = entry.probe.channels;
+            int32_t year = entry.probe.year;
+
+            putString(data, path);
+            data.append(reinterpret_cast<const char*>(&entry.size), 8);
+            data.append(reinterpret_cast<const char*>(&entry.mtime), 8);
+            data.append(reinterpret_cast<const char*>(&entry.probe.duration), 4);
+            data.append(reinterpret_cast<const char*>(&sampleRate), 4);
+            data.append(reinterpret_cast<const char*>(&channels), 4);
+            data.append(reinterpret_cast<const char*>(&year), 4);
+            putString(data, entry.probe.title);
+            putString(data, entry.probe.artist);
+            putString(data, entry.probe.album);
+        }
+        cache.dirty = false;
+    }
+    writeFileAtomically(PROBE_CACHE_FILE, data);
+}
+
+// Loudness analysis
+void LoudnessMeter::start(unsigned rate, unsigned channelCount)
+{
+    sampleRate = rate;
+    channels = channelCount;
+
+    // BS.1770 K-weighting, re-derived for the file's sample rate: a high
+    // shelf for the head, then a high-pass that drops the low rumble
+    const double pi = 3.14159265358979323846;
+    double k = tan(pi * 1681.974450955533 / rate);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    shelf[0] = (vh + vb * k / q + k * k) / a0;
+    shelf[1] = 2.0 * (k * k - vh) / a0;
+    shelf[2] = (vh - vb * k / q + k * k) / a0;
+    shelf[3] = 2.0 * (k * k - 1.0) / a0;
+    shelf[4] = (1.0 - k / q + k * k) / a0;
+
+    k = tan(pi * 38.13547087602444 / rate);
+    q = 0.5003270373238773;
+    a0 = 1.0 + k / q + k * k;
+    highPass[0] = 1.0;
+    highPass[1] = -2.0;
+    highPass[2] = 1.0;
+    highPass[3] = 2.0 * (k * k - 1.0) / a0;
+    highPass[4] = (1.0 - k / q + k * k) / a0;
+
+    state.assign(channels * 4, 0.0);
+    subBlockFrames = max(1u, rate / 10);
+    subBlockFill = 0;
+    subBlockEnergy = 0.0;
+    subBlocks.clear();
+    peak = 0.0f;
+    frames = 0;
+    firstAudible = UINT64_MAX;
+    lastAudible = 0;
+}
+
+void LoudnessMeter::add(const sf::Int16* samples, size_t count)
+{
+    const float audible = SILENCE_THRESHOLD * 32768.0f;
+    for (size_t i = 0; i + channels <= count; i += channels)
+    {
+        bool heard = false;
+        for (unsigned c = 0; c < channels; ++c)
+        {
+            float level = fabs(static_cast<float>(samples[i + c]));
+            peak = max(peak, level / 32768.0f);
+            heard = heard || level > audible;
+
+            // Two transposed direct form II biquads in series
+            double* taps = &state[c * 4];
+            double x = samples[i + c] / 32768.0;
+            double y = shelf[0] * x + taps[0];
+            taps[0] = shelf[1] * x - shelf[3] * y + taps[1];
+            taps[1] = shelf[2] * x - shelf[4] * y;
+            double z = highPass[0] * y + taps[2];
+            taps[2] = highPass[1] * y - highPass[3] * z + taps[3];
+            taps[3] = highPass[2] * y - highPass[4] * z;
+
+            // Front channels all weigh 1.0; surround weights are not applied
+            subBlockEnergy += z * z;
+        }
+
+        if (heard)
+        {
+            firstAudible = min(firstAudible, frames);
+            lastAudible = frames;
+        }
+        ++frames;
+        if (++subBlockFill == subBlockFrames)
+        {
+            subBlocks.push_back(subBlockEnergy / subBlockFrames);
+            subBlockFill = 0;
+            subBlockEnergy = 0.0;
+        }
+    }
+}
+
+LoudnessInfo LoudnessMeter::finish() const
+{
+    // 400 ms gating blocks overlapping by 75%, i.e. four sub-blocks each
+    vector<double> blocks;
+    for (size_t i = 0; i + 4 <= subBlocks.size(); ++i)
+    {
+        blocks.push_back((subBlocks[i] + subBlocks[i + 1] + subBlocks[i + 2] + subBlocks[i + 3]) / 4.0);
+    }
+    auto loudness = [](double energy) { return -0.691 + 10.0 * log10(energy); };
+
+    // Absolute gate at -70 LUFS, then a relative gate 10 LU below what passed it
+    auto gatedMean = [&](double threshold, size_t& passed)
+    {
+        double sum = 0.0;
+        passed = 0;
+        for (double energy : blocks)
+        {
+            if (energy > 0.0 && loudness(energy) > threshold)
+            {
+                sum += energy;
+                ++passed;
+            }
+        }
+        return passed > 0 ? sum / passed : 0.0;
+    };
+
+    LoudnessInfo info;
+    info.peak = peak;
+    size_t passed;
+    double absolute = gatedMean(-70.0, passed);
+    double integrated = passed > 0 ? gatedMean(loudness(absolute) - 10.0, passed) : 0.0;
+    if (passed > 0)
+    {
+        info.integratedLufs = static_cast<float>(loudness(integrated));
+        info.gainDb = min(LOUDNESS_TARGET_LUFS - info.integratedLufs, LOUDNESS_MAX_BOOST_DB);
+        if (peak > 0.0f)
+        {
+            info.gainDb = min(info.gainDb, -20.0f * log10(peak));
+        }
+    }
+    else
+    {
+        info.integratedLufs = -70.0f;
+    }
+
+    if (firstAudible != UINT64_MAX)
+    {
+        info.leadingSilence = static_cast<float>(firstAudible) / sampleRate;
+        info.trailingSilence = static_cast<float>(frames - 1 - lastAudible) / sampleRate;
+    }
+    return info;
+}
+
+bool analyzeLoudness(const string& filepath, LoudnessInfo& info)
+{
+    sf::InputSoundFile file;
+    if (!file.openFromFile(filepath) || file.getChannelCount() == 0 || file.getSampleRate() == 0)
+    {
+        return false;
+    }
+
+    LoudnessMeter meter;
+    meter.start(file.getSampleRate(), file.getChannelCount());
+    vector<sf::Int16> samples(8192 * file.getChannelCount());
+    while (sf::Uint64 count = file.read(samples.data(), samples.size()))
+    {
+        meter.add(samples.data(), static_cast<size_t>(count));
+    }
+    info = meter.finish();
+    return true;
+}
+
+void analyzeLibrary(const SongStore& playlist, LoudnessCache& cache)
+{
+    clearScreen();
+    cout << MAGENTA << BOLD << "╔════════════════════════════════════════╗\n";
+    cout << "║        🎵 Analyze Loudness 🎵          ║\n";
+    cout << "╚════════════════════════════════════════╝" << RESET << "\n\n";
+
+    if (playlist.size() == 0)
+    {
+        displayError("Playlist is empty! Add some songs first.");
+        return;
+    }
+
+    // Files analyzed before and unchanged since are skipped
+    struct Job
+    {
+        string path;
+        string key;
+        uint64_t size;
+        int64_t mtime;
+    };
+    vector<Job> jobs;
+    size_t cached = 0;
+    size_t failed = 0;
+    {
+        lock_guard<mutex> guard(cache.lock);
+        for (size_t i = 0; i < playlist.size(); ++i)
+        {
+            Job job;
+            job.path = playlist.filepath(i);
+            job.key = fs::path(job.path).lexically_normal().string();
+            error_code ec;
+            job.size = fs::file_size(job.path, ec);
+            if (!ec)
+            {
+                job.mtime = fs::last_write_time(job.path, ec).time_since_epoch().count();
+            }
+            if (ec)
+            {
+                failed++;
+                continue;
+            }
+
+            auto it = cache.entries.find(job.key);
+            if (it != cache.entries.end() && it->second.size == job.size && it->second.mtime == job.mtime)
+            {
+                cached++;
+            }
+            else
+            {
+                jobs.push_back(move(job));
+            }
+        }
+    }
+
+    displayInfo("Analyzing " + to_string(jobs.size()) + " file(s) ...");
+    auto start = chrono::steady_clock::now();
+    atomic<size_t> next(0);
+    atomic<size_t> done(0);
+    atomic<size_t> errors(0);
+
+    // Whole files are decoded, so each worker takes one file at a time
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < jobs.size(); i = next++)
+        {
+            LoudnessInfo info;
+            if (analyzeLoudness(jobs[i].path, info))
+            {
+                lock_guard<mutex> guard(cache.lock);
+                cache.entries[jobs[i].key] = LoudnessCacheEntry{jobs[i].size, jobs[i].mtime, info};
+                cache.dirty = true;
+            }
+            else
+            {
+                errors++;
+            }
+            done++;
+        }
+    };
+
+    size_t workerCount = min<size_t>(max(1u, thread::hardware_concurrency()), max<size_t>(1, jobs.size()));
+    vector<thread> threads;
+    for (size_t i = 0; i < workerCount; ++i)
+    {
+        threads.emplace_back(worker);
+    }
+    while (done.load() < jobs.size())
+    {
+        cout << "\r" << CYAN << "Progress: " << WHITE << done.load() << " / " << jobs.size() << RESET << flush;
+        this_thread::sleep_for(chrono::milliseconds(200));
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+    saveLoudnessCache(cache);
+
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    failed += errors;
+    cout << "\r" << CYAN << "Analyzed:         " << WHITE << jobs.size() - errors << "\n";
+    cout << CYAN << "Already analyzed: " << WHITE << cached << "\n";
+    cout << CYAN << "Unreadable:       " << WHITE << failed << "\n";
+    cout << CYAN << "Analysis time:    " << WHITE << fixed << setprecision(2) << seconds << " s"
+         << defaultfloat << RESET << "\n\n";
+    displaySuccess("✅ Loudness analysis complete. Songs now play at " +
+                   to_string(static_cast<int>(LOUDNESS_TARGET_LUFS)) + " LUFS.");
+}
+
+bool lookupLoudness(LoudnessCache& cache, const string& filepath, LoudnessInfo& info)
+{
+    error_code ec;
+    uint64_t size = fs::file_size(filepath, ec);
+    if (ec)
+    {
+        return false;
+    }
+    int64_t mtime = fs::last_write_time(filepath, ec).time_since_epoch().count();
+    if (ec)
+    {
+        return false;
+    }
+
+    lock_guard<mutex> guard(cache.lock);
+    auto it = cache.entries.find(fs::path(filepath).lexically_normal().string());
+    if (it == cache.entries.end() || it->second.size != size || it->second.mtime != mtime)
+    {
+        return false;
+    }
+    info = it->second.info;
+    return true;
+}
+
+void loadLoudnessCache(LoudnessCache& cache)
+{
+    MappedFile file;
+    if (!file.open(LOUDNESS_CACHE_FILE)) return;
+
+    const size_t fixedSize = 2 * sizeof(uint64_t) + 5 * sizeof(float);
+    PayloadReader reader;
+    uint32_t count;
+    if (!readCacheHeader(file, LOUDNESS_CACHE_MAGIC, LOUDNESS_CACHE_VERSION, sizeof(uint32_t) + fixedSize, reader, count))
+    {
+        return;
+    }
+
+    lock_guard<mutex> guard(cache.lock);
+    cache.entries.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        string_view path;
+        LoudnessCacheEntry entry;
+
+        if (!reader.readString(path) || reader.data.size() - reader.pos < fixedSize)
+        {
+            break;
+        }
+
+        const char* fixed = reader.data.data() + reader.pos;
+        memcpy(&entry.size, fixed, 8);
+        memcpy(&entry.mtime, fixed + 8, 8);
+        memcpy(&entry.info.integratedLufs, fixed + 16, 4);
+        memcpy(&entry.info.peak, fixed + 20, 4);
+        memcpy(&entry.info.gainDb, fixed + 24, 4);
+        memcpy(&entry.info.leadingSilence, fixed + 28, 4);
+        memcpy(&entry.info.trailingSilence, fixed + 32, 4);
+        reader.pos += fixedSize;
+        cache.entries.emplace(string(path), entry);
+    }
+}
+
+void saveLoudnessCache(LoudnessCache& cache)
+{
+    string data(LOUDNESS_CACHE_MAGIC, sizeof(LOUDNESS_CACHE_MAGIC));
+    {
+        lock_guard<mutex> guard(cache.lock);
+        if (!cache.dirty)
+        {
+            return;
+        }
+
+        putU32(data, LOUDNESS_CACHE_VERSION);
+        putU32(data, static_cast<uint32_t>(cache.entries.size()));
+        for (const auto& [path, entry] : cache.entries)
+        {
+            putString(data, path);
+            data.append(reinterpret_cast<const char*>(&entry.size), 8);
+            data.append(reinterpret_cast<const char*>(&entry.mtime), 8);
+            data.append(reinterpret_cast<const char*>(&entry.info.integratedLufs), 4);
+            data.append(reinterpret_cast<const char*>(&entry.info.peak), 4);
+            data.append(reinterpret_cast<const char*>(&entry.info.gainDb), 4);
+            data.append(reinterpret_cast<const char*>(&entry.info.leadingSilence), 4);
+            data.append(reinterpret_cast<const char*>(&entry.info.trailingSilence), 4);
+        }
+        cache.dirty = false;
+    }
+    writeFileAtomically(LOUDNESS_CACHE_FILE, data);
+}
+
+// Seek index
+uint64_t SeekTable::offsetFor(uint64_t frame) const
+{
+    // Last entry at or before the frame; its page or frame decodes into it
+    auto it = upper_bound(frames.begin(), frames.end(), frame);
+    return it == frames.begin() ? 0 : offsets[it - frames.begin() - 1];
+}
+
+bool buildSeekTable(const MappedFile& file, SeekTable& table)
+{
+    const auto* data = reinterpret_cast<const unsigned char*>(file.data);
+    if (file.size >= 4 && memcmp(data, "OggS", 4) == 0)
+    {
+        return buildOggSeekTable(data, file.size, table);
+    }
+    if (file.size >= 4 && memcmp(data, "fLaC", 4) == 0)
+    {
+        return buildFlacSeekTable(data, file.size, table);
+    }
+    return false;   // WAV seeks are plain arithmetic already
+}
+
+bool buildOggSeekTable(const unsigned char* data, size_t size, SeekTable& table)
+{
+    // Page headers chain by their own lengths, so only headers are read
+    uint32_t serial = 0;
+    uint64_t previousGranule = 0;
+    uint64_t nextMark = 0;
+
+    for (size_t offset = 0; offset + 27 <= size && memcmp(data + offset, "OggS", 4) == 0;)
+    {
+        const unsigned char* header = data + offset;
+        int segments = header[26];
+        if (offset + 27 + segments > size)
+        {
+            break;
+        }
+        size_t bodySize = 0;
+        for (int i = 0; i < segments; ++i)
+        {
+            bodySize += header[27 + i];
+        }
+
+        if (offset == 0)
+        {
+            // The identification packet fills the first page on its own
+            const unsigned char* ident = header + 27 + segments;
+            if (bodySize < 30 || memcmp(ident, "\x01vorbis", 7) != 0)
+            {
+                return true;    // Not Vorbis; keep an empty table so it is not rescanned
+            }
+            serial = readLE32(header + 14);
+            table.sampleRate = readLE32(ident + 12);
+        }
+
+        // A page holds samples up to its granule position and continues the
+        // previous page's, so the entry points at where decoding resumes
+        uint64_t granule = readLE64(header + 6);
+        if (readLE32(header + 14) == serial && granule != UINT64_MAX && granule > 0)
+        {
+            if (previousGranule >= nextMark && table.sampleRate > 0)
+            {
+                table.frames.push_back(previousGranule);
+                table.offsets.push_back(offset);
+                nextMark = previousGranule + uint64_t(table.sampleRate) * SEEK_TABLE_SPACING;
+            }
+            previousGranule = granule;
+        }
+        offset += 27 + segments + bodySize;
+    }
+    return true;
+}
+
+bool buildFlacSeekTable(const unsigned char* data, size_t size, SeekTable& table)
+{
+    // Metadata blocks first; STREAMINFO gives the rate and block size
+    size_t offset = 4;
+    uint32_t blockSize = 0;
+    uint32_t minFrameSize = 0;
+    unsigned channels = 0;
+    unsigned bitsPerSample = 0;
+    bool last = false;
+    while (!last && offset + 4 <= size)
+    {
+        last = (data[offset] & 0x80) != 0;
+        int type = data[offset] & 0x7F;
+        size_t length = (size_t(data[offset + 1]) << 16) | (data[offset + 2] << 8) | data[offset + 3];
+        if (type == 0 && length >= 34 && offset + 4 + 34 <= size)
+        {
+            const unsigned char* info = data + offset + 4;
+            blockSize = (info[0] << 8) | info[1];
+            minFrameSize = (uint32_t(info[4]) << 16) | (info[5] << 8) | info[6];
+            table.sampleRate = (uint32_t(info[10]) << 12) | (info[11] << 4) | (info[12] >> 4);
+            channels = ((info[12] >> 1) & 0x07) + 1;
+            bitsPerSample = (((info[12] & 0x01) << 4) | (info[13] >> 4)) + 1;
+        }
+        offset += 4 + length;
+    }
+    if (table.sampleRate == 0 || blockSize == 0)
+    {
+        return true;
+    }
+
+    // Frame headers: 14-bit sync, blocking strategy, coded frame or sample
+    // number, then a CRC-8. Sync codes also turn up inside audio data, so a
+    // header must also agree with STREAMINFO and follow the previous frame.
+    static const unsigned sizeCodes[8] = {0, 8, 12, 0, 16, 20, 24, 32};
+    auto crc8 = [](const unsigned char* bytes, size_t count)
+    {
+        uint8_t crc = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            crc ^= bytes[i];
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = static_cast<uint8_t>((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
+            }
+        }
+        return crc;
+    };
+
+    uint64_t nextMark = 0;
+    uint64_t expected = 0;      // Frames come in order, so a header must carry a number just ahead
+    while (offset + 16 <= size)
+    {
+        const auto* found = static_cast<const unsigned char*>(memchr(data + offset, 0xFF, size - 16 - offset));
+        if (!found)
+        {
+            break;
+        }
+        offset = found - data;
+        const unsigned char* header = found;
+        int assignment = header[3] >> 4;
+        int sampleSize = (header[3] >> 1) & 0x07;
+        if ((header[1] & 0xFE) != 0xF8 || (header[2] >> 4) == 0 || (header[2] & 0x0F) == 0x0F ||
+            assignment >= 11 || (assignment < 8 ? assignment + 1u : 2u) != channels ||
+            (sampleSize != 0 && sizeCodes[sampleSize] != bitsPerSample) || (header[3] & 0x01) != 0)
+        {
+            ++offset;
+            continue;
+        }
+
+        // UTF-8 style number: the leading ones of the first byte count the bytes
+        size_t at = 4;
+        uint64_t number = header[at];
+        int extra = 0;
+        if (number >= 0x80)
+        {
+            while (extra < 7 && (number & (0x40 >> extra)))
+            {
+                ++extra;
+            }
+            if (extra == 0 || extra > 6)
+            {
+                ++offset;
+                continue;
+            }
+            number &= 0x3F >> extra;
+        }
+        bool valid = true;
+        for (int i = 0; i < extra; ++i)
+        {
+            unsigned char byte = header[++at];
+            valid = valid && (byte & 0xC0) == 0x80;
+            number = (number << 6) | (byte & 0x3F);
+        }
+        ++at;
+
+        int sizeCode = header[2] >> 4;
+        int rateCode = header[2] & 0x0F;
+        uint32_t frameSize = sizeCode == 1 ? 192 : sizeCode <= 5 ? 576u << (sizeCode - 2) : 256u << (sizeCode - 8);
+        if (sizeCode == 6 || sizeCode == 7)
+        {
+            frameSize = (sizeCode == 6 ? header[at] : (header[at] << 8) | header[at + 1]) + 1;
+            at += sizeCode - 5;
+        }
+        at += rateCode == 12 ? 1 : (rateCode == 13 || rateCode == 14) ? 2 : 0;
+        if (!valid || crc8(header, at) != header[at] || (!(header[1] & 0x01) && frameSize > blockSize))
+        {
+            ++offset;
+            continue;
+        }
+
+        // Fixed-size blocks number frames; variable-size blocks number samples
+        uint64_t frame = (header[1] & 0x01) ? number : number * blockSize;
+        if (frame < expected || frame > expected + uint64_t(16) * blockSize)
+        {
+            ++offset;
+            continue;
+        }
+        expected = frame + 1;
+        if (frame >= nextMark)
+        {
+            table.frames.push_back(frame);
+            table.offsets.push_back(offset);
+            nextMark = frame + uint64_t(table.sampleRate) * SEEK_TABLE_SPACING;
+        }
+        offset += max<size_t>(at + 1, minFrameSize);
+    }
+    return true;
+}
+
+shared_ptr<const SeekTable> lookupSeekTable(SeekIndex& index, const string& filepath, bool build)
+{
+    error_code ec;
+    uint64_t size = fs::file_size(filepath, ec);
+    if (ec)
+    {
+        return nullptr;
+    }
+    int64_t mtime = fs::last_write_time(filepath, ec).time_since_epoch().count();
+    if (ec)
+    {
+        return nullptr;
+    }
+
+    string key = fs::path(filepath).lexically_normal().string();
+    {
+        lock_guard<mutex> guard(index.lock);
+        auto it = index.entries.find(key);
+        if (it != index.entries.end() && it->second.size == size && it->second.mtime == mtime)
+        {
+            return it->second.table->frames.empty() ? nullptr : it->second.table;
+        }
+    }
+    if (!build)
+    {
+        return nullptr;
+    }
+
+    // Build outside the lock; it reads the whole file once
+    MappedFile file;
+    auto table = make_shared<SeekTable>();
+    if (!file.open(filepath) || !buildSeekTable(file, *table))
+    {
+        return nullptr;
+    }
+
+    lock_guard<mutex> guard(index.lock);
+    index.entries[key] = SeekIndexEntry{size, mtime, table};
+    index.dirty = true;
+    return table->frames.empty() ? nullptr : table;
+}
+
+void loadSeekIndex(SeekIndex& index)
+{
+    MappedFile file;
+    if (!file.open(SEEK_INDEX_FILE)) return;
+
+    const size_t fixedSize = 2 * sizeof(uint64_t) + 2 * sizeof(uint32_t);
+    PayloadReader reader;
+    uint32_t count;
+    if (!readCacheHeader(file, SEEK_INDEX_MAGIC, SEEK_INDEX_VERSION, sizeof(uint32_t) + fixedSize, reader, count))
+    {
+        return;
+    }
+
+    lock_guard<mutex> guard(index.lock);
+    index.entries.reserve(count);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        string_view path;
+        SeekIndexEntry entry;
+        uint32_t sampleRate, points;
+
+        if (!reader.readString(path) || reader.data.size() - reader.pos < fixedSize)
+        {
+            break;
+        }
+
+        const char* fixed = reader.data.data() + reader.pos;
+        memcpy(&entry.size, fixed, 8);
+        memcpy(&entry.mtime, fixed + 8, 8);
+        memcpy(&sampleRate, fixed + 16, 4);
+        memcpy(&points, fixed + 20, 4);
+        reader.pos += fixedSize;
+        if ((reader.data.size() - reader.pos) / 16 < points)
+        {
+            break;
+        }
+
+        auto table = make_shared<SeekTable>();
+        table->sampleRate = sampleRate;
+        table->frames.resize(points);
+        table->offsets.resize(points);
+        memcpy(table->frames.data(), reader.data.data() + reader.pos, points * 8);
+        memcpy(table->offsets.data(), reader.data.data() + reader.pos + points * 8, points * 8);
+        reader.pos += points * 16;
+
+        entry.table = move(table);
+        index.entries.emplace(string(path), move(entry));
+    }
+}
+
+void saveSeekIndex(SeekIndex& index)
+{
+    string data(SEEK_INDEX_MAGIC, sizeof(SEEK_INDEX_MAGIC));
+    {
+        lock_guard<mutex> guard(index.lock);
+        if (!index.dirty)
+        {
+            return;
+        }
+
+        putU32(data, SEEK_INDEX_VERSION);
+        putU32(data, static_cast<uint32_t>(index.entries.size()));
+        for (const auto& [path, entry] : index.entries)
+        {
+            const SeekTable& table = *entry.table;
+            uint32_t points = static_cast<uint32_t>(table.frames.size());
+
+            putString(data, path);
+            data.append(reinterpret_cast<const char*>(&entry.size), 8);
+            data.append(reinterpret_cast<const char*>(&entry.mtime), 8);
+            data.append(reinterpret_cast<const char*>(&table.sampleRate), 4);
+            data.append(reinterpret_cast<const char*>(&points), 4);
+            data.append(reinterpret_cast<const char*>(table.frames.data()), points * 8);
+            data.append(reinterpret_cast<const char*>(table.offsets.data()), points * 8);
+        }
+        index.dirty = false;
+    }
+    writeFileAtomically(SEEK_INDEX_FILE, data);
+}
+
+// Audio memory
+
+void startAudioMemory(AudioMemory& memory)
+{
+    memory.stopping = false;
+    memory.worker = thread(runAudioMemoryWorker, ref(memory));
+}
+
+void stopAudioMemory(AudioMemory& memory)
+{
+    {
+        lock_guard<mutex> guard(memory.lock);
+        memory.stopping = true;
+        memory.requests.clear();
+    }
+    memory.wake.notify_one();
+    if (memory.worker.joinable())
+    {
+        memory.worker.join();
+    }
+}
+
+void runAudioMemoryWorker(AudioMemory& memory)
+{
+    unique_lock<mutex> guard(memory.lock);
+
+    while (true)
+    {
+        memory.wake.wait(guard, [&] { return memory.stopping || !memory.requests.empty(); });
+        if (memory.stopping)
+        {
+            break;
+        }
+
+        string key = move(memory.requests.front());
+        memory.requests.pop_front();
+
+        // A request for a clip that is still current only refreshes it
+        shared_ptr<const DecodedAudio> cached;
+        auto it = memory.entries.find(key);
+        if (it != memory.entries.end())
+        {
+            cached = it->second.clip;
+            memory.recency.splice(memory.recency.begin(), memory.recency, it->second.recent);
+        }
+
+        size_t fullLimit = memory.budgetBytes / AUDIO_FULL_DECODE_SHARE;
+        guard.unlock();
+
+        auto clip = make_shared<DecodedAudio>();
+        bool decoded = false;
+        error_code sizeEc, timeEc;
+        uint64_t size = fs::file_size(key, sizeEc);
+        int64_t mtime = fs::last_write_time(key, timeEc).time_since_epoch().count();
+        if (!cached || sizeEc || timeEc || cached->size != size || cached->mtime != mtime)
+        {
+            decoded = decodeAudio(key, fullLimit, *clip);
+        }
+        size_t bytes = clip->samples.size() * sizeof(sf::Int16);
+
+        guard.lock();
+        if (!decoded || bytes > memory.budgetBytes)
+        {
+            continue;
+        }
+
+        // Replace a stale clip for the same file
+        it = memory.entries.find(key);
+        if (it != memory.entries.end())
+        {
+            memory.usedBytes -= it->second.clip->samples.size() * sizeof(sf::Int16);
+            memory.recency.erase(it->second.recent);
+            memory.entries.erase(it);
+        }
+
+        memory.recency.push_front(key);
+        memory.entries.emplace(key, AudioMemoryEntry{move(clip), memory.recency.begin()});
+        memory.usedBytes += bytes;
+
+        // Evict from the cold end; the clip just added is at the front and
+        // fits on its own, so it always survives
+        while (memory.usedBytes > memory.budgetBytes)
+        {
+            auto victim = memory.entries.find(memory.recency.back());
+            memory.usedBytes -= victim->second.clip->samples.size() * sizeof(sf::Int16);
+            memory.entries.erase(victim);
+            memory.recency.pop_back();
+            memory.evictions++;
+        }
+    }
+}
+
+void requestAudio(AudioMemory& memory, const string& filepath)
+{
+    string key = fs::path(filepath).lexically_normal().string();
+    {
+        lock_guard<mutex> guard(memory.lock);
+        if (memory.stopping)
+        {
+            return;
+        }
+
+        // A repeated request just moves to the front
+        auto it = find(memory.requests.begin(), memory.requests.end(), key);
+        if (it != memory.requests.end())
+        {
+            memory.requests.erase(it);
+        }
+        memory.requests.push_front(move(key));
+        if (memory.requests.size() > AUDIO_MEMORY_MAX_REQUESTS)
+        {
+            memory.requests.pop_back();
+        }
+    }
+    memory.wake.notify_one();
+}
+
+shared_ptr<const DecodedAudio> findAudio(AudioMemory& memory, const string& filepath)
+{
+    error_code sizeEc, timeEc;
+    uint64_t size = fs::file_size(filepath, sizeEc);
+    int64_t mtime = fs::last_write_time(filepath, timeEc).time_since_epoch().count();
+
+    string key = fs::path(filepath).lexically_normal().string();
+    lock_guard<mutex> guard(memory.lock);
+    auto it = memory.entries.find(key);
+    if (it == memory.entries.end())
+    {
+        memory.misses++;
+        return nullptr;
+    }
+
+    const AudioMemoryEntry& entry = it->second;
+    if (sizeEc || timeEc || entry.clip->size != size || entry.clip->mtime != mtime)
+    {
+        memory.usedBytes -= entry.clip->samples.size() * sizeof(sf::Int16);
+        memory.recency.erase(entry.recent);
+        memory.entries.erase(it);
+        memory.misses++;
+        return nullptr;
+    }
+
+    memory.recency.splice(memory.recency.begin(), memory.recency, entry.recent);
+    memory.hits++;
+    return entry.clip;
+}
+
+bool decodeAudio(const string& filepath, size_t fullLimit, DecodedAudio& clip)
+{
+    error_code ec;
+    clip.size = fs::file_size(filepath, ec);
+    if (ec)
+    {
+        return false;
+    }
+    clip.mtime = fs::last_write_time(filepath, ec).time_since_epoch().count();
+    if (ec)
+    {
+        return false;
+    }
+
+    sf::InputSoundFile decoder;
+    if (!decoder.openFromFile(filepath) || decoder.getChannelCount() == 0)
+    {
+        return false;
+    }
+
+    // The whole track if it fits its share of the budget, else the opening
+    // the stream starts from
+    clip.sampleRate = decoder.getSampleRate();
+    clip.channels = decoder.getChannelCount();
+    uint64_t total = decoder.getSampleCount();
+    uint64_t opening = static_cast<uint64_t>(PREROLL_SECONDS * clip.sampleRate) * clip.channels;
+    uint64_t wanted = total * sizeof(sf::Int16) <= fullLimit ? total : min(total, opening);
+
+    clip.samples.resize(static_cast<size_t>(wanted));
+    clip.samples.resize(static_cast<size_t>(decoder.read(clip.samples.data(), clip.samples.size())));
+    clip.samples.shrink_to_fit();
+    clip.complete = clip.samples.size() == total;
+    return !clip.samples.empty();
+}
+
+size_t defaultAudioBudget()
+{
+    uint64_t installed = 0;
+#ifdef _WIN32
+    MEMORYSTATUSEX status = {};
+    status.dwLength = sizeof(status);
+    if (GlobalMemoryStatusEx(&status))
+    {
+        installed = status.ullTotalPhys;
+    }
+#else
+    long pages = sysconf(_SC_PHYS_PAGES);
+    long pageSize = sysconf(_SC_PAGESIZE);
+    if (pages > 0 && pageSize > 0)
+    {
+        installed = static_cast<uint64_t>(pages) * static_cast<uint64_t>(pageSize);
+    }
+#endif
+    return static_cast<size_t>(clamp<uint64_t>(installed / AUDIO_MEMORY_RAM_SHARE,
+                                               uint64_t(AUDIO_MEMORY_MIN_MB) << 20, uint64_t(AUDIO_MEMORY_MAX_MB) << 20));
+}
+
+// Equalizer
+void ParametricEq::configure(unsigned int sampleRate, unsigned int channels)
+{
+    rate = sampleRate;
+    channelCount = channels;
+    size_t used = EQ_BANDS * channels;
+    lanes.count = (used + BIQUAD_LANE_WIDTH - 1) / BIQUAD_LANE_WIDTH * BIQUAD_LANE_WIDTH;
+    for (vector<float>* values : {&lanes.b0, &lanes.b1, &lanes.b2, &lanes.a1, &lanes.a2,
+                                  &lanes.z1, &lanes.z2, &lanes.x, &lanes.y})
+    {
+        values->assign(lanes.count, 0.0f);
+    }
+    stale = true;   // The coefficients depend on the sample rate
+}
+
+void ParametricEq::reset()
+{
+    fill(lanes.z1.begin(), lanes.z1.end(), 0.0f);
+    fill(lanes.z2.begin(), lanes.z2.end(), 0.0f);
+    fill(lanes.y.begin(), lanes.y.end(), 0.0f);
+}
+
+bool ParametricEq::prepare()
+{
+    if (!stale && settings.version.load(memory_order_acquire) == designed)
+    {
+        return enabled;
+    }
+
+    // The audio thread never waits for the Equalizer screen; a change it is
+    // still writing is picked up on a later block
+    unique_lock<mutex> guard(settings.lock, try_to_lock);
+    if (!guard.owns_lock())
+    {
+        return enabled;
+    }
+    designed = settings.version.load(memory_order_relaxed);
+    stale = false;
+
+    bool wasEnabled = enabled;
+    enabled = false;
+    if (settings.enabled && settings.active < settings.presets.size() && rate > 0)
+    {
+        const EqPreset& preset = settings.presets[settings.active];
+        for (const EqBand& band : preset.bands)
+        {
+            enabled = enabled || band.gainDb != 0.0f;   // A flat preset is bypassed
+        }
+        if (enabled)
+        {
+            design(preset);
+        }
+    }
+    if (enabled && !wasEnabled)
+    {
+        reset();
+    }
+    return enabled;
+}
+
+void ParametricEq::design(const EqPreset& preset)
+{
+    // Boosts would clip loud passages, so the first band also pulls the
+    // whole cascade down by the largest of them
+    float boost = 0.0f;
+    for (const EqBand& band : preset.bands)
+    {
+        boost = max(boost, band.gainDb);
+    }
+    float headroom = pow(10.0f, -boost / 20.0f);
+
+    for (size_t band = 0; band < EQ_BANDS; ++band)
+    {
+        float coefficients[5];
+        designBiquad(preset.bands[band], rate, coefficients);
+        if (band == 0)
+        {
+            coefficients[0] *= headroom;
+            coefficients[1] *= headroom;
+            coefficients[2] *= headroom;
+        }
+        for (unsigned int channel = 0; channel < channelCount; ++channel)
+        {
+            size_t lane = band * channelCount + channel;
+            lanes.b0[lane] = coefficients[0];
+            lanes.b1[lane] = coefficients[1];
+            lanes.b2[lane] = coefficients[2];
+            lanes.a1[lane] = coefficients[3];
+            lanes.a2[lane] = coefficients[4];
+        }
+    }
+}
+
+void ParametricEq::process(float* samples, size_t frames)
+{
+    // Band k hears band k - 1's output from the previous step, so the last
+    // band's output lags the input by EQ_BANDS - 1 frames (about 0.1 ms at
+    // 48 kHz). The lag is not compensated: the first frames after reset()
+    // are silence, and turning the stage off replays that many frames.
+    const size_t lastBand = (EQ_BANDS - 1) * channelCount;
+    float* x = lanes.x.data();
+    const float* y = lanes.y.data();
+
+    for (size_t n = 0; n < frames; ++n)
+    {
+        float* frame = samples + n * channelCount;
+        copy_n(y, lastBand, x + channelCount);
+        copy_n(frame, channelCount, x);
+        biquadStep(lanes);
+        copy_n(y + lastBand, channelCount, frame);
+    }
+
+    // State decaying through silence would sink into denormals, which are
+    // many times slower to compute with
+    for (size_t i = 0; i < lanes.count; ++i)
+    {
+        if (fabs(lanes.z1[i]) < 1e-12f) lanes.z1[i] = 0.0f;
+        if (fabs(lanes.z2[i]) < 1e-12f) lanes.z2[i] = 0.0f;
+    }
+}
+
+void designBiquad(const EqBand& band, unsigned int sampleRate, float coefficients[5])
+{
+    // Robert Bristow-Johnson's audio EQ cookbook, normalized so a0 = 1
+    const double pi = 3.14159265358979323846;
+    double frequency = min(max(static_cast<double>(band.frequency), 10.0), 0.45 * sampleRate);
+    double a = pow(10.0, band.gainDb / 40.0);
+    double w0 = 2.0 * pi * frequency / sampleRate;
+    double cosine = cos(w0);
+    double alpha = sin(w0) / (2.0 * max(band.q, 0.1f));
+    double shelf = 2.0 * sqrt(a) * alpha;
+
+    double b0, b1, b2, a0, a1, a2;
+    switch (band.type)
+    {
+        case EQ_LOW_SHELF:
+            b0 = a * ((a + 1.0) - (a - 1.0) * cosine + shelf);
+            b1 = 2.0 * a * ((a - 1.0) - (a + 1.0) * cosine);
+            b2 = a * ((a + 1.0) - (a - 1.0) * cosine - shelf);
+            a0 = (a + 1.0) + (a - 1.0) * cosine + shelf;
+            a1 = -2.0 * ((a - 1.0) + (a + 1.0) * cosine);
+            a2 = (a + 1.0) + (a - 1.0) * cosine - shelf;
+            break;
+        case EQ_HIGH_SHELF:
+            b0 = a * ((a + 1.0) + (a - 1.0) * cosine + shelf);
+            b1 = -2.0 * a * ((a - 1.0) + (a + 1.0) * cosine);
+            b2 = a * ((a + 1.0) + (a - 1.0) * cosine - shelf);
+            a0 = (a + 1.0) - (a - 1.0) * cosine + shelf;
+            a1 = 2.0 * ((a - 1.0) - (a + 1.0) * cosine);
+            a2 = (a + 1.0) - (a - 1.0) * cosine - shelf;
+            break;
+        default:
+            b0 = 1.0 + alpha * a;
+            b1 = -2.0 * cosine;
+            b2 = 1.0 - alpha * a;
+            a0 = 1.0 + alpha / a;
+            a1 = -2.0 * cosine;
+            a2 = 1.0 - alpha / a;
+            break;
+    }
+    coefficients[0] = static_cast<float>(b0 / a0);
+    coefficients[1] = static_cast<float>(b1 / a0);
+    coefficients[2] = static_cast<float>(b2 / a0);
+    coefficients[3] = static_cast<float>(a1 / a0);
+    coefficients[4] = static_cast<float>(a2 / a0);
+}
+
+void addBuiltInPresets(Equalizer& eq)
+{
+    // Every preset uses the same six bands; only their gains differ
+    const EqBand layout[EQ_BANDS] =
+    {
+        {EQ_LOW_SHELF, 80.0f, 0.0f, 0.7f},
+        {EQ_PEAK, 250.0f, 0.0f, 1.0f},
+        {EQ_PEAK, 1000.0f, 0.0f, 1.0f},
+        {EQ_PEAK, 3000.0f, 0.0f, 1.0f},
+        {EQ_PEAK, 6000.0f, 0.0f, 1.0f},
+        {EQ_HIGH_SHELF, 12000.0f, 0.0f, 0.7f}
+    };
+    const pair<const char*, array<float, EQ_BANDS>> gains[] =
+    {
+        {"Flat", {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f}},
+        {"Bass Boost", {6.0f, 2.0f, 0.0f, 0.0f, 0.0f, 0.0f}},
+        {"Treble Boost", {0.0f, 0.0f, 0.0f, 1.0f, 3.0f, 6.0f}},
+        {"Vocal", {-2.0f, -1.0f, 2.0f, 4.0f, 2.0f, 0.0f}},
+        {"Loudness", {5.0f, 1.0f, -1.0f, 0.0f, 2.0f, 4.0f}},
+        {"Night", {-4.0f, 0.0f, 1.0f, 1.0f, -2.0f, -4.0f}}
+    };
+
+    for (const auto& [name, bandGains] : gains)
+    {
+        EqPreset preset;
+        preset.name = name;
+        for (size_t band = 0; band < EQ_BANDS; ++band)
+        {
+            preset.bands[band] = layout[band];
+            preset.bands[band].gainDb = bandGains[band];
+        }
+        eq.presets.push_back(move(preset));
+    }
+    eq.builtIn = eq.presets.size();
+}
+
+void changeEqualizer(Equalizer& eq, const function<void()>& change)
+{
+    {
+        lock_guard<mutex> guard(eq.lock);
+        change();
+        eq.dirty = true;
+    }
+    eq.version.fetch_add(1, memory_order_release);
+}
+
+void loadEqualizer(Equalizer& eq)
+{
+    addBuiltInPresets(eq);
+
+    MappedFile file;
+    if (!file.open(EQ_PRESET_FILE)) return;
+
+    PayloadReader reader;
+    reader.data = string_view(file.data, file.size);
+
+    uint32_t version, enabled, count;
+    string_view activeName;
+    if (file.size < sizeof(EQ_PRESET_MAGIC) ||
+        memcmp(file.data, EQ_PRESET_MAGIC, sizeof(EQ_PRESET_MAGIC)) != 0)
+    {
+        return;
+    }
+    reader.pos = sizeof(EQ_PRESET_MAGIC);
+    if (!reader.readU32(version) || version != EQ_PRESET_VERSION || !reader.readU32(enabled) ||
+        !reader.readString(activeName) || !reader.readU32(count))
+    {
+        return;
+    }
+
+    lock_guard<mutex> guard(eq.lock);
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        string_view name;
+        EqPreset preset;
+        const size_t bandSize = 4 + 3 * sizeof(float);
+
+        if (!reader.readString(name) || reader.data.size() - reader.pos < EQ_BANDS * bandSize)
+        {
+            break;
+        }
+        preset.name = string(name);
+        for (EqBand& band : preset.bands)
+        {
+            const char* fixed = reader.data.data() + reader.pos;
+            uint32_t type;
+            memcpy(&type, fixed, 4);
+            memcpy(&band.frequency, fixed + 4, 4);
+            memcpy(&band.gainDb, fixed + 8, 4);
+            memcpy(&band.q, fixed + 12, 4);
+            band.type = type <= EQ_HIGH_SHELF ? static_cast<EqBandType>(type) : EQ_PEAK;
+            reader.pos += bandSize;
+        }
+        eq.presets.push_back(move(preset));
+    }
+
+    // The active preset is stored by name, so built-ins can be added later
+    for (size_t i = 0; i < eq.presets.size(); ++i)
+    {
+        if (eq.presets[i].name == activeName)
+        {
+            eq.active = i;
+        }
+    }
+    eq.enabled = enabled != 0;
+    eq.version.fetch_add(1, memory_order_release);
+}
+
+void saveEqualizer(Equalizer& eq)
+{
+    string data(EQ_PRESET_MAGIC, sizeof(EQ_PRESET_MAGIC));
+    {
+        lock_guard<mutex> guard(eq.lock);
+        if (!eq.dirty)
+        {
+            return;
+        }
+
+        putU32(data, EQ_PRESET_VERSION);
+        putU32(data, eq.enabled ? 1 : 0);
+        putString(data, eq.presets[eq.active].name);
+        putU32(data, static_cast<uint32_t>(eq.presets.size() - eq.builtIn));
+        for (size_t i = eq.builtIn; i < eq.presets.size(); ++i)
+        {
+            putString(data, eq.presets[i].name);
+            for (const EqBand& band : eq.presets[i].bands)
+            {
+                putU32(data, band.type);
+                data.append(reinterpret_cast<const char*>(&band.frequency), 4);
+                data.append(reinterpret_cast<const char*>(&band.gainDb), 4);
+                data.append(reinterpret_cast<const char*>(&band.q), 4);
+            }
+        }
+        eq.dirty = false;
+    }
+    writeFileAtomically(EQ_PRESET_FILE, data);
+}
+
+void equalizerMenu(Equalizer& eq)
+{
+    static const char* const typeNames[] = {"Peak", "Low shelf", "High shelf"};
+
+    while (true)
+    {
+        clearScreen();
+        cout << BOLD << CYAN << "╔══════════════════════════════════════════╗" << RESET << '\n';
+        cout << BOLD << CYAN << "║            🎚️ Equalizer 🎚️               ║" << RESET << '\n';
+        cout << BOLD << CYAN << "╚══════════════════════════════════════════╝" << RESET << '\n' << '\n';
+
+        bool builtIn, enabled;
+        {
+            lock_guard<mutex> guard(eq.lock);
+            const EqPreset& preset = eq.presets[eq.active];
+            builtIn = eq.active < eq.builtIn;
+            enabled = eq.enabled;
+            cout << CYAN << "Status: " << (enabled ? GREEN + "On" : RED + "Off") << CYAN
+                 << "   Preset: " << WHITE << preset.name << (builtIn ? " (built in)" : "") << RESET << "\n\n";
+
+            cout << CYAN << "  Band  Type         Frequency      Gain      Q" << RESET << '\n';
+            for (size_t band = 0; band < EQ_BANDS; ++band)
+            {
+                const EqBand& settings = preset.bands[band];
+                cout << WHITE << "  " << setw(4) << left << band + 1 << "  " << setw(11) << typeNames[settings.type]
+                     << right << fixed << setprecision(0) << setw(8) << settings.frequency << " Hz"
+                     << showpos << setprecision(1) << setw(8) << settings.gainDb << " dB" << noshowpos
+                     << setprecision(2) << setw(7) << settings.q << defaultfloat << left << RESET << '\n';
+            }
+        }
+
+        cout << '\n' << CYAN << "1. Turn " << (enabled ? "off" : "on") << '\n';
+        cout << "2. Choose preset\n";
+        cout << "3. Edit a band\n";
+        cout << "4. Save as a new preset\n";
+        cout << "5. Delete this preset\n" << RESET;
+
+        int choice = get_int("Enter choice (0 to exit): ");
+        switch (choice)
+        {
+            case 0:
+                saveEqualizer(eq);
+                return;
+            case 1:
+                changeEqualizer(eq, [&] { eq.enabled = !eq.enabled; });
+                break;
+            case 2:
+            {
+                size_t count;
+                {
+                    lock_guard<mutex> guard(eq.lock);
+                    count = eq.presets.size();
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        cout << CYAN << i + 1 << ". " << WHITE << eq.presets[i].name << RESET << '\n';
+                    }
+                }
+                int picked = get_int("Preset number: ");
+                if (picked < 1 || static_cast<size_t>(picked) > count)
+                {
+                    displayError("No such preset.");
+                    break;
+                }
+                changeEqualizer(eq, [&] { eq.active = picked - 1; eq.enabled = true; });
+                break;
+            }
+            case 3:
+            {
+                if (builtIn)
+                {
+                    displayError("Built-in presets cannot be changed; save this one as a new preset first.");
+                    break;
+                }
+                int band = get_int("Band number (1-" + to_string(EQ_BANDS) + "): ");
+                if (band < 1 || static_cast<size_t>(band) > EQ_BANDS)
+                {
+                    displayError("No such band.");
+                    break;
+                }
+                EqBand settings;
+                {
+                    lock_guard<mutex> guard(eq.lock);
+                    settings = eq.presets[eq.active].bands[band - 1];
+                }
+                if (readEqBand(settings))
+                {
+                    changeEqualizer(eq, [&] { eq.presets[eq.active].bands[band - 1] = settings; });
+                }
+                break;
+            }
+            case 4:
+            {
+                string name = get_text("🔹 Preset name", "");
+                name = name.substr(0, EQ_PRESET_NAME_LENGTH);
+                if (name.empty())
+                {
+                    displayError("A preset needs a name.");
+                    break;
+                }
+                bool taken = false;
+                {
+                    lock_guard<mutex> guard(eq.lock);
+                    for (const EqPreset& preset : eq.presets)
+                    {
+                        taken = taken || preset.name == name;
+                    }
+                }
+                if (taken)
+                {
+                    displayError("A preset with that name already exists.");
+                    break;
+                }
+                changeEqualizer(eq, [&]
+                {
+                    EqPreset preset = eq.presets[eq.active];
+                    preset.name = name;
+                    eq.presets.push_back(move(preset));
+                    eq.active = eq.presets.size() - 1;
+                });
+                displaySuccess("Preset saved.");
+                break;
+            }
+            case 5:
+                if (builtIn)
+                {
+                    displayError("Built-in presets cannot be deleted.");
+                    break;
+                }
+                changeEqualizer(eq, [&]
+                {
+                    eq.presets.erase(eq.presets.begin() + eq.active);
+                    eq.active = 0;
+                });
+                displaySuccess("Preset deleted.");
+                break;
+            default:
+                displayError("Invalid choice!");
+        }
+    }
+}
+
+bool readEqBand(EqBand& band)
+{
+    // Enter keeps each current value
+    ostringstream frequency, gain, q;
+    frequency << band.frequency;
+    gain << band.gainDb;
+    q << band.q;
+
+    string type = get_text("🔹 Type: 1 peak, 2 low shelf, 3 high shelf", to_string(band.type + 1));
+    float newFrequency = strtof(get_text("🔹 Frequency in Hz (20-20000)", frequency.str()).c_str(), nullptr);
+    float newGain = strtof(get_text("🔹 Gain in dB (-12 to 12)", gain.str()).c_str(), nullptr);
+    float newQ = strtof(get_text("🔹 Q (0.1-10)", q.str()).c_str(), nullptr);
+
+    if (type != "1" && type != "2" && type != "3")
+    {
+        displayError("Type must be 1, 2 or 3.");
+        return false;
+    }
+    if (!(newFrequency >= 20.0f && newFrequency <= 20000.0f) ||
+        !(fabs(newGain) <= EQ_MAX_GAIN_DB) || !(newQ >= 0.1f && newQ <= 10.0f))
+    {
+        displayError("Value out of range.");
+        return false;
+    }
+
+    band.type = static_cast<EqBandType>(type[0] - '1');
+    band.frequency = newFrequency;
+    band.gainDb = newGain;
+    band.q = newQ;
+    return true;
+}
+
+
+// Helper and utility functions
+
+int drawProgressBar(int row, int column, float percentage, bool isPaused)
+{
+    const int barWidth = 50;
+    percentage = percentage >= 0.0f ? min(percentage, 100.0f) : 0.0f;
+    int pos = barWidth * percentage / 100.0f;
+
+    column = terminal.print(row, column, CYAN + "[" + MAGENTA);
+    column = terminal.fill(row, column, pos, U'━');
+    if (pos < barWidth)
+    {
+        column = terminal.print(row, column, isPaused ? YELLOW + "◆" : GREEN + "⬤");
+        column = terminal.print(row, column, BLUE);
+        column = terminal.fill(row, column, barWidth - pos - 1, U'━');
+    }
+    column = terminal.print(row, column, CYAN + "]" + RESET + " ");
+
+    char text[16];
+    snprintf(text, sizeof(text), "%.1f%%", percentage);
+    return terminal.print(row, column, YELLOW + text + RESET);
+}
+
+bool validateAudioFile(string& filepath)
+{
+    fs::path inputPath(filepath);
+    fs::path fullPath;
+
+    // If path is already absolute, use it directly
+    if (inputPath.is_absolute())
+    {
+        fullPath = inputPath;
+    }
+    else
+    {
+        // Try multiple potential base paths
+        vector<fs::path> searchPaths =
+        {
+            fs::current_path(),
+            fs::current_path() / "playlist_data"
+        };
+
+        bool found = false;
+        for (const auto& basePath : searchPaths)
+        {
+            fullPath = basePath / inputPath;
+            if (fs::exists(fullPath))
+            {
+                found = true;
+                break;
+            }
+        }
+
+        // If file not found in any of the search paths, return false
+        if (!found)
+        {
+            return false;
+        }
+    }
+
+    // Check if file exists and is a regular file
+    if (!fs::exists(fullPath) || !fs::is_regular_file(fullPath))
+    {
+        return false;
+    }
+
+    bool isValid = hasAudioExtension(fullPath);
+
+    if (isValid)
+    {
+        filepath = fullPath.lexically_normal().string();
+    }
+
+    return isValid;
+}
+
+bool hasAudioExtension(const fs::path& path)
+{
+    // Get extension
+    string extension = path.extension().string();
+
+    // Validate extension (case-insensitive)
+    static const vector<string> validExtensions = {".wav", ".ogg", ".flac", ".mp3"};
+    return any_of(validExtensions.begin(), validExtensions.end(),
+        [&extension](const string& validExt)
+        {
+            return equal(validExt.begin(), validExt.end(),
+                         extension.begin(), extension.end(),
+                         [](char a, char b)
+                         {
+                             return tolower(a) == tolower(b);
+                         });
+        });
+}
+
+string guessArtist(const string& title)
+{
+    if (toLower(title) == "the astronaut")
+    {
+        return "Jin";
+    }
+    else if (toLower(title) == "my universe")
+    {
+        return "Coldplay / BTS";
+    }
+    return "BTS";
+}
+
+string formatDuration(float seconds)
+{
+    int mins = seconds / 60;
+    int secs = (int)seconds % 60;
+    stringstream ss;
+    ss << setfill('0') << setw(2) << mins << ":"
+       << setfill('0') << setw(2) << secs;
+    return ss.str();
+}
+
+string fitText(string_view text, size_t width)
+{
+    // Bytes of the longest prefix of whole UTF-8 characters within limit columns
+    auto fit = [&](size_t limit, size_t& used)
+    {
+        size_t pos = 0;
+        used = 0;
+        while (pos < text.size())
+        {
+            size_t next = pos;
+            size_t width = glyphWidth(decodeUtf8(text, next));
+            if (used + width > limit)
+            {
+                break;
+            }
+            used += width;
+            pos = next;
+        }
+        return pos;
+    };
+
+    size_t used;
+    size_t end = fit(width, used);
+    string fitted(text.substr(0, end));
+    if (end < text.size() && width >= 3)
+    {
+        fitted = string(text.substr(0, fit(width - 3, used))) + "...";
+        used += 3;
+    }
+    fitted.append(width - used, ' ');
+    return fitted;
+}
+
+uint32_t decodeUtf8(string_view text, size_t& pos)
+{
+    unsigned char lead = text[pos];
+    size_t length = min<size_t>(lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4, text.size() - pos);
+    uint32_t code = length == 1 ? lead : lead & (0x7F >> length);
+    for (size_t i = 1; i < length; ++i)
+    {
+        code = (code << 6) | (static_cast<unsigned char>(text[pos + i]) & 0x3F);
+    }
+    pos += length;
+    return code;
+}
+
+void appendUtf8(string& out, uint32_t code)
+{
+    if (code < 0x80)
+    {
+        out += static_cast<char>(code);
+    }
+    else if (code < 0x800)
+    {
+        out += static_cast<char>(0xC0 | (code >> 6));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+    else if (code < 0x10000)
+    {
+        out += static_cast<char>(0xE0 | (code >> 12));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+    else
+    {
+        out += static_cast<char>(0xF0 | (code >> 18));
+        out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (code & 0x3F));
+    }
+}
+
+int glyphWidth(uint32_t code)
+{
+    // Terminal columns per character: Hangul and other wide scripts take two,
+    // combining marks, joiners and variation selectors none
+    if ((code >= 0x0300 && code <= 0x036F) || code == 0x200D || (code >= 0xFE00 && code <= 0xFE0F))
+    {
+        return 0;
+    }
+    bool wide = (code >= 0x1100 && code <= 0x115F) || (code >= 0x2E80 && code <= 0xA4CF) ||
+                (code >= 0xAC00 && code <= 0xD7A3) || (code >= 0xF900 && code <= 0xFAFF) ||
+                (code >= 0xFF00 && code <= 0xFF60) || (code >= 0x1F300 && code <= 0x1FAFF);
+    return wide ? 2 : 1;
+}
+
+string toLower(const string str)
+{
+    string lower = str;
+    transform(lower.begin(), lower.end(), lower.begin(),
+        [](unsigned char c) { return tolower(c); });
+    return lower;
+}
+
+void parallelFor(size_t count, const function<void(size_t, size_t)>& body)
+{
+    // Small jobs are not worth the thread start-up cost
+    const size_t minChunk = 4096;
+    size_t workers = min<size_t>(max(1u, thread::hardware_concurrency()), (count + minChunk - 1) / minChunk);
+    if (workers <= 1)
+    {
+        body(0, count);
+        return;
+    }
+
+    vector<thread> threads;
+    size_t chunk = (count + workers - 1) / workers;
+    for (size_t begin = chunk; begin < count; begin += chunk)
+    {
+        threads.emplace_back(body, begin, min(count, begin + chunk));
+    }
+    body(0, min(count, chunk));
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+}
+
+template <typename T, typename Less>
+void parallelSort(vector<T>& items, const Less& less)
+{
+    // Each worker sorts one run, then neighbouring runs are merged pairwise
+    mutex lock;
+    vector<pair<size_t, size_t>> runs;
+    parallelFor(items.size(), [&](size_t begin, size_t end)
+    {
+        sort(items.begin() + begin, items.begin() + end, less);
+        lock_guard<mutex> guard(lock);
+        runs.emplace_back(begin, end);
+    });
+    sort(runs.begin(), runs.end());
+
+    while (runs.size() > 1)
+    {
+        vector<pair<size_t, size_t>> merged;
+        vector<thread> threads;
+        for (size_t i = 0; i + 1 < runs.size(); i += 2)
+        {
+            size_t begin = runs[i].first, middle = runs[i].second, end = runs[i + 1].second;
+            threads.emplace_back([&items, &less, begin, middle, end]
+            {
+                inplace_merge(items.begin() + begin, items.begin() + middle, items.begin() + end, less);
+            });
+            merged.emplace_back(begin, end);
+        }
+        if (runs.size() % 2 != 0)
+        {
+            merged.push_back(runs.back());
+        }
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+        runs = move(merged);
+    }
+}
+
+void clearScreen()
+{
+    terminal.clear();
+}
+
+void TerminalScreen::begin()
+{
+    int width, height;
+    getConsoleSize(width, height);
+    if (width != columns || height != rows)
+    {
+        columns = width;
+        rows = height;
+        frontValid = false;
+    }
+    back.assign(static_cast<size_t>(columns) * rows, ScreenCell());
+    pen = 0;
+}
+
+int TerminalScreen::put(int row, int column, uint32_t glyph)
+{
+    int width = glyphWidth(glyph);
+    if (width == 0 || row < 0 || row >= rows || column < 0 || column + width > columns)
+    {
+        return column + width;
+    }
+
+    ScreenCell* cell = &back[static_cast<size_t>(row) * columns + column];
+    // Never leave half of a wide glyph behind
+    if (cell[0].glyph == 0 && column > 0)
+    {
+        cell[-1].glyph = ' ';
+    }
+    if (column + width < columns && cell[width].glyph == 0)
+    {
+        cell[width].glyph = ' ';
+    }
+    cell[0] = {glyph, pen};
+    if (width == 2)
+    {
+        cell[1] = {0, pen};
+    }
+    return column + width;
+}
+
+int TerminalScreen::print(int row, int column, string_view text)
+{
+    size_t pos = 0;
+    while (pos < text.size())
+    {
+        if (text[pos] != '\033')
+        {
+            column = put(row, column, decodeUtf8(text, pos));
+            continue;
+        }
+
+        // Escape sequence: colour changes (the constants above) move the pen,
+        // anything else is skipped
+        size_t end = pos + 1;
+        while (end < text.size() && !(text[end] >= '@' && text[end] <= '~' && text[end] != '['))
+        {
+            ++end;
+        }
+        if (end < text.size() && text[end] == 'm')
+        {
+            int code = 0;
+            for (size_t i = pos + 2; i <= end; ++i)
+            {
+                if (isdigit(static_cast<unsigned char>(text[i])))
+                {
+                    code = code * 10 + (text[i] - '0');
+                    continue;
+                }
+                if (code == 0) pen = 0;
+                else if (code == 1) pen |= 0x100;
+                else if (code == 22) pen &= ~0x100;
+                else if (code >= 30 && code <= 37) pen = (pen & ~0x0F) | (code - 29);
+                else if (code == 39) pen &= ~0x0F;
+                else if (code >= 40 && code <= 47) pen = (pen & ~0xF0) | ((code - 39) << 4);
+                else if (code == 49) pen &= ~0xF0;
+                code = 0;
+            }
+        }
+        pos = end + 1;
+    }
+    return column;
+}
+
+int TerminalScreen::fill(int row, int column, int count, uint32_t glyph)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        column = put(row, column, glyph);
+    }
+    return column;
+}
+
+void TerminalScreen::present(int cursorRow, int cursorColumn)
+{
+    string out;
+    if (!frontValid)
+    {
+        out += "\033[0m\033[H\033[2J";
+        front.assign(back.size(), ScreenCell());
+        frontValid = true;
+    }
+
+    // Walk the grid and emit runs of changed cells; the cursor and the
+    // colour state are tracked so moves and colour codes are only sent
+    // when a run actually needs them
+    int style = -1;
+    int atRow = -1, atColumn = -1;
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int column = 0; column < columns; )
+        {
+            size_t i = static_cast<size_t>(row) * columns + column;
+            if (back[i] == front[i])
+            {
+                ++column;
+                continue;
+            }
+            if (back[i].glyph == 0 && column > 0)
+            {
+                // Right half of a wide glyph changed: redraw from its left half
+                --column;
+                --i;
+            }
+
+            if (row != atRow || column != atColumn)
+            {
+                out += "\033[" + to_string(row + 1) + ";" + to_string(column + 1) + "H";
+            }
+            if (back[i].style != style)
+            {
+                style = back[i].style;
+                out += "\033[0";
+                if (style & 0x100) out += ";1";
+                if (style & 0x0F) out += ";" + to_string(29 + (style & 0x0F));
+                if (style & 0xF0) out += ";" + to_string(39 + ((style >> 4) & 0x0F));
+                out += "m";
+            }
+
+            int width = back[i].glyph == 0 ? 1 : glyphWidth(back[i].glyph);
+            appendUtf8(out, back[i].glyph == 0 ? ' ' : back[i].glyph);
+            for (int k = 0; k < width; ++k)
+            {
+                front[i + k] = back[i + k];
+            }
+            cellsWritten += width;
+            column += width;
+            atRow = row;
+            atColumn = column;
+        }
+    }
+
+    if (style > 0)
+    {
+        out += RESET;
+    }
+    if (cursorRow >= 0 && (cursorRow != atRow || cursorColumn != atColumn))
+    {
+        out += "\033[" + to_string(cursorRow + 1) + ";" + to_string(cursorColumn + 1) + "H";
+    }
+
+    cout.write(out.data(), out.size());
+    cout.flush();
+    bytesWritten += out.size();
+    ++frames;
+}
+
+void TerminalScreen::clear()
+{
+    // Scrollback too, as CLS did
+    const string sequence = RESET + "\033[H\033[2J\033[3J";
+    cout << sequence << flush;
+    bytesWritten += sequence.size();
+
+    getConsoleSize(columns, rows);
+    front.assign(static_cast<size_t>(columns) * rows, ScreenCell());
+    frontValid = true;
+}
+
+void handleResize(int signal)
+{
+    // Nothing to do here: the signal interrupts InputWaiter::wait, and the
+    // next frame picks up the new size
+    (void)signal;
+}
+
+void InputWaiter::open()
+{
+#ifdef _WIN32
+    input = GetStdHandle(STD_INPUT_HANDLE);
+#else
+    if (!raw && tcgetattr(STDIN_FILENO, &saved) == 0)
+    {
+        termios settings = saved;
+        settings.c_lflag &= ~(ICANON | ECHO);
+        settings.c_cc[VMIN] = 1;
+        settings.c_cc[VTIME] = 0;
+        raw = tcsetattr(STDIN_FILENO, TCSANOW, &settings) == 0;
+    }
+#endif
+}
+
+void InputWaiter::close()
+{
+#ifdef _WIN32
+    input = nullptr;
+#else
+    if (raw)
+    {
+        tcsetattr(STDIN_FILENO, TCSANOW, &saved);
+        raw = false;
+    }
+#endif
+}
+
+int InputWaiter::wait(int timeoutMs)
+{
+#ifdef _WIN32
+    auto deadline = chrono::steady_clock::now() + chrono::milliseconds(max(timeoutMs, 0));
+    while (true)
+    {
+        if (_kbhit())
+        {
+            return _getch();
+        }
+
+        DWORD remaining = INFINITE;
+        if (timeoutMs >= 0)
+        {
+            auto left = chrono::duration_cast<chrono::milliseconds>(deadline - chrono::steady_clock::now()).count();
+            if (left <= 0)
+            {
+                return -1;
+            }
+            remaining = static_cast<DWORD>(left);
+        }
+
+        if (WaitForSingleObject(input, remaining) != WAIT_OBJECT_0)
+        {
+            return -1;
+        }
+
+        // The handle is also signalled by key releases, focus and mouse
+        // events; drop those so the next wait blocks again
+        INPUT_RECORD record;
+        DWORD count = 0;
+        if (!_kbhit() && PeekConsoleInput(input, &record, 1, &count) && count > 0)
+        {
+            ReadConsoleInput(input, &record, 1, &count);
+            if (record.EventType == WINDOW_BUFFER_SIZE_EVENT)
+            {
+                return -1;
+            }
+        }
+    }
+#else
+    // A resize arrives as SIGWINCH, which interrupts poll
+    pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    if (pendingScanCode < 0 && poll(&fd, 1, timeoutMs) <= 0)
+    {
+        return -1;
+    }
+    return readTerminalKey();
+#endif
+}
+
+void hideCursor()
+{
+#ifdef _WIN32
+    HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_CURSOR_INFO info;
+    info.dwSize = 100;
+    info.bVisible = FALSE;
+    SetConsoleCursorInfo(consoleHandle, &info);
+#else
+    cout << "\033[?25l" << flush;
+#endif
+}
+
+void showCursor()
+{
+#ifdef _WIN32
+    HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
+    CONSOLE_CURSOR_INFO info;
+    info.dwSize = 100;
+    info.bVisible = TRUE;
+    SetConsoleCursorInfo(consoleHandle, &info);
+#else
+    cout << "\033[?25h" << flush;
+#endif
+}
+
+void getConsoleSize(int& columns, int& rows)
+{
+    columns = 80;
+    rows = 25;
+#ifdef _WIN32
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
+    {
+        columns = info.srWindow.Right - info.srWindow.Left + 1;
+        rows = info.srWindow.Bottom - info.srWindow.Top + 1;
+    }
+#else
+    winsize size;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_col > 0)
+    {
+        columns = size.ws_col;
+        rows = size.ws_row;
+    }
+#endif
+}
+
+int readKey()
+{
+#ifdef _WIN32
+    return _getch();
+#else
+    // Raw mode only while waiting for this one key, as _getch does
+    InputWaiter waiter;
+    waiter.open();
+    int key;
+    do
+    {
+        key = readTerminalKey();
+    } while (key < 0);
+    return key;
+#endif
+}
+
+bool keyPending()
+{
+#ifdef _WIN32
+    return _kbhit();
+#else
+    InputWaiter waiter;
+    waiter.open();
+    pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    return pendingScanCode >= 0 || poll(&fd, 1, 0) > 0;
+#endif
+}
+
+#ifndef _WIN32
+int readTerminalKey()
+{
+    // Keys come out the way conio reports them: Enter as '\r', Backspace as
+    // 8, and arrow and paging keys as 224 followed by their scan code
+    if (pendingScanCode >= 0)
+    {
+        int code = pendingScanCode;
+        pendingScanCode = -1;
+        return code;
+    }
+
+    unsigned char byte;
+    if (read(STDIN_FILENO, &byte, 1) != 1)
+    {
+        return 27;  // Input closed: back out like Esc
+    }
+    if (byte == '\n') return '\r';
+    if (byte == 127) return 8;
+    if (byte != 27) return byte;
+
+    // A lone Esc is a key of its own; an escape sequence follows right away
+    string sequence;
+    pollfd fd = {STDIN_FILENO, POLLIN, 0};
+    while (sequence.size() < 4 && poll(&fd, 1, 30) > 0 && read(STDIN_FILENO, &byte, 1) == 1)
+    {
+        sequence += static_cast<char>(byte);
+        if (sequence.size() > 1 && (isalpha(byte) || byte == '~'))
+        {
+            break;
+        }
+    }
+    if (sequence.empty())
+    {
+        return 27;
+    }
+
+    static const pair<const char*, int> scanCodes[] =
+    {
+        {"[A", 72}, {"[B", 80}, {"[C", 77}, {"[D", 75},
+        {"[H", 71}, {"OH", 71}, {"[1~", 71}, {"[F", 79}, {"OF", 79}, {"[4~", 79},
+        {"[5~", 73}, {"[6~", 81}, {"[3~", 83}
+    };
+    for (const auto& [text, code] : scanCodes)
+    {
+        if (sequence == text)
+        {
+            pendingScanCode = code;
+            return 224;
+        }
+    }
+    return -1;  // Some other function key
+}
+#endif
+
+int get_int(string prompt)
+{
+    regex integer_regex("^-?[0-9]+$");
+    string input;
+
+    while (true)
+    {
+        cout << CYAN << prompt << RESET;
+        getline(cin, input);
+
+        if (regex_match(input, integer_regex))
+        {
+            try
+            {
+                return stoi(input);
+            }
+            catch (out_of_range&)
+            {
+                cout << "Error: Number out of range. Please try again.\n";
+            }
+        }
+        else
+        {
+            cout << RED << "Invalid input. Please enter a valid integer.\n" << RESET;
+        }
+    }
+}
+
+string get_text(const string& prompt, const string& fallback)
+{
+    // Shows the suggested value and returns it when the user just presses Enter
+    cout << CYAN << prompt;
+    if (!fallback.empty())
+    {
+        cout << " [" << fallback << "]";
+    }
+    cout << ": " << RESET;
+
+    string input;
+    getline(cin, input);
+    return input.empty() ? fallback : input;
+}
+
+
+// UI Functions
+int displayMenu(int row)
+{
+    terminal.print(row++, 0, BLUE + BOLD + "╔══════════════════════════════════════════════════════╗" + RESET);
+    terminal.print(row++, 0, BLUE + "║                                                      ║" + RESET);
+
+    string menu[] = {
+        CYAN + "1." + RESET + "  " + YELLOW + "Add Song" + RESET,
+        CYAN + "2." + RESET + "  " + YELLOW + "View Playlist" + RESET,
+        CYAN + "3." + RESET + "  " + YELLOW + "Remove Song" + RESET,
+        CYAN + "4." + RESET + "  " + YELLOW + "Play Song" + RESET,
+        CYAN + "5." + RESET + "  " + YELLOW + "Edit Song" + RESET,
+        CYAN + "6." + RESET + "  " + YELLOW + "Search Songs" + RESET,
+        CYAN + "7." + RESET + "  " + YELLOW + "Sort Playlist" + RESET,
+        CYAN + "8." + RESET + "  " + YELLOW + "Import Folder" + RESET,
+        CYAN + "9." + RESET + "  " + YELLOW + "Filter Songs" + RESET,
+        CYAN + "10." + RESET + " " + YELLOW + "Analyze Loudness" + RESET,
+        CYAN + "11." + RESET + " " + YELLOW + "Equalizer" + RESET,
+        CYAN + "12." + RESET + " " + YELLOW + "Statistics" + RESET,
+        CYAN + "13." + RESET + " " + YELLOW + "Help" + RESET,
+        CYAN + "14." + RESET + " " + RED + "Exit" + RESET
+    };
+
+    for (const auto& item : menu)
+    {
+        terminal.print(row, 0, "║ " + item);
+        terminal.print(row++, 55, "║");
+    }
+
+    terminal.print(row++, 0, BLUE + "║                                                      ║" + RESET);
+    terminal.print(row++, 0, BLUE + "╚══════════════════════════════════════════════════════╝" + RESET);
+    return row + 1;
+}
+
+int browsePlaylist(const SongStore& playlist, const string& heading, const vector<uint32_t>* rows)
+{
+    size_t count = rows ? rows->size() : playlist.size();
+    if (count == 0)
+    {
+        displayInfo("Playlist is empty!");
+        this_thread::sleep_for(chrono::milliseconds(1500));
+        return -1;
+    }
+
+    size_t cursor = 0;
+    size_t top = 0;
+    clearScreen();
+
+    while (true)
+    {
+        terminal.begin();
+        int columns = terminal.columns;
+
+        // Heading, blank line, three header lines, footer and status line
+        size_t visible = static_cast<size_t>(max(terminal.rows - 7, 1));
+        if (cursor < top) top = cursor;
+        if (cursor >= top + visible) top = cursor - visible + 1;
+
+        // Title and album share whatever width the fixed columns leave
+        size_t numberWidth = max<size_t>(2, to_string(count).size());
+        size_t tableWidth = static_cast<size_t>(max(min(columns - 1, 140), 60));
+        size_t flexible = tableWidth - 28 - numberWidth;
+        size_t titleWidth = flexible * 3 / 5;
+        size_t albumWidth = flexible - titleWidth;
+
+        auto rule = [](size_t width)
+        {
+            string line;
+            for (size_t i = 0; i < width; ++i) line += "─";
+            return line;
+        };
+        string separator = rule(numberWidth + 2) + "┼" + rule(titleWidth + 2) + "┼" + rule(albumWidth + 2) +
+                           "┼" + rule(6) + "┼" + rule(10);
+
+        // Only the rows in the window are formatted, whatever the library size;
+        // moving the cursor one row only sends the two rows that changed
+        terminal.print(0, 0, MAGENTA + BOLD + "  " + heading + RESET);
+        terminal.print(2, 0, CYAN + "╔" + rule(numberWidth + 2) + "╤" + rule(titleWidth + 2) + "╤" +
+                             rule(albumWidth + 2) + "╤" + rule(6) + "╤" + rule(10) + "╗");
+        terminal.print(3, 0, "║ " + fitText("No", numberWidth) + " │ " + fitText("Title", titleWidth) + " │ " +
+                             fitText("Album", albumWidth) + " │ Year │ Duration ║");
+        terminal.print(4, 0, "╟" + separator + "╢" + RESET);
+
+        int line = 5;
+        for (size_t row = top; row < top + visible && row < count; ++row)
+        {
+            uint32_t position = rows ? (*rows)[row] : static_cast<uint32_t>(row);
+            string number = to_string(row + 1);
+            string year = to_string(playlist.years[position]);
+            terminal.print(line++, 0, (row == cursor ? BG_BLUE + WHITE + BOLD : WHITE) +
+                           "║ " + string(numberWidth - number.size(), ' ') + number + " │ " +
+                           fitText(playlist.title(position), titleWidth) + " │ " +
+                           fitText(playlist.album(position), albumWidth) + " │ " +
+                           string(4 - min<size_t>(4, year.size()), ' ') + year + " │ " +
+                           "   " + formatDuration(playlist.durations[position]) + " ║" + RESET);
+        }
+
+        line = 5 + static_cast<int>(visible);
+        terminal.print(line++, 0, CYAN + "╚" + rule(numberWidth + 2) + "╧" + rule(titleWidth + 2) + "╧" +
+                                  rule(albumWidth + 2) + "╧" + rule(6) + "╧" + rule(10) + "╝" + RESET);
+        int end = terminal.print(line, 0, YELLOW + "Song " + to_string(cursor + 1) + " of " + to_string(count) + RESET +
+                                 "  ↑↓ PgUp PgDn Home End · G: go to number · Enter: select · Esc: back");
+        terminal.present(line, min(end, columns - 1));
+
+        int key = readKey();
+        if (key == 0 || key == 224)
+        {
+            // Arrow and paging keys arrive as a prefix byte and a scan code
+            switch (readKey())
+            {
+                case 72: // Up
+                    if (cursor > 0) --cursor;
+                    break;
+                case 80: // Down
+                    if (cursor + 1 < count) ++cursor;
+                    break;
+                case 73: // Page Up
+                    cursor = cursor > visible ? cursor - visible : 0;
+                    break;
+                case 81: // Page Down
+                    cursor = min(cursor + visible, count - 1);
+                    break;
+                case 71: // Home
+                    cursor = 0;
+                    break;
+                case 79: // End
+                    cursor = count - 1;
+                    break;
+            }
+        }
+        else if (key == '\r' || key == '\n')
+        {
+            return static_cast<int>(rows ? (*rows)[cursor] : cursor);
+        }
+        else if (key == 27) // Escape
+        {
+            return -1;
+        }
+        else if (key == 'g' || key == 'G')
+        {
+            cout << "\n";
+            int target = get_int("Go to song number: ");
+            if (target >= 1 && static_cast<size_t>(target) <= count)
+            {
+                cursor = static_cast<size_t>(target - 1);
+                top = cursor;
+            }
+            clearScreen();
+        }
+    }
+}
+
+void displayProgress(const PlayerState& state)
+{
+    float percentage = (state.position / state.duration) * 100;
+    int volumeInt = static_cast<int>(state.volume);
+
+    // Redrawn every 100 ms; present() only sends the cells that moved
+    terminal.begin();
+    int row = displayNowPlaying(state, 2) + 1;
+    drawProgressBar(row++, 0, percentage, state.paused);
+
+    // Time and Volume display
+    string timeDisplay = formatDuration(state.position) + " / " + formatDuration(state.duration);
+    int column = terminal.print(row, 0, YELLOW + timeDisplay + RESET + "   ");
+    terminal.print(row++, column, GREEN + "Volume: " + to_string(volumeInt) + "%" + RESET);
+
+    // Decode-ahead buffer, so underruns can be matched to what was heard
+    string buffer = "Buffer: " + to_string(static_cast<int>(state.bufferMs)) + "/" +
+                    to_string(static_cast<int>(state.bufferTargetMs)) + " ms · " +
+                    (state.lowLatency ? "low latency" : "power saving") +
+                    " · Underruns: " + to_string(state.underruns);
+    terminal.print(row++, 0, (state.underruns ? RED : BLUE) + buffer + RESET);
+
+    string crossfade = "Crossfade: off";
+    if (state.crossfadeSeconds > 0.0f)
+    {
+        crossfade = "Crossfade: " + to_string(static_cast<int>(state.crossfadeSeconds)) + " s " +
+                    (state.equalPowerFade ? "equal power" : "linear");
+    }
+    column = terminal.print(row, 0, BLUE + crossfade + RESET + "   ");
+
+    // Gain from the loudness cache; unanalyzed files play untouched
+    string gain = "Gain: not analyzed";
+    if (state.normalized)
+    {
+        ostringstream text;
+        text << "Gain: " << showpos << fixed << setprecision(1) << state.gainDb << " dB";
+        gain = text.str();
+    }
+    terminal.print(row++, column, BLUE + gain + RESET);
+
+    // The DSP load is the chain's share of one core while audio runs through it
+    ostringstream equalizer;
+    equalizer << "EQ: " << (state.eqEnabled ? state.eqPreset : "off");
+    if (state.eqEnabled && state.dspLoad > 0.0f)
+    {
+        equalizer << " · DSP " << fixed << setprecision(2) << state.dspLoad << "% of a core";
+    }
+    terminal.print(row, 0, BLUE + equalizer.str() + RESET);
+    row += 2;
+
+    // Controls
+    terminal.print(row++, 0, CYAN + "Controls:" + RESET);
+    static const char* const controls[] =
+    {
+        "⏯  Space: Play/Pause",
+        "⏹  Q: Stop",
+        "↩  B: Back to menu, keep playing",
+        "⏭  N,P: Next/Previous track",
+        "🔁  R: Restart",
+        "⏪⏩ <,>: Seek",
+        "🔈🔊 -,+: Volume",
+        "⚡  M: Low latency/Power saving",
+        "🔀  X,C: Crossfade length/curve",
+        "🎚  E: Equalizer on/off",
+        "❌ ESC: Exit Program"
+    };
+
+    for (const char* control : controls)
+    {
+        terminal.print(row, 0, CYAN + "- ");
+        terminal.print(row++, 2, control);
+    }
+    terminal.present(row, 0);
+}
+
+
+void displayError(const string& message)
+{
+    cout << RED << BOLD << "Error: " << message << RESET << "\n";
+    this_thread::sleep_for(chrono::seconds(2));
+}
+
+void displaySuccess(const string& message)
+{
+    cout << GREEN << BOLD << "Success: " << message << RESET << "\n";
+    this_thread::sleep_for(chrono::seconds(2));
+}
+
+void displayInfo(const string& message)
+{
+    cout << BLUE << BOLD << "Info: " << message << RESET << "\n";
+}
+
+void displayHelp()
+{
+    clearScreen();
+
+    cout << MAGENTA << BOLD << "╔══════════════════════════════════════════════════════╗" << '\n';
+    cout << "║                🎵 BTS Music Player Help 🎵           ║" << '\n';
+    cout << "╠══════════════════════════════════════════════════════╣" << RESET << '\n';
+
+    cout << '\n';
+    // Navigation Controls Section
+    cout << CYAN << BOLD << "Navigation Controls:" << RESET << "\n";
+    cout << GREEN << "• " << RESET << "Use number keys to select menu options\n";
+    cout << GREEN << "• " << RESET << "Press Enter to confirm selections\n\n";
+
+    // Playback Controls Section
+    cout << CYAN << BOLD << "Playback Controls:" << RESET << "\n";
+    cout << YELLOW << "• " << RESET << "Space: Play/Pause\n";
+    cout << YELLOW << "• " << RESET << "Q: Stop current song\n";
+    cout << YELLOW << "• " << RESET << "B: Back to the menu while the song keeps playing\n";
+    cout << YELLOW << "• " << RESET << "N/P: Next/Previous song in the queue\n";
+    cout << YELLOW << "• " << RESET << "0 in the menu: Return to the player\n";
+    cout << YELLOW << "• " << RESET << "R: Restart song\n";
+    cout << YELLOW << "• " << RESET << "<: Rewind 5 seconds\n";
+    cout << YELLOW << "• " << RESET << ">: Forward 5 seconds\n";
+    cout << YELLOW << "• " << RESET << "M: Switch between power-saving and low-latency buffering\n";
+    cout << YELLOW << "• " << RESET << "X: Crossfade between songs (off, 2, 5, 10 seconds)\n";
+    cout << YELLOW << "• " << RESET << "C: Equal-power or linear crossfade\n";
+    cout << YELLOW << "• " << RESET << "E: Turn the equalizer on or off (presets are in the Equalizer menu)\n";
+    cout << YELLOW << "• " << RESET << "ESC: Exit to main menu\n\n";
+
+    cout << CYAN << BOLD << "Volume Controls:" << RESET << "\n";
+    cout << BLUE << "• " << RESET << "-: Decrease volume\n";
+    cout << BLUE << "• " << RESET << "+ or /: Increase volume\n\n";
+
+    cout << CYAN << BOLD << "File Management:" << RESET << "\n";
+    cout << BLUE << "• " << RESET << "Supported formats: .wav, .ogg, .flac" << '\n';
+    cout << BLUE << "• " << RESET << "Playlist is automatically saved\n";
+    cout << BLUE << "• " << RESET << "Import Folder adds every audio file found under a folder\n";
+    cout << BLUE << "• " << RESET << "Filter example: year 2017-2020, duration < 4:00, album = BE\n";
+    cout << BLUE << "• " << RESET << "Analyze Loudness levels songs to " << LOUDNESS_TARGET_LUFS
+         << " LUFS and skips their silent edges\n";
+    cout << BLUE << "• " << RESET << "Start with --memory-mb <n> to hold up to n MB of decoded audio; short songs are\n"
+         << "  kept whole and play without disk reads, longer ones keep their opening\n";
+    cout << BLUE << "• " << RESET << "Equalizer presets are saved in " << EQ_PRESET_FILE << "; copy a built-in\n"
+         << "  preset with \"Save as a new preset\" to change its bands\n";
+    cout << BLUE << "• " << RESET << "Use absolute paths or relative paths from program directory\n\n";
+
+    cout << MAGENTA << BOLD << "╚══════════════════════════════════════════════════════╝" << '\n';
+    cout << "\n" << CYAN << "Press Enter to return to menu..." << RESET;
+    cin.get();
+}
+
+void displayStatistics(const SongStore& playlist, PlaylistJournal& journal, ProbeCache& cache, LoudnessCache& loudness, SeekIndex& seekIndex, AudioMemory& audio, const PlayerState& player)
+{
+    clearScreen();
+
+    SaveStats stats;
     {
-        song.artist = "BTS";
+        lock_guard<mutex> guard(journal.writer.lock);
+        stats = journal.writer.stats;
     }
 
-
-    // Album input with non-empty validation
-    while (true)
+    cout << MAGENTA << BOLD << "╔══════════════════════════════════════════════════════╗" << '\n';
+    cout << "║                 📊 Player Statistics 📊              ║" << '\n';
+    cout << "╚══════════════════════════════════════════════════════╝" << RESET << "\n\n";
+
+    cout << CYAN << BOLD << "Library:" << RESET << "\n";
+    cout << GREEN << "• " << RESET << "Songs:              " << playlist.size() << "\n";
+    cout << GREEN << "• " << RESET << "Distinct names:     " << playlist.names.size() << "\n";
+    cout << GREEN << "• " << RESET << "Folders:            " << playlist.directoryNames.size() << "\n";
+    cout << GREEN << "• " << RESET << "Memory:             " << fixed << setprecision(1)
+         << playlist.memoryUsage() / (1024.0 * 1024.0) << " MB" << defaultfloat << "\n\n";
+
+    cout << CYAN << BOLD << "Playlist Saves:" << RESET << "\n";
+    cout << GREEN << "• " << RESET << "Save requests:      " << stats.requests << "\n";
+    cout << GREEN << "• " << RESET << "Disk writes:        " << stats.writes << "\n";
+    cout << GREEN << "• " << RESET << "Merged requests:    " << stats.merged << "\n";
+    cout << GREEN << "• " << RESET << "Failed writes:      " << stats.failures << "\n";
+    cout << GREEN << "• " << RESET << "Retried batches:    " << stats.retries << "\n";
+    cout << fixed << setprecision(2);
+    cout << GREEN << "• " << RESET << "Last save latency:  " << stats.lastLatencyMs << " ms\n";
+    cout << GREEN << "• " << RESET << "Max save latency:   " << stats.maxLatencyMs << " ms\n";
+    cout << GREEN << "• " << RESET << "Avg save latency:   "
+         << (stats.writes ? stats.totalLatencyMs / stats.writes : 0.0) << " ms\n";
+    cout << defaultfloat;
+
+    size_t cacheSize;
     {
-        cout << CYAN << "🔹 Enter album name: " << RESET;
-        getline(cin, song.album);
-
-        if (!song.album.empty())
-        {
-            break;
-        }
-        displayError("Album name cannot be empty!");
+        lock_guard<mutex> guard(cache.lock);
+        cacheSize = cache.entries.size();
     }
+    cout << "\n" << CYAN << BOLD << "Metadata Cache:" << RESET << "\n";
+    cout << GREEN << "• " << RESET << "Cached files:       " << cacheSize << "\n";
+    cout << GREEN << "• " << RESET << "Hits:               " << cache.hits << "\n";
+    cout << GREEN << "• " << RESET << "Misses:             " << cache.misses << "\n";
 
-    // Enter release year with robust input validation
-    while (true)
+    size_t analyzed;
     {
-        cout << CYAN << "🔹 Enter release year: " << RESET;
-
-        string yearInput;
-        getline(cin, yearInput);
-
-        try
-        {
-            song.year = stoi(yearInput);
-
-            if (song.year >= 1900 && song.year <= 2100)
-            {
-                break;
-            }
-
-            displayError("Invalid year! Please enter a year between 1900-2100.");
-        }
-        catch (const invalid_argument&)
-        {
-            displayError("Invalid input! Please enter a numeric year.");
-        }
-        catch (const out_of_range&)
-        {
-            displayError("Year is out of valid range!");
-        }
+        lock_guard<mutex> guard(loudness.lock);
+        analyzed = loudness.entries.size();
     }
+    cout << "\n" << CYAN << BOLD << "Loudness:" << RESET << "\n";
+    cout << GREEN << "• " << RESET << "Analyzed files:     " << analyzed << "\n";
+    cout << GREEN << "• " << RESET << "Target level:       " << LOUDNESS_TARGET_LUFS << " LUFS\n";
 
-    while (true)
+    size_t fullTracks = 0, openings = 0, fullBytes = 0, openingBytes = 0, audioBudget;
+    uint64_t audioHits, audioMisses, audioEvictions;
     {
-        cout << CYAN << "🔹 Enter audio filepath: " << RESET;
-        getline(cin, song.filepath);
-
-        // Trim whitespace from filepath
-        song.filepath.erase(0, song.filepath.find_first_not_of(" \t"));
-        song.filepath.erase(song.filepath.find_last_not_of(" \t") + 1);
-
-        if (!song.filepath.empty() && validateAudioFile(song.filepath))
+        lock_guard<mutex> guard(audio.lock);
+        for (const auto& [path, entry] : audio.entries)
         {
-            break;
+            size_t bytes = entry.clip->samples.size() * sizeof(sf::Int16);
+            (entry.clip->complete ? fullTracks : openings)++;
+            (entry.clip->complete ? fullBytes : openingBytes) += bytes;
         }
-        displayError("❌ Invalid audio file! Please check the path and try again.");
+        audioBudget = audio.budgetBytes;
+        audioHits = audio.hits;
+        audioMisses = audio.misses;
+        audioEvictions = audio.evictions;
     }
-
-    // Get duration using SFML with error handling
-    sf::Music music;
-    try
+    cout << "\n" << CYAN << BOLD << "Audio Memory:" << RESET << "\n";
+    cout << fixed << setprecision(1);
+    cout << GREEN << "• " << RESET << "Budget:             " << audioBudget / (1024.0 * 1024.0) << " MB\n";
+    cout << GREEN << "• " << RESET << "Decoded in full:    " << fullTracks << " tracks, " << fullBytes / (1024.0 * 1024.0) << " MB\n";
+    cout << GREEN << "• " << RESET << "Streamed, opening:  " << openings << " tracks, " << openingBytes / (1024.0 * 1024.0) << " MB\n";
+    cout << defaultfloat;
+    cout << GREEN << "• " << RESET << "Hits:               " << audioHits << "\n";
+    cout << GREEN << "• " << RESET << "Misses:             " << audioMisses << "\n";
+    cout << GREEN << "• " << RESET << "Evictions:          " << audioEvictions << "\n";
+
+    cout << "\n" << CYAN << BOLD << "Screen Output:" << RESET << "\n";
+    cout << GREEN << "• " << RESET << "Frames drawn:       " << terminal.frames << "\n";
+    cout << GREEN << "• " << RESET << "Cells rewritten:    " << terminal.cellsWritten << "\n";
+    cout << GREEN << "• " << RESET << "Bytes written:      " << terminal.bytesWritten << "\n";
+
+    cout << "\n" << CYAN << BOLD << "Playback:" << RESET << "\n";
+    cout << GREEN << "• " << RESET << "Track changes:      " << player.transitions << "\n";
+    cout << GREEN << "• " << RESET << "Gapless joins:      " << player.gaplessTransitions << "\n";
+    cout << fixed << setprecision(1);
+    cout << GREEN << "• " << RESET << "Last gap:           " << player.lastGapMs << " ms\n";
+    cout << GREEN << "• " << RESET << "Max gap:            " << player.maxGapMs << " ms\n";
+    cout << defaultfloat;
+    cout << GREEN << "• " << RESET << "Buffering:          " << (player.lowLatency ? "low latency" : "power saving") << "\n";
+    cout << GREEN << "• " << RESET << "Underruns:          " << player.underruns << "\n";
+    cout << GREEN << "• " << RESET << "Audio mapped:       " << fixed << setprecision(1)
+         << player.bytesMapped / (1024.0 * 1024.0) << " MB" << defaultfloat << "\n";
+#ifdef _WIN32
+    cout << GREEN << "• " << RESET << "Cold pages:         " << "not tracked on Windows" << "\n";
+#else
+    cout << GREEN << "• " << RESET << "Cold pages:         " << player.coldPages << "\n";
+#endif
+    cout << GREEN << "• " << RESET << "Read stalls:        " << player.readStalls << "\n";
+
+    size_t seekTables = 0;
     {
-        if (music.openFromFile(song.filepath))
-        {
-            song.duration = music.getDuration().asSeconds();
-        }
-        else
+        lock_guard<mutex> guard(seekIndex.lock);
+        for (const auto& [path, entry] : seekIndex.entries)
         {
-            song.duration = 0.0f;
-            displayError("Could not determine song duration.");
+            seekTables += !entry.table->frames.empty();
         }
     }
-    catch (const exception& e)
-    {
-        song.duration = 0.0f;
-        displayError("Error processing audio file: " + string(e.what()));
-    }
-
-    playlist.push_back(song);
+    cout << GREEN << "• " << RESET << "Seek tables:        " << seekTables << " files\n";
+    cout << GREEN << "• " << RESET << "Last seek:          " << fixed << setprecision(1)
+         << player.lastSeekMs << " ms" << defaultfloat << "\n";
+    cout << GREEN << "• " << RESET << "Last start:         " << fixed << setprecision(1)
+         << player.lastStartMs << " ms" << defaultfloat
+         << (player.lastStartFrom == START_MEMORY ? " (in memory)" : player.lastStartFrom == START_PREROLL ? " (pre-roll)" : " (cold)") << "\n";
+    cout << GREEN << "• " << RESET << "Crossfade:          ";
+    if (player.crossfadeSeconds > 0.0f)
+        cout << player.crossfadeSeconds << " s " << (player.equalPowerFade ? "equal power" : "linear") << "\n";
+    else
+        cout << "off\n";
+    cout << GREEN << "• " << RESET << "Equalizer:          " << (player.eqEnabled ? player.eqPreset : "off") << "\n";
+    cout << GREEN << "• " << RESET << "DSP load:           " << fixed << setprecision(2) << player.dspLoad
+         << "% of a core" << setprecision(1) << " (last block " << player.dspLastBlockUs << " µs, max "
+         << player.dspMaxBlockUs << " µs)" << defaultfloat << "\n";
 
-    displaySuccess("✅ Song added successfully!");
+    cout << "\n" << CYAN << "Press Enter to return to menu..." << RESET;
+    cin.get();
 }
 
-void removeSong(vector<Song>& playlist)
+int displayLogo(int row)
 {
-    clearScreen();
-
-    // Display the current playlist header
-    cout << MAGENTA << BOLD << "╔════════════════════════════════════════╗\n";
-    cout << "║          🎵 Remove a Song 🎵           ║\n";
-    cout << "╚════════════════════════════════════════╝" << RESET << "\n\n";
+    terminal.print(row + 1, 0, MAGENTA + BOLD + "    ╔═══════════════════════════════════════════════╗");
+    terminal.print(row + 2, 0, "    ║     ♪♫•*¨*•.¸¸♫♪ BTS PLAYER ♪♫•*¨*•.¸¸♫♪      ║");
+    terminal.print(row + 3, 0, "    ╚═══════════════════════════════════════════════╝" + RESET);
+    return row + 5;
+}
 
-    if (playlist.empty())
+int displayNowPlaying(const PlayerState& state, int row)
+{
+    // Playing status
+    string status = state.paused ? "⏸️ PAUSED" : "▶️ NOW PLAYING";
+    if (state.repeat)
     {
-        displayInfo("Playlist is empty! There are no songs to remove.");
-        return;
+        status += "  🔁";
     }
 
-    displayPlaylist(playlist);
+    // Song details
+    string title = string(state.title) + " - " + state.artist;
+    string album = "Album: " + string(state.album) + " (" + to_string(state.year) + ")";
+    if (state.queueLength > 1)
+    {
+        status += "   Track " + to_string(state.queuePosition + 1) + " of " + to_string(state.queueLength);
+    }
 
-    int songNumber;
+    // Display the now-playing information
+    terminal.print(row++, 0, MAGENTA + BOLD + status + RESET);
+    terminal.print(row++, 0, GREEN + BOLD + title + RESET);
+    terminal.print(row++, 0, BLUE + album + RESET);
+    return row;
+}
 
-    while (true)
+int displayPlayerStatus(const PlayerState& state, int row)
+{
+    if (!state.active)
     {
-        songNumber = get_int("\nEnter the song number to remove (0 to cancel): ");
-
-        if (songNumber == 0)
-        {
-            displayInfo("Song removal cancelled.");
-            return;
-        }
-        else if (songNumber > 0 && songNumber <= static_cast<int>(playlist.size()))
-        {
-            break;
-        }
-        else
-        {
-            displayError("Invalid input! Please enter a valid song number.");
-        }
+        return row;
     }
 
-    size_t indexToRemove = static_cast<size_t>(songNumber - 1);
-    string removedSongTitle = playlist[indexToRemove].title;
-
-    cout << RED << "\nAre you sure you want to remove \"" << removedSongTitle << "\"? (y/n): " << RESET;
-    string confirmation;
-    getline(cin, confirmation);
+    // One line under the menu while music plays in the background
+    string song = string(state.title) + " - " + state.artist;
+    terminal.print(row, 0, MAGENTA + BOLD + (state.paused ? "⏸ " : "♪ ") + RESET +
+                   fitText(song, 40) + "  " + YELLOW + formatDuration(state.position) + " / " +
+                   formatDuration(state.duration) + RESET + CYAN + "   0. Player" + RESET);
+    return row + 2;
+}
 
-    if (toLower(confirmation) != "y" && toLower(confirmation) != "yes")
+// File I/O
+bool MappedFile::open(const string& path)
+{
+    close();
+#ifdef _WIN32
+    file = CreateFile(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
     {
-        displayInfo("Song removal cancelled.");
-        Sleep(2000);
-        return;
+        return false;
     }
 
-    playlist.erase(playlist.begin() + indexToRemove);
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+    {
+        close();
+        return false;
+    }
 
-    displaySuccess("✅ Successfully removed \"" + removedSongTitle + "\" from the playlist.");
-    Sleep(2000);
+    mapping = CreateFileMapping(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+    {
+        close();
+        return false;
+    }
 
-    // Save the updated playlist
-    savePlaylist(playlist);
-}
+    data = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return false;
+    }
 
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0)
+    {
+        close();
+        return false;
+    }
 
-// Helper and utility functions
+    void* view = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    data = view == MAP_FAILED ? nullptr : static_cast<const char*>(view);
+    size = static_cast<size_t>(info.st_size);
+#endif
+    if (!data)
+    {
+        close();
+        return false;
+    }
+    return true;
+}
 
-string getProgressBar(float percentage, bool isPaused)
+void MappedFile::close()
 {
-    const int barWidth = 50;
-    int pos = barWidth * percentage / 100.0f;
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data) munmap(const_cast<char*>(data), size);
+    if (fd >= 0) ::close(fd);
+    fd = -1;
+#endif
+    data = nullptr;
+    size = 0;
+}
 
-    string bar = CYAN + "[" + RESET;
+bool readCacheHeader(const MappedFile& file, const char (&magic)[8], uint32_t version, size_t minimumEntrySize,
+                     PayloadReader& reader, uint32_t& count)
+{
+    // Cache files are magic, version, entry count, then the entries
+    reader.data = string_view(file.data, file.size);
+    reader.pos = sizeof(magic);
 
-    for (int i = 0; i < barWidth; ++i)
+    uint32_t fileVersion;
+    if (file.size < sizeof(magic) || memcmp(file.data, magic, sizeof(magic)) != 0 ||
+        !reader.readU32(fileVersion) || fileVersion != version || !reader.readU32(count))
     {
-        if (i < pos)
-        {
-            bar += MAGENTA + "━" + RESET;
-        }
-        else if (i == pos)
-        {
-            bar += isPaused ? YELLOW + "◆" + RESET : GREEN + "⬤" + RESET;
-        }
-        else
-        {
-            bar += BLUE + "━" + RESET;
-        }
+        return false;
     }
 
-    bar += CYAN + "]" + RESET;
-
-    // Use stringstream for formatting percentage
-    ostringstream oss;
-    oss << YELLOW << fixed << setprecision(1) << percentage << "%" << RESET;
-    return bar + " " + oss.str();
+    // The count is only a hint; a corrupt one must not size allocations
+    count = static_cast<uint32_t>(min<size_t>(count, (file.size - reader.pos) / minimumEntrySize));
+    return true;
 }
 
-bool validateAudioFile(string& filepath)
+uint64_t checksumBytes(const char* data, size_t size)
 {
-    fs::path inputPath(filepath);
-    fs::path fullPath;
+    // FNV-1a style mixing, eight bytes at a time
+    const uint64_t prime = 1099511628211ULL;
+    uint64_t hash = 1469598103934665603ULL;
+    size_t i = 0;
 
-    // If path is already absolute, use it directly
-    if (inputPath.is_absolute())
+    for (; i + 8 <= size; i += 8)
     {
-        fullPath = inputPath;
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * prime;
+        hash ^= hash >> 29;
     }
-    else
+    for (; i < size; ++i)
     {
-        // Try multiple potential base paths
-        vector<fs::path> searchPaths =
-        {
-            fs::current_path(),
-            fs::current_path() / "playlist_data"
-        };
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * prime;
+    }
+    return hash;
+}
 
-        bool found = false;
-        for (const auto& basePath : searchPaths)
-        {
-            fullPath = basePath / inputPath;
-            if (fs::exists(fullPath))
-            {
-                found = true;
-                break;
-            }
-        }
+bool openPlaylistView(const MappedFile& file, PlaylistFileView& view)
+{
+    if (file.size < sizeof(PlaylistFileHeader))
+    {
+        return false;
+    }
 
-        // If file not found in any of the search paths, return false
-        if (!found)
-        {
-            return false;
-        }
+    const auto* header = reinterpret_cast<const PlaylistFileHeader*>(file.data);
+    if (memcmp(header->magic, PLAYLIST_MAGIC, sizeof(PLAYLIST_MAGIC)) != 0 ||
+        header->version != PLAYLIST_VERSION ||
+        header->headerSize != sizeof(PlaylistFileHeader))
+    {
+        return false;
     }
 
-    // Check if file exists and is a regular file
-    if (!fs::exists(fullPath) || !fs::is_regular_file(fullPath))
+    // Reject anything that would read past the end of the mapping. Sizes are
+    // compared against what is left of the file, so a crafted header cannot
+    // wrap an offset + size sum back into range; the table follows the header
+    if (header->recordOffset != sizeof(PlaylistFileHeader) ||
+        header->recordCount > (file.size - header->recordOffset) / sizeof(PlaylistFileRecord))
+    {
+        return false;
+    }
+    uint64_t tableSize = header->recordCount * sizeof(PlaylistFileRecord);
+    if (header->blobOffset != header->recordOffset + tableSize ||
+        header->blobSize != file.size - header->blobOffset)
     {
         return false;
     }
 
-    // Get extension
-    string extension = fullPath.extension().string();
+    if (checksumBytes(file.data + header->recordOffset, tableSize + header->blobSize) != header->checksum)
+    {
+        return false;
+    }
 
-    // Validate extension (case-insensitive)
-    vector<string> validExtensions = {".wav", ".ogg", ".flac", ".mp3"};
-    bool isValid = any_of(validExtensions.begin(), validExtensions.end(),
-        [&extension](const string& validExt)
-        {
-            return equal(validExt.begin(), validExt.end(),
-                         extension.begin(), extension.end(),
-                         [](char a, char b)
-                         {
-                             return tolower(a) == tolower(b);
-                         });
-        });
+    view.header = header;
+    view.records = reinterpret_cast<const PlaylistFileRecord*>(file.data + header->recordOffset);
+    view.blob = file.data + header->blobOffset;
 
-    if (isValid)
+    for (size_t i = 0; i < view.size(); ++i)
     {
-        filepath = fullPath.lexically_normal().string();
+        const PlaylistFileRecord& record = view.records[i];
+        if (uint64_t(record.titleOffset) + record.titleLength > header->blobSize ||
+            uint64_t(record.artistOffset) + record.artistLength > header->blobSize ||
+            uint64_t(record.filepathOffset) + record.filepathLength > header->blobSize ||
+            uint64_t(record.albumOffset) + record.albumLength > header->blobSize)
+        {
+            view = PlaylistFileView();
+            return false;
+        }
     }
-
-    return isValid;
+    return true;
 }
 
-string formatDuration(float seconds)
+void savePlaylist(const SongStore& playlist, uint64_t journalSequence)
 {
-    int mins = seconds / 60;
-    int secs = (int)seconds % 60;
-    stringstream ss;
-    ss << setfill('0') << setw(2) << mins << ":"
-       << setfill('0') << setw(2) << secs;
-    return ss.str();
+    writeFileAtomically(PLAYLIST_FILE, serializePlaylist(playlist, journalSequence));
 }
 
-string toLower(const string str)
+string serializePlaylist(const SongStore& playlist, uint64_t journalSequence)
 {
-    string lower = str;
-    transform(lower.begin(), lower.end(), lower.begin(),
-        [](unsigned char c) { return tolower(c); });
-    return lower;
-}
+    vector<PlaylistFileRecord> records(playlist.size());
+    string blob;
 
-void clearScreen()
-{
-    system("CLS");
-}
+    const fs::path basePath = fs::current_path();
+    const string basePrefix = basePath.string() + string(1, fs::path::preferred_separator);
 
-void hideCursor()
-{
-    HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_CURSOR_INFO info;
-    info.dwSize = 100;
-    info.bVisible = FALSE;
-    SetConsoleCursorInfo(consoleHandle, &info);
-}
+    // Names and folders are already interned by the store, so each is
+    // written or converted once and songs just refer to it by id
+    vector<uint32_t> nameOffsets(playlist.names.size(), UINT32_MAX);
+    vector<string> storedDirectories(playlist.directoryNames.size());
+    for (size_t i = 0; i < storedDirectories.size(); ++i)
+    {
+        // Roots such as "/" or "C:\" are kept absolute
+        const string& directory = playlist.directoryNames[i];
+        string parent = directory.substr(0, directory.size() > 0 ? directory.size() - 1 : 0);
+        if (fs::path(parent).relative_path().empty())
+        {
+            storedDirectories[i] = directory;
+        }
+        else
+        {
+            storedDirectories[i] = storedPathFor(parent, basePath, basePrefix) + directory.back();
+        }
+    }
 
-void showCursor()
-{
-    HANDLE consoleHandle = GetStdHandle(STD_OUTPUT_HANDLE);
-    CONSOLE_CURSOR_INFO info;
-    info.dwSize = 100;
-    info.bVisible = TRUE;
-    SetConsoleCursorInfo(consoleHandle, &info);
+    auto addName = [&](uint32_t name, uint32_t& offset, uint32_t& length)
+    {
+        if (nameOffsets[name] == UINT32_MAX)
+        {
+            nameOffsets[name] = static_cast<uint32_t>(blob.size());
+            blob += playlist.names[name];
+        }
+        offset = nameOffsets[name];
+        length = static_cast<uint32_t>(playlist.names[name].size());
+    };
+    auto addText = [&](string_view text, uint32_t& offset, uint32_t& length)
+    {
+        offset = static_cast<uint32_t>(blob.size());
+        length = static_cast<uint32_t>(text.size());
+        blob.append(text.data(), text.size());
+    };
+
+    for (size_t i = 0; i < playlist.size(); ++i)
+    {
+        PlaylistFileRecord& record = records[i];
+
+        addText(playlist.title(i), record.titleOffset, record.titleLength);
+        addName(playlist.artists[i], record.artistOffset, record.artistLength);
+        addName(playlist.albums[i], record.albumOffset, record.albumLength);
+
+        const string& directory = storedDirectories[playlist.directories[i]];
+        string_view fileName = playlist.text(playlist.fileNames[i]);
+        record.filepathOffset = static_cast<uint32_t>(blob.size());
+        record.filepathLength = static_cast<uint32_t>(directory.size() + fileName.size());
+        blob += directory;
+        blob.append(fileName.data(), fileName.size());
+
+        record.year = playlist.years[i];
+        record.duration = playlist.durations[i];
+    }
+
+    PlaylistFileHeader header = {};
+    memcpy(header.magic, PLAYLIST_MAGIC, sizeof(PLAYLIST_MAGIC));
+    header.version = PLAYLIST_VERSION;
+    header.headerSize = sizeof(PlaylistFileHeader);
+    header.recordCount = records.size();
+    header.recordOffset = sizeof(PlaylistFileHeader);
+    header.blobOffset = header.recordOffset + records.size() * sizeof(PlaylistFileRecord);
+    header.blobSize = blob.size();
+    header.journalSequence = journalSequence;
+
+    string data(sizeof(header), '\0');
+    data.append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(PlaylistFileRecord));
+    data += blob;
+    header.checksum = checksumBytes(data.data() + sizeof(header), data.size() - sizeof(header));
+    memcpy(&data[0], &header, sizeof(header));
+    return data;
 }
 
-int get_int(string prompt)
+void loadPlaylist(SongStore& playlist, PlaylistJournal& journal)
 {
-    regex integer_regex("^-?[0-9]+$");
-    string input;
+    uint64_t snapshotSequence = 0;
+    MappedFile file;
 
-    while (true)
+    if (file.open(PLAYLIST_FILE))
     {
-        cout << CYAN << prompt << RESET;
-        getline(cin, input);
-
-        if (regex_match(input, integer_regex))
+        if (memcmp(file.data, PLAYLIST_MAGIC, min(file.size, sizeof(PLAYLIST_MAGIC))) != 0)
         {
-            try
-            {
-                return stoi(input);
-            }
-            catch (out_of_range&)
+            // Pre-v2 file: read it the old way once and rewrite it in the new format
+            file.close();
+            loadLegacyPlaylist(playlist);
+            if (!playlist.empty())
             {
-                cout << "Error: Number out of range. Please try again.\n";
+                savePlaylist(playlist);
             }
         }
         else
         {
-            cout << RED << "Invalid input. Please enter a valid integer.\n" << RESET;
+            PlaylistFileView view;
+            if (openPlaylistView(file, view))
+            {
+                snapshotSequence = view.header->journalSequence;
+                loadPlaylistView(playlist, view);
+            }
+            else
+            {
+                // Writing now would replace the library with whatever little
+                // could be recovered, so leave the snapshot and journal as they are
+                journal.readOnly = true;
+                displayError("Playlist file is corrupted and could not be loaded. Changes will not be saved this session.");
+            }
         }
     }
-}
 
+    uint64_t lastSequence = replayJournal(playlist, snapshotSequence);
+    journal.nextSequence = lastSequence + 1;
 
-// UI Functions
-void displayMenu()
-{
-    cout << BLUE << BOLD << "╔══════════════════════════════════════════════════════╗" << RESET << endl;
-    cout << BLUE << "║                                                      ║" << RESET << endl;
+    // A leftover journal (crash, or a torn tail) is folded in right away so
+    // new records are never appended after unreadable ones
+    error_code ec;
+    if (fs::file_size(PLAYLIST_JOURNAL_FILE, ec) > 0 && !ec)
+    {
+        compactPlaylist(playlist, journal);
+    }
+}
 
-    string menu[] = {
-        CYAN + "1." + RESET + "  " + YELLOW + "Add Song" + RESET,
-        CYAN + "2." + RESET + "  " + YELLOW + "View Playlist" + RESET,
-        CYAN + "3." + RESET + "  " + YELLOW + "Remove Song" + RESET,
-        CYAN + "4." + RESET + "  " + YELLOW + "Play Song" + RESET,
-        CYAN + "5." + RESET + "  " + YELLOW + "Edit Song" + RESET,
-        CYAN + "6." + RESET + "  " + YELLOW + "Search Songs" + RESET,
-        CYAN + "7." + RESET + "  " + YELLOW + "Sort Playlist" + RESET,
-        CYAN + "8." + RESET + "  " + YELLOW + "Help" + RESET,
-        CYAN + "9." + RESET + "  " + RED + "Exit" + RESET
+void loadPlaylistView(SongStore& playlist, const PlaylistFileView& view)
+{
+    // Columns are filled straight from the mapping: titles and file names are
+    // appended to the arena, and each distinct name and folder is converted
+    // once instead of building a Song per record
+    const fs::path basePath = fs::current_path();
+    const string basePrefix = basePath.string() + string(1, fs::path::preferred_separator);
+    playlist.reserve(playlist.size() + view.size());
+    playlist.arena.reserve(playlist.arena.size() + view.header->blobSize);
+
+    // The writer stores every distinct name once, so its blob offset names it
+    unordered_map<uint32_t, uint32_t> nameIds;
+    auto nameAt = [&](uint32_t offset, uint32_t length)
+    {
+        auto it = nameIds.find(offset);
+        if (it == nameIds.end())
+        {
+            it = nameIds.emplace(offset, playlist.internName(string(view.text(offset, length)))).first;
+        }
+        return it->second;
     };
 
-    for (const auto& item : menu)
+    // Folders are repeated in every path, so they are keyed by their stored text
+    unordered_map<string_view, uint32_t> directoryIds;
+    string_view lastDirectory;
+    uint32_t lastDirectoryId = 0;
+
+    for (size_t i = 0; i < view.size(); ++i)
     {
-        cout << "║ " << item << string(70 - item.length(), ' ') << " ║" << endl;
-    }
+        const PlaylistFileRecord& record = view.records[i];
+        bool sameArtist = i > 0 && record.artistOffset == view.records[i - 1].artistOffset;
+        bool sameAlbum = i > 0 && record.albumOffset == view.records[i - 1].albumOffset;
+
+        string_view storedPath = view.text(record.filepathOffset, record.filepathLength);
+        size_t split = storedPath.find_last_of("/\\");
+        split = split == string_view::npos ? 0 : split + 1;
+        string_view directory = storedPath.substr(0, split);
+        if (i == 0 || directory != lastDirectory)
+        {
+            auto it = directoryIds.find(directory);
+            if (it == directoryIds.end())
+            {
+                string resolved = directory.empty() ? basePrefix : resolveStoredPath(directory, basePath, basePrefix);
+                it = directoryIds.emplace(directory, playlist.internDirectory(resolved)).first;
+            }
+            lastDirectory = directory;
+            lastDirectoryId = it->second;
+        }
 
-    cout << BLUE << "║                                                      ║" << RESET << endl;
-    cout << BLUE << "╚══════════════════════════════════════════════════════╝" << RESET << endl;
-    cout << '\n';
+        playlist.titles.push_back(playlist.storeText(view.text(record.titleOffset, record.titleLength)));
+        playlist.fileNames.push_back(playlist.storeText(storedPath.substr(split)));
+        playlist.artists.push_back(sameArtist ? playlist.artists.back() : nameAt(record.artistOffset, record.artistLength));
+        playlist.albums.push_back(sameAlbum ? playlist.albums.back() : nameAt(record.albumOffset, record.albumLength));
+        playlist.directories.push_back(lastDirectoryId);
+        playlist.years.push_back(record.year);
+        playlist.durations.push_back(record.duration);
+        playlist.ids.push_back(playlist.nextId++);
+    }
+    ++playlist.version;
+    ++playlist.contentVersion;
 }
 
-void displayPlaylist(const vector<Song>& playlist, int currentSong)
+void loadLegacyPlaylist(SongStore& playlist)
 {
-    clearScreen();
-    cout << MAGENTA << BOLD << "╔══════════════════════════════════════════════════════════════════════╗\n";
-    cout << "║                            🎵 Current Playlist 🎵                    ║\n";
-    cout << "╚══════════════════════════════════════════════════════════════════════╝" << RESET << "\n\n";
+    ifstream file(PLAYLIST_FILE, ios::binary);
+    if (!file) return;
 
-    if (playlist.empty())
+    size_t size;
+    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+
+    for (size_t i = 0; i < size && file; ++i)
     {
-        displayInfo("Playlist is empty!");
-        return;
-    }
+        Song song;
+        size_t titleLen, artistLen, filepathLen, albumLen;
 
-    // Table header
-    cout << CYAN << "╔════╤──────────────────────────────────────┬──────────────────────┬──────┬──────────╗\n";
-    cout << "║ No │ Title                                │ Album                │ Year │ Duration ║\n";
-    cout << "╟────┼──────────────────────────────────────┼──────────────────────┼──────┼──────────╢\n";
+        file.read(reinterpret_cast<char*>(&titleLen), sizeof(titleLen));
+        song.title.resize(titleLen);
+        file.read(&song.title[0], titleLen);
 
-    // Table content
-    for (size_t i = 0; i < playlist.size(); i++)
-    {
-        string rowColor = (i == currentSong) ? GREEN : WHITE;
+        file.read(reinterpret_cast<char*>(&artistLen), sizeof(artistLen));
+        song.artist.resize(artistLen);
+        file.read(&song.artist[0], artistLen);
+
+        file.read(reinterpret_cast<char*>(&filepathLen), sizeof(filepathLen));
+        song.filepath.resize(filepathLen);
+        file.read(&song.filepath[0], filepathLen);
+
+        fs::path relativePath(song.filepath);
+        fs::path fullPath = fs::current_path() / relativePath;
+        song.filepath = fullPath.lexically_normal().string();
 
-        // Truncate text if too long
-        string title = playlist[i].title.length() > 30 ? playlist[i].title.substr(0, 27) + "..." : playlist[i].title;
-        string album = playlist[i].album.length() > 20 ? playlist[i].album.substr(0, 17) + "..." : playlist[i].album;
+        file.read(reinterpret_cast<char*>(&albumLen), sizeof(albumLen));
+        song.album.resize(albumLen);
+        file.read(&song.album[0], albumLen);
 
-        cout << rowColor
-             << "║ " << setw(2) << i + 1 << " │ "
-             << setw(36) << left << title << " │ "
-             << setw(20) << left << album << " │ "
-             << setw(4) << right << playlist[i].year << " │ "
-             << setw(8) << right << formatDuration(playlist[i].duration) << " ║\n";
+        file.read(reinterpret_cast<char*>(&song.year), sizeof(song.year));
+        file.read(reinterpret_cast<char*>(&song.duration), sizeof(song.duration));
 
-        if (i < playlist.size() - 1)
+        if (file)
         {
-            cout << CYAN << "╟────┼──────────────────────────────────────┼──────────────────────┼──────┼──────────╢\n";
+            playlist.add(song);
         }
     }
-
-    // Table footer
-    cout << CYAN << "╚════╧──────────────────────────────────────┴──────────────────────┴──────┴──────────╝" << RESET << "\n";
 }
 
-void displayProgress(sf::Music& music, const Song& song, bool isPaused, float& volume)
+void compactPlaylist(const SongStore& playlist, PlaylistJournal& journal)
 {
-    static string lastDisplay = "";
-
-    float duration = music.getDuration().asSeconds();
-    float currentTime = music.getPlayingOffset().asSeconds();
-    float percentage = (currentTime / duration) * 100;
-    int volumeInt = static_cast<int>(volume);
+    if (journal.readOnly)
+    {
+        return;
+    }
 
-    stringstream ss;
+    // The snapshot records how far the journal got, so a crash before the
+    // writer truncates the journal only makes the next load skip records
+    submitSnapshot(journal.writer, playlist, journal.nextSequence - 1);
+    journal.recordCount = 0;
+}
 
-    displayNowPlaying(song, isPaused, ss);
-    ss << "\n";
-    // Progress bar
-    string progressBar = getProgressBar(percentage, isPaused);
-    ss << YELLOW << progressBar << RESET << "\n";
+// Journal payload encoding
+void putU32(string& out, uint32_t value)
+{
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
 
-    // Time and Volume display
-    string timeDisplay = formatDuration(currentTime) + " / " + formatDuration(duration);
-    string volumeDisplay = "Volume: " + to_string(volumeInt) + "%";
-    ss << YELLOW << timeDisplay << RESET << "   " << GREEN << volumeDisplay << RESET << "\n\n";
+void putString(string& out, const string& text)
+{
+    putU32(out, static_cast<uint32_t>(text.size()));
+    out += text;
+}
 
-    // Controls
-    ss << CYAN << "Controls:" << RESET << "\n";
-    vector<string> controls =
-    {
-        "⏯  Space: Play/Pause",
-        "⏹  Q: Stop",
-        "🔁  R: Restart",
-        "⏪⏩ <,>: Seek",
-        "🔈🔊 -,+: Volume",
-        "❌ ESC: Exit Program"
-    };
+void putSong(string& out, const Song& song)
+{
+    const fs::path basePath = fs::current_path();
+    const string basePrefix = basePath.string() + string(1, fs::path::preferred_separator);
+
+    putString(out, song.title);
+    putString(out, song.artist);
+    putString(out, storedPathFor(song.filepath, basePath, basePrefix));
+    putString(out, song.album);
+    out.append(reinterpret_cast<const char*>(&song.year), sizeof(song.year));
+    out.append(reinterpret_cast<const char*>(&song.duration), sizeof(song.duration));
+}
 
-    for (const auto& control : controls)
+bool readSong(PayloadReader& reader, Song& song, const fs::path& basePath, const string& basePrefix)
+{
+    string_view title, artist, filepath, album;
+    if (!reader.readString(title) || !reader.readString(artist) ||
+        !reader.readString(filepath) || !reader.readString(album) ||
+        reader.data.size() - reader.pos < sizeof(song.year) + sizeof(song.duration))
     {
-        ss << CYAN << "- " << control << RESET << "\n";
+        return false;
     }
+    song.title = title;
+    song.artist = artist;
+    song.filepath = resolveStoredPath(filepath, basePath, basePrefix);
+    song.album = album;
+    memcpy(&song.year, reader.data.data() + reader.pos, sizeof(song.year));
+    memcpy(&song.duration, reader.data.data() + reader.pos + sizeof(song.year), sizeof(song.duration));
+    reader.pos += sizeof(song.year) + sizeof(song.duration);
+    return true;
+}
 
-    string currentDisplay = ss.str();
-    if (currentDisplay != lastDisplay)
+void appendJournal(PlaylistJournal& journal, JournalOp op, const string& payload)
+{
+    if (journal.readOnly)
     {
-        cout << "\033[3;1H";
-        cout << "\033[J";
-        cout << currentDisplay << flush;
-        lastDisplay = currentDisplay;
+        return;
     }
+
+    JournalRecordHeader header = {};
+    header.payloadSize = static_cast<uint32_t>(payload.size());
+    header.op = op;
+    header.sequence = journal.nextSequence++;
+
+    string record(reinterpret_cast<const char*>(&header), sizeof(header));
+    record += payload;
+    uint64_t checksum = checksumBytes(record.data(), record.size());
+    record.append(reinterpret_cast<const char*>(&checksum), sizeof(checksum));
+
+    // One small append per edit, handed to the writer thread
+    submitJournalRecord(journal.writer, record);
+    journal.recordCount++;
 }
 
+void journalAdd(PlaylistJournal& journal, const Song& song)
+{
+    string payload;
+    putSong(payload, song);
+    appendJournal(journal, JOURNAL_ADD, payload);
+}
 
-void displayError(const string& message)
+void journalRemove(PlaylistJournal& journal, size_t index)
 {
-    cout << RED << BOLD << "Error: " << message << RESET << "\n";
-    this_thread::sleep_for(chrono::seconds(2));
+    string payload;
+    putU32(payload, static_cast<uint32_t>(index));
+    appendJournal(journal, JOURNAL_REMOVE, payload);
 }
 
-void displaySuccess(const string& message)
+void journalEdit(PlaylistJournal& journal, size_t index, const Song& song)
 {
-    cout << GREEN << BOLD << "Success: " << message << RESET << "\n";
-    this_thread::sleep_for(chrono::seconds(2));
+    string payload;
+    putU32(payload, static_cast<uint32_t>(index));
+    putSong(payload, song);
+    appendJournal(journal, JOURNAL_EDIT, payload);
 }
 
-void displayInfo(const string& message)
+void journalReorder(PlaylistJournal& journal, const vector<uint32_t>& order)
 {
-    cout << BLUE << BOLD << "Info: " << message << RESET << "\n";
+    string payload;
+    putU32(payload, static_cast<uint32_t>(order.size()));
+    payload.append(reinterpret_cast<const char*>(order.data()), order.size() * sizeof(uint32_t));
+    appendJournal(journal, JOURNAL_REORDER, payload);
 }
 
-void displayHelp()
+uint64_t replayJournal(SongStore& playlist, uint64_t snapshotSequence)
 {
-    clearScreen();
+    MappedFile file;
+    if (!file.open(PLAYLIST_JOURNAL_FILE)) return snapshotSequence;
 
-    cout << MAGENTA << BOLD << "╔══════════════════════════════════════════════════════╗" << '\n';
-    cout << "║                🎵 BTS Music Player Help 🎵           ║" << '\n';
-    cout << "╠══════════════════════════════════════════════════════╣" << RESET << '\n';
+    const fs::path basePath = fs::current_path();
+    const string basePrefix = basePath.string() + string(1, fs::path::preferred_separator);
+    uint64_t lastSequence = snapshotSequence;
+    size_t pos = 0;
 
-    cout << '\n';
-    // Navigation Controls Section
-    cout << CYAN << BOLD << "Navigation Controls:" << RESET << "\n";
-    cout << GREEN << "• " << RESET << "Use number keys to select menu options\n";
-    cout << GREEN << "• " << RESET << "Press Enter to confirm selections\n\n";
+    while (file.size - pos >= sizeof(JournalRecordHeader) + sizeof(uint64_t))
+    {
+        JournalRecordHeader header;
+        memcpy(&header, file.data + pos, sizeof(header));
 
-    // Playback Controls Section
-    cout << CYAN << BOLD << "Playback Controls:" << RESET << "\n";
-    cout << YELLOW << "• " << RESET << "Space: Play/Pause\n";
-    cout << YELLOW << "• " << RESET << "Q: Stop current song\n";
-    cout << YELLOW << "• " << RESET << "R: Restart song\n";
-    cout << YELLOW << "• " << RESET << "<: Rewind 5 seconds\n";
-    cout << YELLOW << "• " << RESET << ">: Forward 5 seconds\n";
-    cout << YELLOW << "• " << RESET << "ESC: Exit to main menu\n\n";
+        size_t recordSize = sizeof(header) + header.payloadSize;
+        if (file.size - pos - sizeof(uint64_t) < recordSize)
+        {
+            break;  // Torn write at the tail
+        }
 
-    cout << CYAN << BOLD << "Volume Controls:" << RESET << "\n";
-    cout << BLUE << "• " << RESET << "-: Decrease volume\n";
-    cout << BLUE << "• " << RESET << "+ or /: Increase volume\n\n";
+        uint64_t checksum;
+        memcpy(&checksum, file.data + pos + recordSize, sizeof(checksum));
+        if (checksumBytes(file.data + pos, recordSize) != checksum)
+        {
+            break;
+        }
 
-    cout << CYAN << BOLD << "File Management:" << RESET << "\n";
-    cout << BLUE << "• " << RESET << "Supported formats: .wav, .ogg, .flac" << '\n';
-    cout << BLUE << "• " << RESET << "Playlist is automatically saved\n";
-    cout << BLUE << "• " << RESET << "Use absolute paths or relative paths from program directory\n\n";
+        PayloadReader reader;
+        reader.data = string_view(file.data + pos + sizeof(header), header.payloadSize);
+        pos += recordSize + sizeof(checksum);
 
-    cout << MAGENTA << BOLD << "╚══════════════════════════════════════════════════════╝" << '\n';
-    cout << "\n" << CYAN << "Press Enter to return to menu..." << RESET;
-    cin.get();
+        // Records already folded into the snapshot are skipped
+        if (header.sequence <= snapshotSequence)
+        {
+            continue;
+        }
+
+        // Removes and edits address songs by position, so nothing after a
+        // lost record can be applied safely
+        if (header.sequence != lastSequence + 1)
+        {
+            break;
+        }
+        lastSequence = header.sequence;
+
+        uint32_t index;
+        Song song;
+        switch (header.op)
+        {
+            case JOURNAL_ADD:
+                if (readSong(reader, song, basePath, basePrefix))
+                {
+                    playlist.add(song);
+                }
+                break;
+            case JOURNAL_REMOVE:
+                if (reader.readU32(index) && index < playlist.size())
+                {
+                    playlist.erase(index);
+                }
+                break;
+            case JOURNAL_EDIT:
+                if (reader.readU32(index) && index < playlist.size() &&
+                    readSong(reader, song, basePath, basePrefix))
+                {
+                    playlist.set(index, song);
+                }
+                break;
+            case JOURNAL_REORDER:
+            {
+                uint32_t count;
+                if (!reader.readU32(count) || count != playlist.size() ||
+                    reader.data.size() - reader.pos < count * sizeof(uint32_t))
+                {
+                    break;
+                }
+
+                vector<uint32_t> order(count);
+                memcpy(order.data(), reader.data.data() + reader.pos, count * sizeof(uint32_t));
+
+                // Only apply orders that are a true permutation
+                vector<bool> used(count, false);
+                size_t valid = 0;
+                for (uint32_t from : order)
+                {
+                    if (from >= count || used[from]) break;
+                    used[from] = true;
+                    ++valid;
+                }
+                if (valid == count)
+                {
+                    playlist.permute(order);
+                }
+                break;
+            }
+        }
+    }
+    return lastSequence;
 }
 
-void displayLogo()
+string storedPathFor(const string& filepath, const fs::path& basePath, const string& basePrefix)
 {
-    cout << MAGENTA << BOLD;
-    cout << R"(
-    ╔═══════════════════════════════════════════════╗
-    ║     ♪♫•*¨*•.¸¸♫♪ BTS PLAYER ♪♫•*¨*•.¸¸♫♪      ║
-    ╚═══════════════════════════════════════════════╝
-)" << RESET << '\n';
+    // Purely lexical: fs::proximate would touch the filesystem for every song
+    if (filepath.compare(0, basePrefix.size(), basePrefix) == 0)
+    {
+        return filepath.substr(basePrefix.size());
+    }
+    return fs::path(filepath).lexically_proximate(basePath).string();
 }
 
-void displayNowPlaying(const Song& song, bool isPaused, ostream& out)
+string resolveStoredPath(string_view storedPath, const fs::path& basePath, const string& basePrefix)
 {
-    // Playing status
-    string status = isPaused ? "⏸️ PAUSED" : "▶️ NOW PLAYING";
+    // Stored paths are relative to the working directory; plain ones are joined
+    // by concatenation instead of a fs::path round trip per song
+    bool plainRelative = !storedPath.empty() &&
+                         storedPath[0] != '/' && storedPath[0] != '\\' &&
+                         storedPath.find(':') == string_view::npos &&
+                         storedPath.find("..") == string_view::npos &&
+                         storedPath.find("./") == string_view::npos &&
+                         storedPath.find(".\\") == string_view::npos;
+    if (plainRelative)
+    {
+        string resolved;
+        resolved.reserve(basePrefix.size() + storedPath.size());
+        resolved = basePrefix;
+        resolved += storedPath;
+        return resolved;
+    }
+    return (basePath / fs::path(storedPath)).lexically_normal().string();
+}
 
-    // Song details
-    string title = song.title + " - " + song.artist;
-    string album = "Album: " + song.album + " (" + to_string(song.year) + ")";
+bool writeFileData(const string& path, const string& data, bool append)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr,
+                             append ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
 
-    // Display the now-playing information
-    out << MAGENTA << BOLD << status << RESET << "\n";
-    out << GREEN << BOLD << title << RESET << "\n";
-    out << BLUE << album << RESET << "\n";
+    bool ok = true;
+    if (append)
+    {
+        LARGE_INTEGER zero = {};
+        ok = SetFilePointerEx(file, zero, nullptr, FILE_END);
+    }
+
+    size_t written = 0;
+    while (ok && written < data.size())
+    {
+        DWORD chunk = static_cast<DWORD>(min<size_t>(data.size() - written, 1u << 30));
+        DWORD count = 0;
+        ok = WriteFile(file, data.data() + written, chunk, &count, nullptr) && count > 0;
+        written += count;
+    }
+
+    // Make sure the bytes are on disk before anyone relies on them
+    ok = ok && FlushFileBuffers(file);
+    CloseHandle(file);
+    return ok;
+#else
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0644);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    size_t written = 0;
+    while (ok && written < data.size())
+    {
+        ssize_t count = ::write(fd, data.data() + written, data.size() - written);
+        ok = count > 0;
+        written += ok ? count : 0;
+    }
+
+    ok = ok && fsync(fd) == 0;
+    ::close(fd);
+    return ok;
+#endif
 }
 
-// File I/O
-void savePlaylist(const vector<Song>& playlist)
+bool writeFileAtomically(const string& path, const string& data)
 {
-    ofstream file("playlist_data/playlist.dat", ios::binary);
-    size_t size = playlist.size();
-    file.write(reinterpret_cast<const char*>(&size), sizeof(size));
-
-    for (const auto& song : playlist)
+    // Write a temp file, flush it, then rename it over the original so a
+    // crash leaves either the old or the new file, never a torn one
+    string tempPath = path + ".tmp";
+    if (!writeFileData(tempPath, data, false))
     {
-        // Convert absolute path to relative path for storage
-        fs::path fullPath(song.filepath);
-        fs::path relativePath = fs::proximate(fullPath, fs::current_path());
-        string relativePathStr = relativePath.string();
+        return false;
+    }
+#ifdef _WIN32
+    return MoveFileEx(tempPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH);
+#else
+    return rename(tempPath.c_str(), path.c_str()) == 0;
+#endif
+}
 
-        size_t titleLen = song.title.length();
-        size_t artistLen = song.artist.length();
-        size_t filepathLen = relativePathStr.length();
-        size_t albumLen = song.album.length();
+void startPlaylistWriter(PlaylistWriter& writer)
+{
+    writer.stopping = false;
+    writer.worker = thread(runPlaylistWriter, ref(writer));
+}
 
-        // Write data using relative path
-        file.write(reinterpret_cast<const char*>(&titleLen), sizeof(titleLen));
-        file.write(song.title.c_str(), titleLen);
-        file.write(reinterpret_cast<const char*>(&artistLen), sizeof(artistLen));
-        file.write(song.artist.c_str(), artistLen);
-        file.write(reinterpret_cast<const char*>(&filepathLen), sizeof(filepathLen));
-        file.write(relativePathStr.c_str(), filepathLen);
-        file.write(reinterpret_cast<const char*>(&albumLen), sizeof(albumLen));
-        file.write(song.album.c_str(), albumLen);
-        file.write(reinterpret_cast<const char*>(&song.year), sizeof(song.year));
-        file.write(reinterpret_cast<const char*>(&song.duration), sizeof(song.duration));
+void stopPlaylistWriter(PlaylistWriter& writer)
+{
+    {
+        lock_guard<mutex> guard(writer.lock);
+        writer.stopping = true;
+    }
+    writer.wake.notify_one();
+    if (writer.worker.joinable())
+    {
+        writer.worker.join();
     }
 }
 
-void loadPlaylist(vector<Song>& playlist)
+void runPlaylistWriter(PlaylistWriter& writer)
 {
-    ifstream file("playlist_data/playlist.dat", ios::binary);
-    if (!file) return;
+    unique_lock<mutex> guard(writer.lock);
+    int retryMs = WRITER_RETRY_MS;
+    int exitAttempts = 0;               // Failed writes since stopping was asked for
 
-    size_t size;
-    file.read(reinterpret_cast<char*>(&size), sizeof(size));
+    auto hasWork = [&]
+    {
+        return writer.snapshotPending || (!writer.journalBytes.empty() && !writer.journalBroken);
+    };
 
-    for (size_t i = 0; i < size; ++i)
+    while (true)
     {
-        Song song;
-        size_t titleLen, artistLen, filepathLen, albumLen;
+        writer.wake.wait(guard, [&] { return writer.stopping || hasWork(); });
 
-        file.read(reinterpret_cast<char*>(&titleLen), sizeof(titleLen));
-        song.title.resize(titleLen);
-        file.read(&song.title[0], titleLen);
+        if (!hasWork() || exitAttempts >= WRITER_EXIT_ATTEMPTS)
+        {
+            break;  // Stopping with nothing left to write, or nothing that can be written
+        }
 
-        file.read(reinterpret_cast<char*>(&artistLen), sizeof(artistLen));
-        song.artist.resize(artistLen);
-        file.read(&song.artist[0], artistLen);
+        // Take the whole batch and release the lock before touching the disk
+        bool writeSnapshot = writer.snapshotPending;
+        SongStore snapshot = move(writer.snapshot);
+        uint64_t snapshotSequence = writer.snapshotSequence;
+        string journalBytes = move(writer.journalBytes);
+        size_t requests = writer.pendingRequests;
+
+        writer.snapshotPending = false;
+        writer.snapshot = SongStore();
+        writer.journalBytes.clear();
+        writer.pendingRequests = 0;
+        guard.unlock();
+
+        auto start = chrono::steady_clock::now();
+        bool snapshotOk = !writeSnapshot ||
+                          (writeFileAtomically(PLAYLIST_FILE, serializePlaylist(snapshot, snapshotSequence)) &&
+                           writeFileData(PLAYLIST_JOURNAL_FILE, "", false));
+        bool journalOk = snapshotOk && (journalBytes.empty() || writeFileData(PLAYLIST_JOURNAL_FILE, journalBytes, true));
+        bool ok = snapshotOk && journalOk;
+        double latencyMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+        guard.lock();
+        writer.stats.writes++;
+        writer.stats.merged += requests > 1 ? requests - 1 : 0;
+        writer.stats.failures += ok ? 0 : 1;
+        writer.stats.lastLatencyMs = latencyMs;
+        writer.stats.maxLatencyMs = max(writer.stats.maxLatencyMs, latencyMs);
+        writer.stats.totalLatencyMs += latencyMs;
+        writer.failing = !ok;
+
+        if (ok)
+        {
+            writer.journalBroken = writer.journalBroken && !writeSnapshot;
+            retryMs = WRITER_RETRY_MS;
+            continue;
+        }
 
-        file.read(reinterpret_cast<char*>(&filepathLen), sizeof(filepathLen));
-        song.filepath.resize(filepathLen);
-        file.read(&song.filepath[0], filepathLen);
+        // Put the batch back in front of anything queued meanwhile. A newer
+        // snapshot already covers both the old snapshot and its records.
+        writer.stats.retries++;
+        if (!writer.snapshotPending)
+        {
+            if (!snapshotOk)
+            {
+                writer.snapshotPending = true;
+                writer.snapshot = move(snapshot);
+                writer.snapshotSequence = snapshotSequence;
+            }
+            writer.journalBytes.insert(0, journalBytes);
+        }
+        writer.pendingRequests += requests;
+        if (snapshotOk && !journalOk)
+        {
+            writer.journalBroken = true;
+            writer.snapshotWanted = true;
+        }
 
-        fs::path relativePath(song.filepath);
-        fs::path fullPath = fs::current_path() / relativePath;
-        song.filepath = fullPath.lexically_normal().string();
+        // Back off before the next try. Asking to stop cuts the wait short
+        // once; after that, exit waits at most a second between tries.
+        bool wasStopping = writer.stopping;
+        exitAttempts += wasStopping ? 1 : 0;
+        int delayMs = wasStopping ? min(retryMs, 1000) : retryMs;
+        writer.wake.wait_for(guard, chrono::milliseconds(delayMs), [&] { return writer.stopping != wasStopping; });
+        retryMs = min(retryMs * 2, WRITER_RETRY_MAX_MS);
+    }
+}
 
-        file.read(reinterpret_cast<char*>(&albumLen), sizeof(albumLen));
-        song.album.resize(albumLen);
-        file.read(&song.album[0], albumLen);
+void submitSnapshot(PlaylistWriter& writer, const SongStore& playlist, uint64_t journalSequence)
+{
+    {
+        lock_guard<mutex> guard(writer.lock);
+        // A snapshot covers every journal record queued before it
+        writer.snapshotPending = true;
+        writer.snapshot = playlist;
+        writer.snapshotSequence = journalSequence;
+        writer.journalBytes.clear();
+        writer.pendingRequests++;
+        writer.stats.requests++;
+    }
+    writer.wake.notify_one();
+}
 
-        file.read(reinterpret_cast<char*>(&song.year), sizeof(song.year));
-        file.read(reinterpret_cast<char*>(&song.duration), sizeof(song.duration));
+void submitJournalRecord(PlaylistWriter& writer, const string& record)
+{
+    {
+        lock_guard<mutex> guard(writer.lock);
+        writer.journalBytes += record;
+        writer.pendingRequests++;
+        writer.stats.requests++;
+    }
+    writer.wake.notify_one();
+}
 
-        playlist.push_back(song);
+bool pollPlaylistWriter(PlaylistWriter& writer)
+{
+    // Called by the UI after each action: tells the user once per run of
+    // failures and returns true when the writer needs a fresh snapshot
+    bool showFailure, wantSnapshot;
+    {
+        lock_guard<mutex> guard(writer.lock);
+        showFailure = writer.failing && !writer.failureShown;
+        writer.failureShown = writer.failing;
+        wantSnapshot = writer.snapshotWanted;
+        writer.snapshotWanted = false;
+    }
+    if (showFailure)
+    {
+        displayError("The playlist could not be saved to disk. Retrying in the background...");
     }
+    return wantSnapshot;
 }